@@ -1,5 +1,56 @@
 #include "app.h"
 
+app::app(int argc, char const* argv[]) {
+	// usage: vkExperiment [--instances N] [--particles N] [--lights N] [--bench-pipelines] [--bench-particles] [--bench-lights] [--bench-occlusion] [--trace-allocations] [--profile trace.json] [--memory-budget MB] [mesh.obj|mesh.gltf|mesh.glb]
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+			instanceCount = static_cast<uint32_t>(std::max(1l, std::strtol(argv[++i], nullptr, 10)));
+		else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc)
+			particleCapacity = static_cast<uint32_t>(std::max(1l, std::strtol(argv[++i], nullptr, 10)));
+		else if (strcmp(argv[i], "--bench-particles") == 0)
+			particleBenchmark = true;
+		else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+			lightCount = static_cast<uint32_t>(std::clamp(std::strtol(argv[++i], nullptr, 10), 0l, long(maxLightCount)));
+		else if (strcmp(argv[i], "--bench-lights") == 0) {
+			lightBenchmark = true;
+			lightCount = minLightCount;
+		}
+		else if (strcmp(argv[i], "--bench-occlusion") == 0) {
+			occlusionBenchmark = true;
+			hiZCulling = false; // the first report is without it
+		}
+		else if (strcmp(argv[i], "--bench-pipelines") == 0)
+			pipelineBenchmark = true;
+		else if (strcmp(argv[i], "--trace-allocations") == 0)
+			traceAllocations = true;
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+			profilePath = argv[++i];
+		else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc)
+			simulatedBudget = static_cast<uint64_t>(std::max(1l, std::strtol(argv[++i], nullptr, 10))) * 1024 * 1024;
+		else
+			meshPath = argv[i];
+	}
+	if (occlusionBenchmark && instanceCount == 1) // a field of instances to walk through, most of them hidden behind the nearest
+		instanceCount = occlusionBenchmarkInstances;
+#ifdef ENABLE_PROFILER
+	if (profilePath != nullptr)
+		cout << "Profiling into " << profilePath << ", " << profiler::measureZoneOverhead() << " ns per zone" << endl;
+#else
+	if (profilePath != nullptr)
+		cout << "Built without the profiler, --profile needs make PROFILE=1" << endl;
+#endif
+}
+
+void app::writeProfile() {
+#ifdef ENABLE_PROFILER
+	if (profilePath == nullptr) return;
+	if (profiler::exportChromeTrace(profilePath))
+		cout << "Profile written to " << profilePath << ", open it in chrome://tracing or ui.perfetto.dev" << endl;
+	else
+		cerr << "Failed to write profile to " << profilePath << endl;
+#endif
+}
+
 void app::initGLFW() {
 	glfwInit();
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -82,7 +133,7 @@ void app::createInstance() {
 	}
 
 	// create the instance with the specified info, report failure
-	if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS)
+	if (vkCreateInstance(&createInfo, host.callbacks(), &instance) != VK_SUCCESS)
 		throw std::runtime_error("Vulkan instance creation failed!");
 }
 
@@ -117,7 +168,7 @@ void app::initDebugCallback() {
 	createInfo.pfnUserCallback = debugCallback;
 	createInfo.pUserData = nullptr; // Optional
 
-	if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS)
+	if (CreateDebugUtilsMessengerEXT(instance, &createInfo, host.callbacks(), &debugMessenger) != VK_SUCCESS)
    	throw std::runtime_error("Failed to set up debug messenger callback!");
 }
 
@@ -128,7 +179,7 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
 }
 
 void app::createSurface() {
-	if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
+	if (glfwCreateWindowSurface(instance, window, host.callbacks(), &surface) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create window surface!");
 }
 
@@ -220,6 +271,40 @@ void app::pickPhysicalDevice() {
 	if (physicalDevice == VK_NULL_HANDLE) throw std::runtime_error("Failed to find a suitable GPU!");
 }
 
+void app::pickSampleCount() {
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	supportedSampleCounts = deviceProperties.limits.framebufferColorSampleCounts;
+
+	// both the color and depth attachments share the sample count
+	supportedSampleCounts &= deviceProperties.limits.framebufferDepthSampleCounts;
+
+	// take the highest supported count which does not exceed the requested one - 1x is always supported
+	msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+	for (VkSampleCountFlags count = desiredMsaaSamples; count > VK_SAMPLE_COUNT_1_BIT; count >>= 1)
+		if (supportedSampleCounts & count) {
+			msaaSamples = static_cast<VkSampleCountFlagBits>(count);
+			break;
+		}
+	cout << "Using " << msaaSamples << "x MSAA" << endl;
+}
+
+void app::cycleSampleCount() {
+	// step to the next supported sample count, wrapping back around to 1x
+	VkSampleCountFlags next = msaaSamples;
+	do {
+		next <<= 1;
+		if (next > VK_SAMPLE_COUNT_64_BIT) next = VK_SAMPLE_COUNT_1_BIT;
+	} while (!(supportedSampleCounts & next));
+	msaaSamples = static_cast<VkSampleCountFlagBits>(next);
+	framebufferResized = true; // render pass, pipeline and framebuffers all depend on the sample count
+}
+
+void app::toggleDepthPrepass() {
+	depthPrepass = !depthPrepass;
+	framebufferResized = true; // changes the subpass layout of the render pass, so everything downstream is rebuilt
+}
+
 void app::createLogicalDevice() {
 	QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
@@ -239,15 +324,72 @@ void app::createLogicalDevice() {
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
 
-	VkPhysicalDeviceFeatures deviceFeatures{};	// currently empty
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+	VkPhysicalDeviceFeatures deviceFeatures{};
+	deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery; // for counting fragment invocations
+	deviceFeatures.inheritedQueries = supportedFeatures.inheritedQueries; // over the command chunks executed in the render pass
+	pipelineStatisticsSupported = supportedFeatures.pipelineStatisticsQuery == VK_TRUE && supportedFeatures.inheritedQueries == VK_TRUE;
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect; // one indirect draw per visible meshlet
+	deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance; // which picks the instance transform
+	multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE && supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+	meshletCulling = meshletCulling && multiDrawIndirectSupported;
+	cpuCulling = !multiDrawIndirectSupported; // culls whole instances on the CPU instead
+	deviceFeatures.shaderStorageImageWriteWithoutFormat = supportedFeatures.shaderStorageImageWriteWithoutFormat; // tonemapping into BGRA
+	storageWriteWithoutFormatSupported = supportedFeatures.shaderStorageImageWriteWithoutFormat == VK_TRUE;
+	deviceFeatures.shaderStorageImageArrayDynamicIndexing = supportedFeatures.shaderStorageImageArrayDynamicIndexing; // the depth pyramid's levels
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	timestampPeriod = deviceProperties.limits.timestampPeriod; // nanoseconds per tick, for the GPU stage timings
+
+	// Hi-Z culling builds on meshlet culling, and reduces the depth buffer into an array of storage images, one per level
+	VkFormatProperties depthProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, depthFormat, &depthProperties);
+	hiZSupported = multiDrawIndirectSupported && supportedFeatures.shaderStorageImageArrayDynamicIndexing == VK_TRUE &&
+		(depthProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) && deviceProperties.limits.maxPerStageDescriptorStorageImages >= maxPyramidLevels;
+	hiZSampleCounts = hiZSupported ? deviceProperties.limits.sampledImageDepthSampleCounts : 0;
+	hiZCulling = hiZCulling && hiZSupported;
+
+	// the draw count written by the culling pass is read on the GPU with vkCmdDrawIndexedIndirectCount, core in 1.2
+	VkPhysicalDeviceVulkan12Features vulkan12Features{};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	vulkan12Features.pNext = nullptr;
+	if (deviceProperties.apiVersion >= VK_API_VERSION_1_2) {
+		VkPhysicalDeviceFeatures2 supportedFeatures2{};
+		supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		supportedFeatures2.pNext = &vulkan12Features;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
+		drawIndirectCountSupported = vulkan12Features.drawIndirectCount == VK_TRUE;
+		vulkan12Features = VkPhysicalDeviceVulkan12Features{}; // only enable what's used
+		vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		vulkan12Features.drawIndirectCount = drawIndirectCountSupported ? VK_TRUE : VK_FALSE;
+	}
+
+	// per heap budgets, where the driver knows them - otherwise the residency manager has to guess
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+	std::vector<const char*> enabledExtensions = deviceExtensions;
+	for (const auto& extension : availableExtensions)
+		if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+			enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+			memoryBudgetSupported = true;
+		}
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+	deviceLocalHeap = memoryProperties.memoryTypes[findMemoryType(~0u, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).value_or(0)].heapIndex;
+
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	createInfo.pNext = nullptr;
+	createInfo.pNext = deviceProperties.apiVersion >= VK_API_VERSION_1_2 ? &vulkan12Features : nullptr;
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	createInfo.pEnabledFeatures = &deviceFeatures;
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
-   createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+	createInfo.ppEnabledExtensionNames = enabledExtensions.data();
+   createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
 
 	if (enableValidationLayers) {
 		createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -256,12 +398,13 @@ void app::createLogicalDevice() {
 		createInfo.enabledLayerCount = 0;
 	}
 
-	if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS)
+	if (vkCreateDevice(physicalDevice, &createInfo, host.callbacks(), &device) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create logical device!");
 
 	// creating the queue objects
 	vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
 	vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+	deletions.init(device);
 }
 
 SwapchainSupportDetails app::querySwapchainSupport(VkPhysicalDevice device) {
@@ -288,7 +431,17 @@ SwapchainSupportDetails app::querySwapchainSupport(VkPhysicalDevice device) {
 	return details;
 }
 
-VkSurfaceFormatKHR app::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
+VkSurfaceFormatKHR app::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats, bool storageUsage) {
+	// the tonemapping pass does its own sRGB encoding, so it can only write a UNORM swapchain image directly
+	swapchainStorage = false;
+	if (storageUsage) {
+		for (const auto& availableFormat : availableFormats) {
+			if (availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR && storageOutputFormat(availableFormat.format)) {
+				swapchainStorage = true;
+				return availableFormat;
+			}
+		}
+	}
 	for (const auto& availableFormat : availableFormats) {
 		if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
 			return availableFormat; // pick 8bpc RGBA using an SRGB color space
@@ -324,7 +477,11 @@ VkExtent2D app::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
 void app::createSwapchain() {
 	SwapchainSupportDetails swapchainSupport = querySwapchainSupport(physicalDevice);
 
-	VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapchainSupport.formats);
+	const bool storageUsage = (swapchainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT) != 0;
+	VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapchainSupport.formats, storageUsage);
+	if (!swapchainStorage && surfaceFormat.format != VK_FORMAT_B8G8R8A8_SRGB && surfaceFormat.format != VK_FORMAT_R8G8B8A8_SRGB &&
+		surfaceFormat.format != VK_FORMAT_B8G8R8A8_UNORM && surfaceFormat.format != VK_FORMAT_R8G8B8A8_UNORM)
+		throw std::runtime_error("Failed to find a swapchain format to copy the tonemapped image into!");
 	VkPresentModeKHR presentMode = chooseSwapPresentMode(swapchainSupport.presentModes);
 	VkExtent2D extent = chooseSwapExtent(swapchainSupport.capabilities);
 
@@ -346,7 +503,9 @@ void app::createSwapchain() {
 	createInfo.imageColorSpace = surfaceFormat.colorSpace;
 	createInfo.imageExtent = extent;
 	createInfo.imageArrayLayers = 1; // this would change for e.g. stereoscopic 3d
-	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	// nothing renders into the swapchain image - the tonemapping pass either writes it, or its output is copied into it
+	// (color attachment usage only so that it can still have image views, every surface supports it)
+	createInfo.imageUsage = swapchainStorage ? VK_IMAGE_USAGE_STORAGE_BIT : VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
 	QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 	uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
@@ -377,10 +536,11 @@ void app::createSwapchain() {
 	// you will want to disable this flag if your application needs consistent readback of those pixels' results
 	createInfo.clipped = VK_TRUE;
 
-	// this is used in the case of swapchain recreation, when a new swapchain is created it must give a reference to the old one
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	// this is used in the case of swapchain recreation, when a new swapchain is created it must give a reference to the old
+	// one - which cleanupSwapchain has retired, but won't be destroyed before this one has presented
+	createInfo.oldSwapchain = swapchain;
 
-	if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapchain) != VK_SUCCESS)
+	if (vkCreateSwapchainKHR(device, &createInfo, host.swapchainCallbacks(), &swapchain) != VK_SUCCESS)
     	throw std::runtime_error("failed to create swapchain!");
 
 	vkGetSwapchainImagesKHR(device, swapchain, &imageCount, nullptr);
@@ -393,34 +553,217 @@ void app::createSwapchain() {
 
 void app::createImageViews() {
 	swapchainImageViews.resize(swapchainImages.size());
-	for (size_t i = 0; i < swapchainImages.size(); i++) {
-		VkImageViewCreateInfo createInfo{};
-		createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		createInfo.pNext = nullptr;
-		createInfo.image = swapchainImages[i];
-		createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		createInfo.format = swapchainImageFormat;
+	for (size_t i = 0; i < swapchainImages.size(); i++)
+		swapchainImageViews[i] = createImageView(swapchainImages[i], swapchainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+}
+
+VkImageView app::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t baseLevel, uint32_t levelCount) {
+	VkImageViewCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	createInfo.pNext = nullptr;
+	createInfo.image = image;
+	createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	createInfo.format = format;
+
+	// remapping the color channels if desired e.g. monochrome or constant value for a given channel
+	createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+	// describing image purpose - a range of mip levels (just the one, mostly) and a single layer
+	createInfo.subresourceRange.aspectMask = aspectFlags;
+	createInfo.subresourceRange.baseMipLevel = baseLevel;
+	createInfo.subresourceRange.levelCount = levelCount;
+	createInfo.subresourceRange.baseArrayLayer = 0;
+	createInfo.subresourceRange.layerCount = 1;
+
+	VkImageView imageView;
+	if (vkCreateImageView(device, &createInfo, host.swapchainCallbacks(), &imageView) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create image view!");
+	return imageView;
+}
+
+std::optional<uint32_t> app::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+	// typeFilter is a bitmask of the acceptable memory types, from VkMemoryRequirements
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+	return std::nullopt;
+}
+
+void app::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory, const VkAllocationCallbacks* allocator) {
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, allocator, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+	std::optional<uint32_t> memoryType = findMemoryType(memRequirements.memoryTypeBits, properties);
+	if (!memoryType.has_value())
+		throw std::runtime_error("Failed to find suitable memory type!");
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.pNext = nullptr;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = memoryType.value();
+
+	if (vkAllocateMemory(device, &allocInfo, allocator, &bufferMemory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate buffer memory!");
+	vkBindBufferMemory(device, buffer, bufferMemory, 0);
+}
 
-		// remapping the color channels if desired e.g. monochrome or constant value for a given channel
-		createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-		createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-		createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-		createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+void app::uploadBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory, host.callbacks());
+	void* mapped;
+	vkMapMemory(device, stagingBufferMemory, 0, size, 0, &mapped);
+	memcpy(mapped, data, static_cast<size_t>(size));
+	vkUnmapMemory(device, stagingBufferMemory);
 
-		// describing image purpose - here, just a color target with no mip levels and a single layer
-		createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		createInfo.subresourceRange.baseMipLevel = 0;
-		createInfo.subresourceRange.levelCount = 1;
-		createInfo.subresourceRange.baseArrayLayer = 0;
-		createInfo.subresourceRange.layerCount = 1;
+	createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory, host.callbacks());
 
-		// create the image views
-		if (vkCreateImageView(device, &createInfo, nullptr, &swapchainImageViews[i]) != VK_SUCCESS)
-		    throw std::runtime_error("Failed to create image views!");
+	// one-off command buffer for the copy - startup only, so waiting on the queue is fine
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate command buffers!");
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	VkBufferCopy copyRegion{};
+	copyRegion.srcOffset = 0;
+	copyRegion.dstOffset = 0;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(commandBuffer, stagingBuffer, buffer, 1, &copyRegion);
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(graphicsQueue);
+
+	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+	vkDestroyBuffer(device, stagingBuffer, host.callbacks());
+	vkFreeMemory(device, stagingBufferMemory, host.callbacks());
+}
+
+void app::createImage(uint32_t w, uint32_t h, VkSampleCountFlagBits samples, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t mipLevels) {
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.pNext = nullptr;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent.width = w;
+	imageInfo.extent.height = h;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = mipLevels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = format;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = usage;
+	imageInfo.samples = samples;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateImage(device, &imageInfo, host.swapchainCallbacks(), &image) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create image!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+	// lazily allocated memory is only a request - tile based GPUs expose it, most desktop GPUs do not
+	std::optional<uint32_t> memoryType = findMemoryType(memRequirements.memoryTypeBits, properties);
+	if (!memoryType.has_value() && (properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+		memoryType = findMemoryType(memRequirements.memoryTypeBits, properties & ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+	if (!memoryType.has_value())
+		throw std::runtime_error("Failed to find suitable memory type!");
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.pNext = nullptr;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = memoryType.value();
+
+	if (vkAllocateMemory(device, &allocInfo, host.swapchainCallbacks(), &imageMemory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate image memory!");
+	vkBindImageMemory(device, image, imageMemory, 0);
+}
+
+void app::createColorResources() {
+	// the HDR target is rendered (or resolved) into, then sampled by the post-processing chain
+	createImage(swapchainExtent.width, swapchainExtent.height, VK_SAMPLE_COUNT_1_BIT, hdrFormat,
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, hdrImage, hdrImageMemory);
+	hdrImageView = createImageView(hdrImage, hdrFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+	if (msaaSamples == VK_SAMPLE_COUNT_1_BIT) return; // rendering directly into the HDR target
+
+	// the multisampled image only lives for the duration of the subpass - it is resolved and then discarded, so it
+	// never needs backing memory on a tiler. transient usage + lazily allocated memory lets the driver skip it entirely.
+	// Except with Hi-Z culling, where it's carried from the early render pass over to the late one
+	if (hiZActive)
+		createImage(swapchainExtent.width, swapchainExtent.height, msaaSamples, hdrFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage, colorImageMemory);
+	else
+		createImage(swapchainExtent.width, swapchainExtent.height, msaaSamples, hdrFormat,
+			VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, colorImage, colorImageMemory);
+	colorImageView = createImageView(colorImage, hdrFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+}
+
+VkFormat app::findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
+	for (VkFormat format : candidates) { // candidates are in order of preference
+		VkFormatProperties props;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+		if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features)
+			return format;
+		else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features)
+			return format;
 	}
+	throw std::runtime_error("Failed to find supported format!");
+}
+
+void app::pickDepthFormat() {
+	// reversed-Z only buys precision with a floating point depth buffer - the exponent spends its precision near 0.0,
+	// which is where the far distances end up when the near plane maps to 1.0
+	depthFormat = findSupportedFormat({VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
+		VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+	if (depthFormat == VK_FORMAT_D24_UNORM_S8_UINT)
+		cout << "No float depth format available, reversed-Z will not improve depth precision" << endl;
 }
 
-static std::vector<char> readFile(const std::string& filename) {
+void app::createDepthResources() {
+	// like the multisampled color target, depth is never needed outside of the render pass - unless Hi-Z culling builds
+	// its pyramid out of it between the two render passes
+	if (hiZActive)
+		createImage(swapchainExtent.width, swapchainExtent.height, msaaSamples, depthFormat,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
+	else
+		createImage(swapchainExtent.width, swapchainExtent.height, msaaSamples, depthFormat,
+			VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, depthImage, depthImageMemory);
+	depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+}
+
+std::vector<char> readFile(const std::string& filename) {
 	std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
 	if (!file.is_open())
@@ -444,168 +787,46 @@ VkShaderModule app::createShaderModule(const std::vector<char>& code) {
 	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
 
 	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+	if (vkCreateShaderModule(device, &createInfo, host.callbacks(), &shaderModule) != VK_SUCCESS)
    	throw std::runtime_error("Failed to create shader module!");
 
 	return shaderModule;
 }
 
 
-void app::createGraphicsPipeline() {
-	auto vertShaderCode = readFile("shaders/vert.spv");
-	auto fragShaderCode = readFile("shaders/frag.spv");
-	VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-	VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-	// vertex stage
-	VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertShaderStageInfo.pNext = nullptr;
-	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageInfo.module = vertShaderModule;
-	vertShaderStageInfo.pName = "main"; // allows for different entry points (this seems worth investigating)
-
-	// fragment stage
-	VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-	fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragShaderStageInfo.pNext = nullptr;
-	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageInfo.module = fragShaderModule;
-	fragShaderStageInfo.pName = "main";
-
-	VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
-
-	// specifying the vertex input (currently hardcoded in the shader)
-	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	// two sets of pointers to array-of-structures to describe user specified vertex data
-	vertexInputInfo.vertexBindingDescriptionCount = 0;
-	vertexInputInfo.pVertexBindingDescriptions = nullptr;
-	vertexInputInfo.vertexAttributeDescriptionCount = 0;
-	vertexInputInfo.pVertexAttributeDescriptions = nullptr;
-
-	// specifies the manner in which the vertex data is used when assembling each primitive
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-	// region of the viewport which will be rendered to - this is typically (0,0) to (width,height)
-	VkViewport viewport{};
-	viewport.x = 0.0f;	viewport.width  = (float) swapchainExtent.width;
-	viewport.y = 0.0f;	viewport.height = (float) swapchainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	// scissor is maybe kind of like a stencil buffer? for only presenting part of framebuffer
-	VkRect2D scissor{};
-	scissor.offset = {0, 0};
-	scissor.extent = swapchainExtent;
-
-	// from these two, construct the viewport state
-	VkPipelineViewportStateCreateInfo viewportState{};
-	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
-	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
-
-	// rasterizer setup
-	VkPipelineRasterizationStateCreateInfo rasterizer{};
-	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterizer.depthClampEnable = VK_FALSE; // clamps depth to [0,1], used for e.g. shadow maps
-	rasterizer.rasterizerDiscardEnable = VK_FALSE; // if true, geometry never passes through rasterizer
-	rasterizer.polygonMode = VK_POLYGON_MODE_FILL; // filled, edge lines, points at vertices, etc
-	rasterizer.lineWidth = 1.0f; // width of lines drawn by the API - must use wideLines GPU feature for >1.0
-	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT; // culling mode: discard front/back/both/neither
-	rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE; // how to determine front/back (winding order)
-	rasterizer.depthBiasEnable = VK_FALSE; // sometimes used for shadow mapping, constant offset to depth value
-	rasterizer.depthBiasConstantFactor = 0.0f;
-	rasterizer.depthBiasClamp = 0.0f;
-	rasterizer.depthBiasSlopeFactor = 0.0f;
-
-	// will be revisited in the multisampling chapter, currently disabled
-	VkPipelineMultisampleStateCreateInfo multisampling{};
-	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.sampleShadingEnable = VK_FALSE;
-	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-	multisampling.minSampleShading = 1.0f;
-	multisampling.pSampleMask = nullptr;
-	multisampling.alphaToCoverageEnable = VK_FALSE;
-	multisampling.alphaToOneEnable = VK_FALSE;
-
-	// color blending - basic alpha blending
-	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachment.blendEnable = VK_TRUE;
-	colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-	colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-	colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-	colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-	colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-	colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
-
-	// more global settings re:blending
-	VkPipelineColorBlendStateCreateInfo colorBlending{};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlending.logicOpEnable = VK_FALSE; // apply bitwise ops to combine
-	colorBlending.logicOp = VK_LOGIC_OP_COPY;
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &colorBlendAttachment;
-	colorBlending.blendConstants[0] = 0.0f;
-	colorBlending.blendConstants[1] = 0.0f;
-	colorBlending.blendConstants[2] = 0.0f;
-	colorBlending.blendConstants[3] = 0.0f;
-
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 0; // Optional
-	pipelineLayoutInfo.pSetLayouts = nullptr; // Optional
-	pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-	pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
-
-	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
-	    throw std::runtime_error("Failed to create pipeline layout!");
-
-	VkGraphicsPipelineCreateInfo pipelineInfo{};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.stageCount = 2; // vertex and fragment shaders
-	pipelineInfo.pStages = shaderStages;
-
-	pipelineInfo.pVertexInputState = &vertexInputInfo;
-	pipelineInfo.pInputAssemblyState = &inputAssembly;
-	pipelineInfo.pViewportState = &viewportState;
-	pipelineInfo.pRasterizationState = &rasterizer;
-	pipelineInfo.pMultisampleState = &multisampling;
-	pipelineInfo.pDepthStencilState = nullptr; // Optional
-	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr; // can be used to vary linewidth or viewport size at runtime
-
-	pipelineInfo.layout = pipelineLayout;
-	pipelineInfo.renderPass = renderPass;
-	pipelineInfo.subpass = 0;
-
-	// this can use a base pipeline to create the current one, if many properties are in common
-	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
-	pipelineInfo.basePipelineIndex = -1; // Optional
-
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
-		throw std::runtime_error("Failed to create graphics pipeline!");
-
-	// destroy shader modules after pipeline creation is done
-	vkDestroyShaderModule(device, fragShaderModule, nullptr);
-	vkDestroyShaderModule(device, vertShaderModule, nullptr);
+// infinite far plane, reversed-Z projection - the near plane maps to depth 1.0 and infinity to 0.0. Also flips y, so that
+// counter-clockwise triangles in a y-up view space stay counter-clockwise in Vulkan's y-down framebuffer space
+static glm::mat4 reversedZPerspective(float fovy, float aspect, float zNear) {
+	const float f = 1.0f / std::tan(fovy * 0.5f);
+	glm::mat4 result(0.0f);
+	result[0][0] = f / aspect;
+	result[1][1] = -f;
+	result[2][3] = -1.0f; // w_clip = -z_view
+	result[3][2] = zNear; // z_clip = near, so depth = near / -z_view
+	return result;
 }
 
-
 void app::createRenderPass() {
+	// Hi-Z culling is settled for the swapchain here, the targets and the rest of its resources are made to match
+	hiZActive = hiZCulling && (hiZSampleCounts & msaaSamples) != 0;
+	renderPass = buildRenderPass(msaaSamples, depthPrepass, host.swapchainCallbacks());
+	if (hiZActive) {
+		earlyRenderPass = buildRenderPass(msaaSamples, depthPrepass, host.swapchainCallbacks(), earlyPhase);
+		lateRenderPass = buildRenderPass(msaaSamples, depthPrepass, host.swapchainCallbacks(), latePhase);
+	}
+}
+
+VkRenderPass app::buildRenderPass(VkSampleCountFlagBits samples, bool prepass, const VkAllocationCallbacks* allocator, renderPassPhase phase) {
+	const bool multisampled = samples != VK_SAMPLE_COUNT_1_BIT;
+
 	VkAttachmentDescription colorAttachment{};
-	colorAttachment.format = swapchainImageFormat;
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	colorAttachment.format = hdrFormat;
+	colorAttachment.samples = samples;
 
 	// what to do with the data in the attachment before and after rendering
 	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; // clear values to constant at start
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // rendered contents can be read from memory later
+	// multisampled contents are only needed until they are resolved, so they never have to be written out to memory
+	colorAttachment.storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
 
 	// same logic, but for the stencil application - disabled
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
@@ -613,71 +834,453 @@ void app::createRenderPass() {
 
 	// defines the pixel formats for the images - more detail in texture chapter
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // layout before pass begins - doesn't matter, as it is cleared anyways
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // layout after pass ends - ready for swapchain presentation
+	// layout after pass ends - ready for the post-processing chain to sample, unless this is the multisampled image
+	colorAttachment.finalLayout = multisampled ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	// single sampled HDR target that the multisampled color attachment is resolved into
+	VkAttachmentDescription resolveAttachment{};
+	resolveAttachment.format = hdrFormat;
+	resolveAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	resolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE; // fully overwritten by the resolve
+	resolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	resolveAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	resolveAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	resolveAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	resolveAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	// depth is cleared to 0.0 (the far plane, with reversed-Z) and discarded at the end of the pass
+	VkAttachmentDescription depthAttachment{};
+	depthAttachment.format = depthFormat;
+	depthAttachment.samples = samples;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	// two phase Hi-Z culling - the early pass keeps color and depth, and the late pass draws on top of both. Only load and
+	// store ops and layouts differ, the subpass dependencies are the same for all three, so they are compatible and share
+	// the framebuffers and pipelines. What happens between the two passes is synchronized by recordHiZCulling, which also
+	// moves depth in and out of the read only layout the pyramid is built from. The early pass' resolve is overwritten
+	// by the late one's
+	if (phase == earlyPhase) {
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		resolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	} else if (phase == latePhase) {
+		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	}
 
 	VkAttachmentReference colorAttachmentRef{};
 	colorAttachmentRef.attachment = 0; // this index is referenced directly with the layout(location = 0) out vec4 color in the shader
 	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; // layout of color attachment
 
+	VkAttachmentReference depthAttachmentRef{};
+	depthAttachmentRef.attachment = 1;
+	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	// after the pre-pass, the color subpass only tests against depth
+	VkAttachmentReference depthReadOnlyAttachmentRef{};
+	depthReadOnlyAttachmentRef.attachment = 1;
+	depthReadOnlyAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+	VkAttachmentReference resolveAttachmentRef{};
+	resolveAttachmentRef.attachment = 2;
+	resolveAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription prepassSubpass{};
+	prepassSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	prepassSubpass.colorAttachmentCount = 0;
+	prepassSubpass.pDepthStencilAttachment = &depthAttachmentRef;
+
 	VkSubpassDescription subpass{};
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &colorAttachmentRef;
+	subpass.pResolveAttachments = multisampled ? &resolveAttachmentRef : nullptr; // resolve happens at the end of the subpass
+	subpass.pDepthStencilAttachment = prepass ? &depthReadOnlyAttachmentRef : &depthAttachmentRef;
 
 	// attach these together and create
+	VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment, resolveAttachment};
+	VkSubpassDescription subpasses[] = {prepassSubpass, subpass};
 	VkRenderPassCreateInfo renderPassInfo{};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = 1;
-	renderPassInfo.pAttachments = &colorAttachment;
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
-
-	VkSubpassDependency dependency{};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
-
-	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
+	renderPassInfo.attachmentCount = multisampled ? 3 : 2;
+	renderPassInfo.pAttachments = attachments;
+	renderPassInfo.subpassCount = prepass ? 2 : 1;
+	renderPassInfo.pSubpasses = prepass ? subpasses : &subpass;
+
+	// color output waits on the previous frame's post-processing being done reading the HDR target, depth waits on the
+	// previous frame's depth tests being done with it
+	VkSubpassDependency colorDependency{};
+	colorDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	colorDependency.dstSubpass = prepass ? 1 : 0;
+	colorDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	colorDependency.srcAccessMask = 0;
+	colorDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	colorDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	VkSubpassDependency depthDependency{};
+	depthDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	depthDependency.dstSubpass = 0;
+	depthDependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	depthDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depthDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	depthDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// the color subpass tests against the depth written by the pre-pass - by region, so a tiler can keep it on chip
+	VkSubpassDependency prepassDependency{};
+	prepassDependency.srcSubpass = 0;
+	prepassDependency.dstSubpass = 1;
+	prepassDependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	prepassDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	prepassDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	prepassDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+	prepassDependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+	// and the post-processing chain samples what the color subpass wrote, or resolved
+	VkSubpassDependency postDependency{};
+	postDependency.srcSubpass = prepass ? 1 : 0;
+	postDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+	postDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	postDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	postDependency.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	postDependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkSubpassDependency dependencies[] = {colorDependency, depthDependency, postDependency, prepassDependency};
+	renderPassInfo.dependencyCount = prepass ? 4 : 3;
+	renderPassInfo.pDependencies = dependencies;
+
+	VkRenderPass result;
+	if (vkCreateRenderPass(device, &renderPassInfo, allocator, &result) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create render pass!");
+	return result;
 }
 
 void app::createFramebuffers() {
 	swapchainFramebuffers.resize(swapchainImageViews.size());
 	for (size_t i = 0; i < swapchainImageViews.size(); i++) {
-		VkImageView attachments[] = {swapchainImageViews[i]};
+		// with MSAA, the HDR target is the resolve target and the shared multisampled image is rendered to - depth is
+		// shared between all the framebuffers, it is only used within the render pass. So is the HDR target, since the
+		// render pass of the next frame waits on this one's post-processing
+		const bool multisampled = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+		VkImageView attachments[3];
+		attachments[0] = multisampled ? colorImageView : hdrImageView;
+		attachments[1] = depthImageView;
+		attachments[2] = hdrImageView;
 		VkFramebufferCreateInfo framebufferInfo{};
 		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 		framebufferInfo.renderPass = renderPass;
-		framebufferInfo.attachmentCount = 1;
+		framebufferInfo.attachmentCount = multisampled ? 3 : 2;
 		framebufferInfo.pAttachments = attachments;
 		framebufferInfo.width = swapchainExtent.width;
 		framebufferInfo.height = swapchainExtent.height;
 		framebufferInfo.layers = 1;
-		if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapchainFramebuffers[i]) != VK_SUCCESS)
+		if (vkCreateFramebuffer(device, &framebufferInfo, host.swapchainCallbacks(), &swapchainFramebuffers[i]) != VK_SUCCESS)
 			throw std::runtime_error("failed to create framebuffer!");
 	}
 }
 
+void app::createQueryPool() {
+	statisticsQueryPending.assign(swapchainImages.size(), false);
+
+	// timestamps between the stages of the frame, gpuStageCount + 1 per command buffer
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	const uint32_t timestampValidBits = queueFamilies[findQueueFamilies(physicalDevice).graphicsFamily.value()].timestampValidBits;
+	timestampMask = timestampValidBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << timestampValidBits) - 1;
+	if (timestampValidBits != 0) {
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.pNext = nullptr;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = static_cast<uint32_t>(swapchainImages.size()) * (gpuStageCount + 1);
+
+		if (vkCreateQueryPool(device, &queryPoolInfo, host.swapchainCallbacks(), &timestampQueryPool) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create query pool!");
+	}
+	if (!pipelineStatisticsSupported) return;
+
+	// one query per command buffer, each counts the fragment shader invocations for the whole render pass
+	VkQueryPoolCreateInfo queryPoolInfo{};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.pNext = nullptr;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	queryPoolInfo.queryCount = static_cast<uint32_t>(swapchainImages.size());
+	queryPoolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+	if (vkCreateQueryPool(device, &queryPoolInfo, host.swapchainCallbacks(), &statisticsQueryPool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create query pool!");
+}
+
+void app::readStatisticsQuery(uint32_t imageIndex) {
+	// only valid once the command buffer's last submission has completed - called after waiting on its fence
+	if (!statisticsQueryPending[imageIndex]) return;
+	uint64_t fragmentInvocations = 0;
+	if (statisticsQueryPool != VK_NULL_HANDLE && vkGetQueryPoolResults(device, statisticsQueryPool, imageIndex, 1, sizeof(uint64_t), &fragmentInvocations, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+		fragmentInvocationAccumulator += static_cast<double>(fragmentInvocations);
+		fragmentInvocationSamples++;
+	}
+	uint64_t timestamps[gpuStageCount + 1];
+	if (timestampQueryPool != VK_NULL_HANDLE && vkGetQueryPoolResults(device, timestampQueryPool, imageIndex * (gpuStageCount + 1), gpuStageCount + 1,
+		sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+		for (uint32_t stage = 0; stage < gpuStageCount; stage++) // masked, in case the counter wrapped in between
+			gpuStageAccumulators[stage] += static_cast<double>((timestamps[stage + 1] - timestamps[stage]) & timestampMask) * timestampPeriod * 1e-6;
+		gpuTimeSamples++;
+	}
+	statisticsQueryPending[imageIndex] = false;
+}
+
 void app::createCommandPool() {
 	QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
 
 	VkCommandPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-	poolInfo.flags = 0; // Optional  - there's a few usage hint flags that can go here
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // command chunks and their primaries are rerecorded one at a time
 
-	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+	if (vkCreateCommandPool(device, &poolInfo, host.callbacks(), &commandPool) != VK_SUCCESS)
    	throw std::runtime_error("Failed to create command pool!");
 }
 
+void app::loadMesh() {
+	PROFILE_ZONE("loadMesh");
+	if (meshPath.empty()) {
+		uploadMesh(generateOverdrawMesh(overdrawLayers).view());
+		return;
+	}
+
+	// the cache holds the streams in exactly the layout they are uploaded in - staging copies read from the mapping
+	auto start = std::chrono::steady_clock::now();
+	meshCache cache;
+	if (cache.open(meshPath)) {
+		cout << "Mapped mesh cache " << meshCache::pathFor(meshPath) << " in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << endl;
+		uploadMesh(cache.view());
+	} else {
+		meshData mesh = importMesh(meshPath, workers);
+		meshCache::write(meshPath, mesh);
+		uploadMesh(mesh.view());
+	}
+	cout << "Mesh ready for drawing " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+		<< " ms after startup began loading it" << endl;
+}
+
+void app::uploadMesh(const meshView& mesh) {
+	bounds = mesh.bounds;
+	lods.assign(mesh.lods, mesh.lods + mesh.lodCount);
+	lodLevel = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	VkDeviceSize vertexBytes = sizeof(packedVertex) * mesh.vertexCount;
+	VkDeviceSize indexBytes = sizeof(uint32_t) * mesh.indexCount;
+	uploadBuffer(mesh.vertices, vertexBytes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+	hostIndices.assign(mesh.indices, mesh.indices + mesh.indexCount);
+	lodIndexBuffers.assign(lods.size(), VK_NULL_HANDLE);
+	lodIndexBuffersMemory.assign(lods.size(), VK_NULL_HANDLE);
+	for (uint32_t lod = 0; lod < lods.size(); lod++) // everything starts out resident, the budget trims it from there
+		uploadLod(lod);
+	registerLods();
+	uploadBuffer(mesh.meshlets, sizeof(meshlet) * mesh.meshletCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, meshletBuffer, meshletBufferMemory);
+	meshletTotal = mesh.meshletCount;
+	buildOccluders(mesh);
+	cout << "Uploaded " << (vertexBytes + indexBytes) / (1024.0 * 1024.0) << " MB of vertex + index data (" << lods.size() << " LODs, "
+		<< lods[0].meshletCount << " meshlets at full detail) in "
+		<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << endl;
+}
+
+void app::cycleLodLevel() {
+	lodLevel = (lodLevel + 1) % static_cast<uint32_t>(lods.size());
+	cout << "LOD " << lodLevel << ": " << lods[lodLevel].indexCount / 3 << " triangles" << endl;
+	drawnLod = residentLod(lodLevel); // an evicted one is streamed back in on the next frame
+	resetFrameTime(); // the chunks drawing the mesh are rerecorded as each image comes up, see chunkKey
+}
+
+void app::createDescriptorSetLayout() {
+	VkDescriptorSetLayoutBinding uboLayoutBinding{};
+	uboLayoutBinding.binding = 0;
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorCount = 1;
+	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	uboLayoutBinding.pImmutableSamplers = nullptr;
+
+	// instance transforms - binding 4 in both this set and the culling set, since both include shaders/camera.glsl
+	VkDescriptorSetLayoutBinding instanceLayoutBinding{};
+	instanceLayoutBinding.binding = 4;
+	instanceLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	instanceLayoutBinding.descriptorCount = 1;
+	instanceLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	instanceLayoutBinding.pImmutableSamplers = nullptr;
+
+	// lights, light clusters and light indices for the color pass - the same bindings in the light binning set, since
+	// both include shaders/clusters.glsl
+	VkDescriptorSetLayoutBinding bindings[5] = {uboLayoutBinding, instanceLayoutBinding};
+	for (uint32_t i = 2; i < 5; i++) {
+		bindings[i].binding = 3 + i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		bindings[i].pImmutableSamplers = nullptr;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = nullptr;
+	layoutInfo.bindingCount = 5;
+	layoutInfo.pBindings = bindings;
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, host.callbacks(), &descriptorSetLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create descriptor set layout!");
+}
+
+void app::createUniformBuffers() {
+	uniformBuffers.resize(swapchainImages.size());
+	uniformBuffersMemory.resize(swapchainImages.size());
+	uniformBuffersMapped.resize(swapchainImages.size());
+	for (size_t i = 0; i < swapchainImages.size(); i++) {
+		createBuffer(sizeof(cameraUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i], host.swapchainCallbacks());
+		vkMapMemory(device, uniformBuffersMemory[i], 0, sizeof(cameraUniforms), 0, &uniformBuffersMapped[i]);
+	}
+}
+
+void app::createDescriptorPool() {
+	// a set per image, plus one per image and frame in flight for drawing the particles - each with four storage buffers
+	const uint32_t setCount = static_cast<uint32_t>(swapchainImages.size() * (1 + MAX_FRAMES_IN_FLIGHT));
+	VkDescriptorPoolSize poolSizes[2]{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = setCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = setCount * 4;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	poolInfo.maxSets = setCount;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, host.swapchainCallbacks(), &descriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create descriptor pool!");
+}
+
+void app::createDescriptorSets() {
+	std::vector<VkDescriptorSetLayout> layouts(swapchainImages.size(), descriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(swapchainImages.size());
+	allocInfo.pSetLayouts = layouts.data();
+
+	descriptorSets.resize(swapchainImages.size());
+	if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate descriptor sets!");
+
+	for (size_t i = 0; i < swapchainImages.size(); i++) {
+		VkDescriptorBufferInfo bufferInfo{};
+		bufferInfo.buffer = uniformBuffers[i];
+		bufferInfo.offset = 0;
+		bufferInfo.range = sizeof(cameraUniforms);
+		VkDescriptorBufferInfo instanceInfo{instanceBuffers[i], 0, VK_WHOLE_SIZE};
+		VkDescriptorBufferInfo clusterInfos[3] = {{lightBuffers[i], 0, VK_WHOLE_SIZE}, {clusterBuffers[i], 0, VK_WHOLE_SIZE}, {lightIndexBuffers[i], 0, VK_WHOLE_SIZE}};
+
+		VkWriteDescriptorSet descriptorWrites[5]{};
+		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[0].dstSet = descriptorSets[i];
+		descriptorWrites[0].dstBinding = 0;
+		descriptorWrites[0].dstArrayElement = 0;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[0].descriptorCount = 1;
+		descriptorWrites[0].pBufferInfo = &bufferInfo;
+		descriptorWrites[1] = descriptorWrites[0];
+		descriptorWrites[1].dstBinding = 4;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[1].pBufferInfo = &instanceInfo;
+		for (uint32_t b = 2; b < 5; b++) {
+			descriptorWrites[b] = descriptorWrites[1];
+			descriptorWrites[b].dstBinding = 3 + b;
+			descriptorWrites[b].pBufferInfo = &clusterInfos[b - 2];
+		}
+		vkUpdateDescriptorSets(device, 5, descriptorWrites, 0, nullptr);
+	}
+	writeParticleDrawDescriptorSets();
+}
+
+// Gribb/Hartmann plane extraction - each plane is a sum of rows of the clip matrix, scaled so that the xyz part is unit
+// length and plane distances come out in mesh units. Vulkan's clip volume is -w <= x,y <= w, 0 <= z <= w, and with the
+// reversed-Z infinite projection z >= 0 always holds, so there is no far plane
+static void extractFrustumPlanes(const glm::mat4& m, glm::vec4 planes[5]) {
+	auto row = [&m](int i) { return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]); };
+	const glm::vec4 x = row(0), y = row(1), z = row(2), w = row(3);
+	planes[0] = w + x;
+	planes[1] = w - x;
+	planes[2] = w + y;
+	planes[3] = w - y;
+	planes[4] = w - z;
+	for (int i = 0; i < 5; i++)
+		planes[i] = planes[i] / glm::length(glm::vec3(planes[i].x, planes[i].y, planes[i].z));
+}
+
+void app::updateUniformBuffer(uint32_t imageIndex) {
+	const float fovy = 1.5707963f;
+	const float aspect = swapchainExtent.width / (float) swapchainExtent.height;
+	const glm::vec3 center = sceneCenter;
+	const float radius = sceneRadius;
+	const float time = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+
+	cameraUniforms ubo{};
+	ubo.meshCenter = glm::vec4(bounds.center[0], bounds.center[1], bounds.center[2], 0.0f);
+	ubo.meshExtent = glm::vec4(bounds.extent[0], bounds.extent[1], bounds.extent[2], 0.0f);
+	float zNear;
+	glm::vec3 eye;
+	if (meshPath.empty()) {
+		// overdraw benchmark camera - at the origin looking down -z, every layer is drawn back to front, so without the
+		// pre-pass every layer gets shaded
+		zNear = 0.1f;
+		eye = glm::vec3(0.0f);
+		ubo.view = glm::mat4(1.0f);
+	} else if (instanceCount > 1) {
+		// walk through the field of instances just above the ground, looking along the path - most of the scene is
+		// outside the frustum or behind nearer instances, which is what the culling paths are there for
+		const float meshRadius = glm::length(glm::vec3(bounds.extent[0], bounds.extent[1], bounds.extent[2]));
+		float angle = cameraOrbitSpeed * time;
+		eye = center + glm::vec3(0.5f * radius * std::sin(angle), 0.5f * meshRadius, 0.5f * radius * std::cos(angle));
+		glm::vec3 direction(std::cos(angle), 0.0f, -std::sin(angle));
+		zNear = meshRadius * 0.01f;
+		ubo.view = glm::lookAt(eye, eye + direction, glm::vec3(0.0f, 1.0f, 0.0f));
+	} else {
+		// slow orbit around the mesh, far enough out that the bounding sphere stays in view
+		float angle = cameraOrbitSpeed * time;
+		eye = center + radius * glm::vec3(1.5f * std::sin(angle), 0.5f, 1.5f * std::cos(angle));
+		zNear = radius * 0.01f;
+		ubo.view = glm::lookAt(eye, center, glm::vec3(0.0f, 1.0f, 0.0f));
+	}
+	ubo.viewProjection = reversedZPerspective(fovy, aspect, zNear) * ubo.view;
+	ubo.cameraPosition = glm::vec4(eye, 1.0f);
+
+	// depth slices for the light clusters - exponential from the near plane out to the far side of the scene, anything
+	// further away goes in the last one
+	const float zFar = std::max(glm::length(center - eye) + radius, 2.0f * zNear);
+	const float tanHalfFovy = std::tan(0.5f * fovy);
+	ubo.clusterDepth = glm::vec4(zNear, clusterSlices / std::log(zFar / zNear), 0.0f, 0.0f);
+	ubo.clusterScale = glm::vec4(tanHalfFovy * aspect, tanHalfFovy, swapchainExtent.width, swapchainExtent.height);
+	ubo.lightCount = lightCount;
+	ubo.time = time;
+	ubo.deltaTime = std::min(time - frameCamera.time, 0.1f); // frameCamera still holds the previous frame's
+	extractFrustumPlanes(ubo.viewProjection, ubo.frustumPlanes);
+	memcpy(uniformBuffersMapped[imageIndex], &ubo, sizeof(ubo));
+	frameCamera = ubo;
+}
+
 void app::createCommandBuffers() {
 	commandBuffers.resize(swapchainFramebuffers.size());
+	recordedLods.assign(swapchainFramebuffers.size(), drawnLod);
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = commandPool;
@@ -687,33 +1290,90 @@ void app::createCommandBuffers() {
 	if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
 		throw std::runtime_error("Failed to allocate command buffers!");
 
+	// and the chunks they execute, none of them recorded yet
+	chunkBuffers.resize(swapchainFramebuffers.size() * commandChunkCount);
+	chunkKeys.assign(chunkBuffers.size(), 0);
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+	allocInfo.commandBufferCount = (uint32_t) chunkBuffers.size();
+	if (vkAllocateCommandBuffers(device, &allocInfo, chunkBuffers.data()) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate command chunks!");
+
 	for (size_t i = 0; i < commandBuffers.size(); i++) {
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = 0; // some different usage hints, currently irrelevant
-		beginInfo.pInheritanceInfo = nullptr; // Optional
-		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS)
-			throw std::runtime_error("failed to begin recording command buffer!");
-
-		VkRenderPassBeginInfo renderPassInfo{};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = renderPass;
-		renderPassInfo.framebuffer = swapchainFramebuffers[i];
-		renderPassInfo.renderArea.offset = {0, 0};
-		renderPassInfo.renderArea.extent = swapchainExtent;
-
-		VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-		renderPassInfo.clearValueCount = 1;
-		renderPassInfo.pClearValues = &clearColor;
-
-		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-		vkCmdDraw(commandBuffers[i], 3, 1, 0, 0); // the actual draw call
+		updateCommandChunks(i);
+		recordCommandBuffer(i);
+	}
+}
+
+void app::recordCommandBuffer(size_t i) {
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = 0; // some different usage hints, currently irrelevant
+	beginInfo.pInheritanceInfo = nullptr; // Optional
+	if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("failed to begin recording command buffer!");
+
+	VkRenderPassBeginInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = swapchainFramebuffers[i];
+	renderPassInfo.renderArea.offset = {0, 0};
+	renderPassInfo.renderArea.extent = swapchainExtent;
+
+	VkClearValue clearValues[2];
+	clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+	clearValues[1].depthStencil = {0.0f, 0}; // reversed-Z, 0.0 is the far plane
+	renderPassInfo.clearValueCount = 2;
+	renderPassInfo.pClearValues = clearValues;
+
+	// the timestamps of this command buffer, written as each stage of the frame is done - see readStatisticsQuery
+	const uint32_t firstTimestamp = static_cast<uint32_t>(i) * (gpuStageCount + 1);
+	if (timestampQueryPool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(commandBuffers[i], timestampQueryPool, firstTimestamp, gpuStageCount + 1);
+		vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, firstTimestamp);
+	}
+
+	executeChunks(commandBuffers[i], i, {particleSimulationChunk, cullingChunk});
+	if (timestampQueryPool != VK_NULL_HANDLE)
+		vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, firstTimestamp + 1);
+
+	// queries have to be reset outside of the render pass before they can be used again
+	if (statisticsQueryPool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(commandBuffers[i], statisticsQueryPool, static_cast<uint32_t>(i), 1);
+		vkCmdBeginQuery(commandBuffers[i], statisticsQueryPool, static_cast<uint32_t>(i), 0);
+	}
+
+	// with two phase culling, what was visible last frame is drawn in the early render pass, and what the depth pyramid
+	// built from it shows to have come into view in the late one
+	const bool twoPhase = twoPhaseCulling();
+	if (twoPhase) {
+		renderPassInfo.renderPass = earlyRenderPass;
+		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		if (depthPrepass) {
+			executeChunks(commandBuffers[i], i, {depthPrepassChunk});
+			vkCmdNextSubpass(commandBuffers[i], VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		}
+		executeChunks(commandBuffers[i], i, {opaqueChunk});
 		vkCmdEndRenderPass(commandBuffers[i]);
+		executeChunks(commandBuffers[i], i, {hiZChunk});
+		renderPassInfo.renderPass = lateRenderPass;
+	}
 
-		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
-			throw std::runtime_error("Failed to record command buffer!");
+	vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	if (depthPrepass) {
+		executeChunks(commandBuffers[i], i, {twoPhase ? lateDepthPrepassChunk : depthPrepassChunk});
+		vkCmdNextSubpass(commandBuffers[i], VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 	}
+	executeChunks(commandBuffers[i], i, {twoPhase ? lateOpaqueChunk : opaqueChunk, particleDrawChunk});
+	vkCmdEndRenderPass(commandBuffers[i]);
+
+	if (statisticsQueryPool != VK_NULL_HANDLE)
+		vkCmdEndQuery(commandBuffers[i], statisticsQueryPool, static_cast<uint32_t>(i));
+	if (timestampQueryPool != VK_NULL_HANDLE)
+		vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, firstTimestamp + 2);
+	executeChunks(commandBuffers[i], i, {postChunk});
+
+	if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
+		throw std::runtime_error("Failed to record command buffer!");
 }
 
 void app::createSyncObjects() {
@@ -730,18 +1390,30 @@ void app::createSyncObjects() {
 	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
 	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-		if(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-			vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS)
+		if(vkCreateSemaphore(device, &semaphoreInfo, host.callbacks(), &imageAvailableSemaphores[i]) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semaphoreInfo, host.callbacks(), &renderFinishedSemaphores[i]) != VK_SUCCESS ||
+			vkCreateFence(device, &fenceInfo, host.callbacks(), &inFlightFences[i]) != VK_SUCCESS)
 				throw std::runtime_error("failed to create synchronization objects for a frame!");
 }
 
 
 void app::drawFrame() {
-	vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+	PROFILE_ZONE("drawFrame");
+	{
+		PROFILE_ZONE("wait for frame fence");
+		vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+	}
+	deletions.collect(fenceSubmissions[currentFrame]); // the fence covers its own submission and every one before it
+	host.beginFrame(); // command scope allocations of the last frame are long gone, and retired generations may be empty now
+	const uint64_t allocationsBefore = host.allocationCount(), bytesBefore = host.allocationBytes();
+	host.setTracing(traceAllocations);
 
 	uint32_t imageIndex;
-	VkResult result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+	VkResult result;
+	{
+		PROFILE_ZONE("acquire");
+		result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+	}
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
 		recreateSwapchain();
@@ -750,8 +1422,26 @@ void app::drawFrame() {
 		throw std::runtime_error("Failed to acquire swapchain image!");
 	}
 
-	if (imagesInFlight[imageIndex] != VK_NULL_HANDLE)
+	if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+		PROFILE_ZONE("wait for image fence");
 		vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+	}
+	readStatisticsQuery(imageIndex); // previous use of this command buffer is finished
+	readCullStatistics(imageIndex);
+	readClusterStatistics(imageIndex);
+	readParticleStatistics();
+	updateResidency(); // before anything is recorded, it can change the LOD that's drawn
+	updateScene(imageIndex); // instance buffer for this image is no longer in use either
+	updateUniformBuffer(imageIndex);
+	updateLights(imageIndex);
+	if (cpuCulling) cullInstances();
+	if (particles) updateParticles();
+	{
+		// the particle time step changes every frame, and so can the survivors, the rest only with the toggles
+		PROFILE_ZONE("recordCommandBuffer");
+		if (updateCommandChunks(imageIndex))
+			recordCommandBuffer(imageIndex);
+	}
 
 	imagesInFlight[imageIndex] = inFlightFences[currentFrame];
 
@@ -759,7 +1449,8 @@ void app::drawFrame() {
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
 	VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
-	VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+	// the swapchain image is first touched at the end of the post-processing chain
+	VkPipelineStageFlags waitStages[] = {swapchainStorage ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT};
 	submitInfo.waitSemaphoreCount = 1;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
@@ -771,8 +1462,17 @@ void app::drawFrame() {
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
 	vkResetFences(device, 1, &inFlightFences[currentFrame]);
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
-   	throw std::runtime_error("Failed to submit draw command buffer!");
+	{
+		PROFILE_ZONE("submit");
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
+			throw std::runtime_error("Failed to submit draw command buffer!");
+	}
+	fenceSubmissions[currentFrame] = ++submissionCount;
+	deletions.submitted(submissionCount);
+	statisticsQueryPending[imageIndex] = true;
+	cullStatisticsPending[imageIndex] = meshletCulling;
+	clusterStatisticsPending[imageIndex] = true;
+	particleStatisticsPending[currentFrame] = particles;
 
 	VkPresentInfoKHR presentInfo{};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -785,8 +1485,17 @@ void app::drawFrame() {
 	presentInfo.pImageIndices = &imageIndex;
 	presentInfo.pResults = nullptr; // Optional - creates array of VkResult values for each swapchain, but we have only one
 
-	result = vkQueuePresentKHR(presentQueue, &presentInfo); // submit the draw call to the present queue
+	{
+		PROFILE_ZONE("present");
+		result = vkQueuePresentKHR(presentQueue, &presentInfo); // submit the draw call to the present queue
+	}
+	if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR)
+		releaseRetiredSwapchains(); // before a rebuild below retires the one that just presented
 	// vkQueueWaitIdle(presentQueue); // wait for work to finish after submitting it - not neccesary with fences in place
+	host.setTracing(false); // a swapchain rebuild isn't part of a steady state frame
+	hostAllocationAccumulator += static_cast<double>(host.allocationCount() - allocationsBefore);
+	hostAllocationBytesAccumulator += static_cast<double>(host.allocationBytes() - bytesBefore);
+	PROFILE_COUNTER("host allocations", host.allocationCount() - allocationsBefore);
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized)
 		recreateSwapchain();
@@ -794,21 +1503,164 @@ void app::drawFrame() {
 		throw std::runtime_error("Failed to present swapchain image!");
 
 	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	PROFILE_FRAME();
 }
 
 // main loop for runtime operations (input, etc)
 void app::mainLoop() {
+	resetFrameTime();
 	while( !glfwWindowShouldClose( window ) ) {
 		glfwPollEvents(); // handle all the events off the queue
 		drawFrame(); // draw a frame to the window
+		updateFrameTime();
 	}
 	vkDeviceWaitIdle(device);
 }
 
+void app::updateFrameTime() {
+	auto now = std::chrono::steady_clock::now();
+	frameTimeAccumulator += std::chrono::duration<double, std::milli>(now - lastFrameTime).count();
+	lastFrameTime = now;
+	if (++framesAccumulated == frameTimeReportInterval) {
+		double average = frameTimeAccumulator / framesAccumulated;
+		cout << msaaSamples << "x MSAA, depth pre-pass " << (depthPrepass ? "on" : "off") << ", LOD " << drawnLod << ": " << average << " ms/frame ("
+			<< 1000.0 / average << " fps) over " << framesAccumulated << " frames at " << swapchainExtent.width << "x" << swapchainExtent.height;
+		if (fragmentInvocationSamples != 0)
+			cout << ", " << static_cast<uint64_t>(fragmentInvocationAccumulator / fragmentInvocationSamples) << " fragment invocations/frame";
+		cout << endl;
+		const meshLod& lod = lods[drawnLod];
+		const double occludedPercent = testedMeshletAccumulator != 0.0 ? 100.0 * occludedMeshletAccumulator / testedMeshletAccumulator : 0.0;
+		if (cullStatisticsSamples != 0) {
+			cout << "  meshlet culling: " << static_cast<uint64_t>(visibleTriangleAccumulator / cullStatisticsSamples) << " of " << uint64_t(lod.indexCount / 3) * instanceCount
+				<< " triangles visible, " << static_cast<uint64_t>(visibleMeshletAccumulator / cullStatisticsSamples) << " of " << lod.meshletCount * instanceCount << " meshlets";
+			if (testedMeshletAccumulator != 0.0) // the fraction of what's in the frustum and facing the camera
+				cout << ", Hi-Z: " << occludedPercent << "% occluded, " << static_cast<uint64_t>(lateMeshletAccumulator / cullStatisticsSamples)
+					<< " meshlets/frame drawn late";
+			cout << endl;
+		} else
+			cout << "  meshlet culling off: " << uint64_t(lod.indexCount / 3) * instanceCount << " triangles submitted" << endl;
+		if (cpuCullSamples != 0)
+			cout << "  CPU culling" << (occlusionCulling ? " + occlusion: " : ": ") << cpuCullAccumulator / cpuCullSamples << " ms/frame, "
+				<< static_cast<uint64_t>(cpuCullVisibleAccumulator / cpuCullSamples) << " of " << instanceCount << " instances drawn ("
+				<< 100.0 * (1.0 - cpuCullVisibleAccumulator / (cpuCullSamples * double(instanceCount))) << "% culled, "
+				<< static_cast<uint64_t>(cpuCullOccludedAccumulator / cpuCullSamples) << " by occlusion)" << endl;
+		cout << "  scene update: " << sceneUpdateAccumulator / framesAccumulated << " ms/frame for " << instanceCount << " instances, "
+			<< static_cast<uint64_t>(sceneTransformsWritten / framesAccumulated) << " transforms written/frame" << endl;
+		if (clusterStatisticsSamples != 0)
+			cout << "  clustered lighting: " << lightCount << " lights, " << clusterIndexAccumulator / (double(clusterStatisticsSamples) * clusterCount)
+				<< " lights/cluster on average, " << static_cast<uint64_t>(clusterDroppedAccumulator / clusterStatisticsSamples) << " dropped/frame (over "
+				<< maxLightsPerCluster << " in a cluster)" << endl;
+		if (gpuTimeSamples != 0) {
+			static const char* stageNames[gpuStageCount] = {"compute", "scene", "bloom down + histogram", "exposure", "bloom up", "tonemap"};
+			double total = 0.0;
+			cout << "  GPU time:";
+			for (uint32_t stage = 0; stage < gpuStageCount; stage++) {
+				cout << (stage == 0 ? " " : ", ") << stageNames[stage] << " " << gpuStageAccumulators[stage] / gpuTimeSamples << " ms";
+				total += gpuStageAccumulators[stage];
+			}
+			cout << " (" << total / gpuTimeSamples << " ms/frame, post-processing " << (hdrFormat == VK_FORMAT_R16G16B16A16_SFLOAT ? "from RGBA16F" : "from B10G11R11")
+				<< (swapchainStorage ? " into the swapchain image)" : " copied into the swapchain image)") << endl;
+		}
+		cout << "  command chunks: " << chunksReusedAccumulator / framesAccumulated << " reused, " << chunksRecordedAccumulator / framesAccumulated
+			<< " rerecorded/frame, " << recordingSavedAccumulator / framesAccumulated << " ms/frame of recording saved" << endl;
+		if (particleSamples != 0)
+			cout << "  particles: " << static_cast<uint64_t>(particleAliveAccumulator / particleSamples) << " of " << particleCapacity << " alive, "
+				<< static_cast<uint64_t>(particleEmittedAccumulator / framesAccumulated) << " emitted/frame" << endl;
+		const residencyStats& residencyCounts = residency.stats();
+		const heapBudget& local = heapBudgets[deviceLocalHeap];
+		cout << "  device local heap: " << local.usage / (1024 * 1024) << " of " << local.budget / (1024 * 1024) << " MB budget"
+			<< (memoryBudgetSupported ? "" : " (estimated)") << (simulatedBudget != 0 ? " (simulated)" : "") << ", " << minHeadroom / (1024 * 1024)
+			<< " MB least headroom, LODs: " << residencyCounts.evictions << " evictions (" << residencyCounts.evictedBytes / 1024 << " KB), "
+			<< residencyCounts.uploads << " re-uploads (" << residencyCounts.uploadedBytes / 1024 << " KB)";
+		if (drawnLod != lodLevel)
+			cout << ", drawing LOD " << drawnLod << " until LOD " << lodLevel << " fits";
+		cout << endl;
+		cout << "  host allocations: " << hostAllocationAccumulator / framesAccumulated << "/frame ("
+			<< static_cast<uint64_t>(hostAllocationBytesAccumulator / framesAccumulated) << " bytes/frame), "
+			<< host.arenaCapacity() / 1024 << " KB held in arenas" << endl;
+		resetFrameTime();
+		if (occlusionBenchmark) { // --bench-occlusion, one report without Hi-Z culling and one with it
+			if (!hiZCulling && hiZSupported && meshletCulling) {
+				occlusionBaseline = average;
+				toggleHiZCulling();
+			} else {
+				if (hiZActive && meshletCulling)
+					cout << "Hi-Z culling: " << occlusionBaseline << " -> " << average << " ms/frame (" << 100.0 * (1.0 - average / occlusionBaseline)
+						<< "% less frame time), " << occludedPercent << "% of the meshlets in the frustum occluded" << endl;
+				else
+					cout << "Hi-Z culling isn't available on this device, at " << msaaSamples << "x MSAA - nothing to compare" << endl;
+				glfwSetWindowShouldClose(window, 1);
+			}
+		}
+		if (lightBenchmark) { // --bench-lights, one report per light count
+			if (lightCount >= maxLightCount)
+				glfwSetWindowShouldClose(window, 1);
+			else
+				cycleLightCount();
+		}
+	}
+}
+
+void app::resetFrameTime() {
+	// partial intervals are discarded, so each report only ever covers a single configuration
+	lastFrameTime = std::chrono::steady_clock::now();
+	frameTimeAccumulator = 0.0;
+	framesAccumulated = 0;
+	fragmentInvocationAccumulator = 0.0;
+	fragmentInvocationSamples = 0;
+	visibleTriangleAccumulator = 0.0;
+	visibleMeshletAccumulator = 0.0;
+	lateMeshletAccumulator = 0.0;
+	occludedMeshletAccumulator = 0.0;
+	testedMeshletAccumulator = 0.0;
+	cullStatisticsSamples = 0;
+	sceneUpdateAccumulator = 0.0;
+	sceneTransformsWritten = 0.0;
+	hostAllocationAccumulator = 0.0;
+	hostAllocationBytesAccumulator = 0.0;
+	particleAliveAccumulator = 0.0;
+	particleEmittedAccumulator = 0.0;
+	particleSamples = 0;
+	clusterIndexAccumulator = 0.0;
+	clusterDroppedAccumulator = 0.0;
+	clusterStatisticsSamples = 0;
+	cpuCullAccumulator = 0.0;
+	cpuCullVisibleAccumulator = 0.0;
+	cpuCullOccludedAccumulator = 0.0;
+	cpuCullSamples = 0;
+	for (double& accumulator : gpuStageAccumulators)
+		accumulator = 0.0;
+	minHeadroom = INT64_MAX;
+	chunksReusedAccumulator = 0.0;
+	chunksRecordedAccumulator = 0.0;
+	recordingSavedAccumulator = 0.0;
+	gpuTimeSamples = 0;
+}
+
 // called with the information on key events
 void app::keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, 1); // hit escape to close the app
+	if (key == GLFW_KEY_M && action == GLFW_PRESS)
+		reinterpret_cast<app*>(glfwGetWindowUserPointer(window))->cycleSampleCount();
+	if (key == GLFW_KEY_P && action == GLFW_PRESS)
+		reinterpret_cast<app*>(glfwGetWindowUserPointer(window))->toggleDepthPrepass();
+	if (key == GLFW_KEY_L && action == GLFW_PRESS)
+		reinterpret_cast<app*>(glfwGetWindowUserPointer(window))->cycleLodLevel();
+	if (key == GLFW_KEY_C && action == GLFW_PRESS)
+		reinterpret_cast<app*>(glfwGetWindowUserPointer(window))->toggleMeshletCulling();
+	if (key == GLFW_KEY_K && action == GLFW_PRESS)
+		reinterpret_cast<app*>(glfwGetWindowUserPointer(window))->cycleMaterial();
+	if (key == GLFW_KEY_B && action == GLFW_PRESS)
+		reinterpret_cast<app*>(glfwGetWindowUserPointer(window))->toggleCpuCulling();
+	if (key == GLFW_KEY_O && action == GLFW_PRESS)
+		reinterpret_cast<app*>(glfwGetWindowUserPointer(window))->toggleOcclusionCulling();
+	if (key == GLFW_KEY_F && action == GLFW_PRESS)
+		reinterpret_cast<app*>(glfwGetWindowUserPointer(window))->toggleParticles();
+	if (key == GLFW_KEY_N && action == GLFW_PRESS)
+		reinterpret_cast<app*>(glfwGetWindowUserPointer(window))->cycleLightCount();
+	if (key == GLFW_KEY_H && action == GLFW_PRESS)
+		reinterpret_cast<app*>(glfwGetWindowUserPointer(window))->toggleHiZCulling();
 }
 
 void app::framebufferResizeCallback(GLFWwindow* window, int width, int height) {
@@ -817,18 +1669,64 @@ void app::framebufferResizeCallback(GLFWwindow* window, int width, int height) {
 }
 
 void app::cleanupSwapchain() {
+	// frames in flight may still be using any of these, they are destroyed once the GPU is done with them - except for the
+	// swapchain and its image views, which wait on the next swapchain's first present, see releaseRetiredSwapchains.
+	// Everything goes back to the arena of this swapchain generation, which is retired here and reset once it's all been
+	// freed
+	const VkAllocationCallbacks* allocator = host.swapchainCallbacks();
+	if (colorImage != VK_NULL_HANDLE) { // multisampled color target, only present with MSAA enabled
+		deletions.destroy(colorImageView, allocator);
+		deletions.destroy(colorImage, allocator);
+		deletions.destroy(colorImageMemory, allocator);
+		colorImage = VK_NULL_HANDLE;
+	}
+	deletions.destroy(depthImageView, allocator);
+	deletions.destroy(depthImage, allocator);
+	deletions.destroy(depthImageMemory, allocator);
+	deletions.destroy(hdrImageView, allocator);
+	deletions.destroy(hdrImage, allocator);
+	deletions.destroy(hdrImageMemory, allocator);
+	deletions.destroy(statisticsQueryPool, allocator);
+	statisticsQueryPool = VK_NULL_HANDLE;
+	deletions.destroy(timestampQueryPool, allocator);
+	timestampQueryPool = VK_NULL_HANDLE;
 	for (size_t i = 0; i < swapchainFramebuffers.size(); i++)
-		vkDestroyFramebuffer(device, swapchainFramebuffers[i], nullptr);
-	vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-	vkDestroyPipeline(device, graphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-	vkDestroyRenderPass(device, renderPass, nullptr);
-	for (auto imageView : swapchainImageViews)
-		vkDestroyImageView(device, imageView, nullptr); // delete each of the swapchain image views
-	vkDestroySwapchainKHR(device, swapchain, nullptr); // delete the current swapchain
+		deletions.destroy(swapchainFramebuffers[i], allocator);
+	for (VkCommandBuffer commandBuffer : commandBuffers)
+		deletions.free(commandPool, commandBuffer);
+	for (VkCommandBuffer commandBuffer : chunkBuffers)
+		deletions.free(commandPool, commandBuffer);
+	for (size_t i = 0; i < uniformBuffers.size(); i++) {
+		deletions.destroy(uniformBuffers[i], allocator);
+		deletions.destroy(uniformBuffersMemory[i], allocator); // implicitly unmapped
+	}
+	cleanupInstanceBuffers();
+	deletions.destroy(descriptorPool, allocator); // frees the descriptor sets too
+	cleanupCullResources();
+	cleanupHiZResources();
+	cleanupClusterResources();
+	cleanupPostResources();
+	deletions.destroy(renderPass, allocator); // the pipelines are kept by the pipeline manager, and work with the next compatible one
+	if (earlyRenderPass != VK_NULL_HANDLE) { // only with Hi-Z culling
+		deletions.destroy(earlyRenderPass, allocator);
+		deletions.destroy(lateRenderPass, allocator);
+		earlyRenderPass = lateRenderPass = VK_NULL_HANDLE;
+	}
+	retiredSwapchains.push_back({swapchain, swapchainImageViews, allocator}); // createSwapchain still passes it on as oldSwapchain
+	host.retireSwapchain();
+}
+
+void app::releaseRetiredSwapchains() {
+	for (const retiredSwapchain& retired : retiredSwapchains) {
+		for (VkImageView imageView : retired.imageViews)
+			deletions.destroy(imageView, retired.allocator); // delete each of the swapchain image views
+		deletions.destroy(retired.swapchain, retired.allocator);
+	}
+	retiredSwapchains.clear();
 }
 
 void app::recreateSwapchain() {
+	PROFILE_ZONE("recreateSwapchain");
 	// to handle the special case where the app is minimized
 	// int width = 0, height = 0; // not working as intended
 	// glfwGetFramebufferSize(window, &width, &height);
@@ -838,31 +1736,96 @@ void app::recreateSwapchain() {
 	// 	glfwWaitEvents();
 	// }
 
-	vkDeviceWaitIdle(device);
+	// no device idle - everything in use by the frames in flight goes through the deletion queue
 	cleanupSwapchain();
 	createSwapchain();
 	createImageViews();
 	createRenderPass();
 	createGraphicsPipeline();
+	createColorResources();
+	createDepthResources();
 	createFramebuffers();
+	createQueryPool();
+	createUniformBuffers();
+	createInstanceBuffers();
+	createClusterResources();
+	createDescriptorPool();
+	createDescriptorSets();
+	createHiZResources();
+	createCullResources();
+	createPostResources();
 	createCommandBuffers();
+	imagesInFlight.assign(swapchainImages.size(), VK_NULL_HANDLE); // the image count can change with the new swapchain
+
+	framebufferResized = false; // handled
+	resetFrameTime(); // don't mix timings from before and after the change
 }
 
 void app::cleanup() {
+	PROFILE_ZONE("cleanup");
 	// This function is called on program shutdown to deallocate all GLFW+Vulkan resources
 	cleanupSwapchain(); // delete swapchain objects
+	releaseRetiredSwapchains(); // nothing is presented anymore
+	deletions.flush(); // the device is idle by now
+	std::vector<char> pipelineCacheData = pipelines.cacheData(); // picked up by the next run
+	std::ofstream(pipelineCachePath, std::ios::binary).write(pipelineCacheData.data(), pipelineCacheData.size());
+	pipelines.cleanup();
+	vkDestroyPipelineLayout(device, pipelineLayout, host.callbacks());
+	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, host.callbacks());
+	vkDestroyPipeline(device, cullPipeline, host.callbacks());
+	vkDestroyPipeline(device, cullLatePipeline, host.callbacks());
+	vkDestroyBuffer(device, visibilityBuffer, host.callbacks());
+	vkFreeMemory(device, visibilityBufferMemory, host.callbacks());
+	vkDestroyPipeline(device, hiZPipeline, host.callbacks());
+	vkDestroyPipeline(device, hiZMultisampledPipeline, host.callbacks());
+	vkDestroyPipelineLayout(device, hiZPipelineLayout, host.callbacks());
+	vkDestroyDescriptorSetLayout(device, hiZDescriptorSetLayout, host.callbacks());
+	vkDestroySampler(device, hiZSampler, host.callbacks());
+	vkDestroyBuffer(device, hiZCounterBuffer, host.callbacks());
+	vkFreeMemory(device, hiZCounterBufferMemory, host.callbacks());
+	vkDestroyPipelineLayout(device, cullPipelineLayout, host.callbacks());
+	vkDestroyDescriptorSetLayout(device, cullDescriptorSetLayout, host.callbacks());
+	vkDestroyPipeline(device, clusterPipeline, host.callbacks());
+	vkDestroyPipelineLayout(device, clusterPipelineLayout, host.callbacks());
+	vkDestroyDescriptorSetLayout(device, clusterDescriptorSetLayout, host.callbacks());
+	vkDestroyBuffer(device, exposureBuffer, host.callbacks());
+	vkFreeMemory(device, exposureBufferMemory, host.callbacks());
+	vkDestroyPipeline(device, bloomPrefilterPipeline, host.callbacks());
+	vkDestroyPipeline(device, bloomDownsamplePipeline, host.callbacks());
+	vkDestroyPipeline(device, bloomUpsamplePipeline, host.callbacks());
+	vkDestroyPipeline(device, exposurePipeline, host.callbacks());
+	vkDestroyPipeline(device, tonemapPipeline, host.callbacks());
+	vkDestroyPipelineLayout(device, postPipelineLayout, host.callbacks());
+	vkDestroyDescriptorSetLayout(device, postDescriptorSetLayout, host.callbacks());
+	vkDestroySampler(device, postSampler, host.callbacks());
+	cleanupParticleBuffers();
+	vkDestroyPipeline(device, particleSimulatePipeline, host.callbacks());
+	vkDestroyPipeline(device, particleEmitPipeline, host.callbacks());
+	vkDestroyPipeline(device, particleFinalizePipeline, host.callbacks());
+	vkDestroyPipelineLayout(device, particlePipelineLayout, host.callbacks());
+	vkDestroyDescriptorSetLayout(device, particleDescriptorSetLayout, host.callbacks());
+	vkDestroyBuffer(device, meshletBuffer, host.callbacks());
+	vkFreeMemory(device, meshletBufferMemory, host.callbacks());
+	for (size_t lod = 0; lod < lodIndexBuffers.size(); lod++) { // evicted ones are already gone
+		if (lodIndexBuffers[lod] == VK_NULL_HANDLE) continue;
+		vkDestroyBuffer(device, lodIndexBuffers[lod], host.callbacks());
+		vkFreeMemory(device, lodIndexBuffersMemory[lod], host.callbacks());
+	}
+	vkDestroyBuffer(device, vertexBuffer, host.callbacks());
+	vkFreeMemory(device, vertexBufferMemory, host.callbacks());
 	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) { // delete all sync objects
-		vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-		vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-		vkDestroyFence(device, inFlightFences[i], nullptr);
+		vkDestroySemaphore(device, renderFinishedSemaphores[i], host.callbacks());
+		vkDestroySemaphore(device, imageAvailableSemaphores[i], host.callbacks());
+		vkDestroyFence(device, inFlightFences[i], host.callbacks());
 	}
-	vkDestroyCommandPool(device, commandPool, nullptr); // delete the command pool object
+	vkDestroyCommandPool(device, commandPool, host.callbacks()); // delete the command pool object
 	if( enableValidationLayers ) // delete debug callback
-		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, host.callbacks());
 
-	vkDestroyDevice(device, nullptr); // destroy the logical device associated with the GPU
-	vkDestroySurfaceKHR(instance, surface, nullptr); // destroy the window surface
-	vkDestroyInstance(instance, nullptr); // destroy the created instance
+	vkDestroyDevice(device, host.callbacks()); // destroy the logical device associated with the GPU
+	vkDestroySurfaceKHR(instance, surface, host.callbacks()); // destroy the window surface
+	vkDestroyInstance(instance, host.callbacks()); // destroy the created instance
+	host.report(); // anything still live at this point was leaked
 
 	glfwDestroyWindow(window); // close the window and end the program
 	glfwTerminate();
@@ -3,8 +3,11 @@
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
 #include <iostream>
 using std::endl, std::cout, std::cin, std::cerr;
@@ -14,18 +17,108 @@ using std::endl, std::cout, std::cin, std::cerr;
 #include <cstring>
 #include <cstdint> // for UINT32_MAX
 #include <algorithm>
+#include <chrono> // frame timing
 
 // these will be done away with eventually, I want to reimplement the parts that use these headers
 #include <optional> // for the vulkan-tutorial style handling of the QueueFamilyIndices
 #include <set> // also used for the QueueFamilyIndices stuff
 // this will probably meet the same fate, static arrays are going to be able to do everything I need
 #include <vector>
+#include <string>
+
+#include "threadPool.h"
+#include "mesh.h"
+#include "meshCache.h"
+#include "scene.h"
+#include "cpuCulling.h"
+#include "deletionQueue.h"
+#include "pipelineManager.h"
+#include "hostAllocator.h"
+#include "profiler.h"
+#include "residencyManager.h"
 
 constexpr uint32_t width  = 720;
 constexpr uint32_t height = 480;
 
 constexpr int MAX_FRAMES_IN_FLIGHT = 2;
 
+// requested MSAA sample count - clamped to what the device supports for color attachments, cycle at runtime with 'M'
+constexpr VkSampleCountFlagBits desiredMsaaSamples = VK_SAMPLE_COUNT_4_BIT;
+
+// number of frames averaged for each frame time report
+constexpr uint32_t frameTimeReportInterval = 500;
+
+// number of stacked, screen covering quads drawn back to front by the overdraw benchmark, used when no mesh is given
+constexpr uint32_t overdrawLayers = 32;
+
+// orbiting camera speed around a loaded mesh, in radians per second
+constexpr float cameraOrbitSpeed = 0.3f;
+
+// instanced scene layout - instances are placed in rings of up to this many around a group node, and every fourth group
+// spins at sceneGroupSpinSpeed (radians per second), so only those subtrees are dirty each frame
+constexpr uint32_t sceneGroupSize = 16;
+constexpr float sceneGroupSpinSpeed = 0.5f;
+
+// CPU culling - software occlusion buffer size, the number of nearest instances rasterized into it as occluders, and
+// how far the BVH's summed node area may grow through refits before it is rebuilt
+constexpr uint32_t occlusionBufferWidth = 256;
+constexpr uint32_t occlusionBufferHeight = 128;
+constexpr size_t occluderCount = 16;
+constexpr float bvhRebuildThreshold = 1.5f;
+
+// materials - a shading model and a palette, both specialization constants of shaders/basic.frag. Every material is
+// built for every render pass layout before the first frame, and cycled at runtime with 'K'
+constexpr uint32_t shadingModelCount = 4;
+constexpr uint32_t paletteCount = 8;
+constexpr uint32_t materialCount = shadingModelCount * paletteCount;
+
+// GPU particles - capacity unless set with --particles, lifetime in seconds (each particle gets 50 to 100% of it), and
+// the number of simulation steps timed for each size by --bench-particles
+constexpr uint32_t defaultParticleCount = 262144;
+constexpr float particleLifetime = 4.0f;
+constexpr uint32_t particleBenchmarkSteps = 32;
+
+// clustered lighting - the froxel grid lights are binned into (screen tiles by exponential depth slices), the longest
+// light list a cluster can hold, and the light counts cycled through with 'N'. Matches shaders/clusters.glsl
+constexpr uint32_t clusterTilesX = 16;
+constexpr uint32_t clusterTilesY = 9;
+constexpr uint32_t clusterSlices = 24;
+constexpr uint32_t clusterCount = clusterTilesX * clusterTilesY * clusterSlices;
+constexpr uint32_t maxLightsPerCluster = 128;
+constexpr uint32_t minLightCount = 16;
+constexpr uint32_t maxLightCount = 16384;
+constexpr uint32_t defaultLightCount = 256;
+
+// HDR post-processing - bloom levels under the HDR target, the first one at half resolution, and the stages of the
+// frame timed on the GPU: the compute passes ahead of the render pass, the render pass, then bloom downsampling (with the
+// luminance histogram), exposure, bloom upsampling and tonemapping
+constexpr uint32_t bloomLevels = 6;
+constexpr uint32_t bloomDownsamplePasses = 1 + bloomLevels / 2; // the prefilter into level 0, then two levels per pass
+constexpr uint32_t gpuStageCount = 6;
+constexpr uint32_t histogramBins = 256;
+
+// Hi-Z occlusion culling - mip levels the depth pyramid can have (level 0 is at most 16k on a side), and the instance
+// count --bench-occlusion walks through when none is given
+constexpr uint32_t maxPyramidLevels = 16;
+constexpr uint32_t occlusionBenchmarkInstances = 4096;
+
+// the parts of a frame recorded into secondary command buffers of their own, per swapchain image - see commandChunks.cc
+enum commandChunk : uint32_t {
+	particleSimulationChunk, // compute, ahead of the render pass
+	cullingChunk, // meshlet culling and light binning, likewise
+	depthPrepassChunk, // the pre-pass subpass
+	opaqueChunk, // mesh draws of the color subpass
+	hiZChunk, // with two phase culling, the depth pyramid and the late culling pass between the render passes
+	lateDepthPrepassChunk, // the late render pass' pre-pass subpass
+	lateOpaqueChunk, // and its color subpass
+	particleDrawChunk, // blended over them, in the last render pass
+	postChunk, // after the render pass
+	commandChunkCount
+};
+
+// the pipeline cache is saved here on exit, in the working directory, and loaded on the next start
+constexpr const char* pipelineCachePath = "pipeline.cache";
+
 #define DEBUG
 #ifdef DEBUG
 constexpr bool enableValidationLayers = true;
@@ -54,6 +147,89 @@ struct QueueFamilyIndices {
 	bool found(){ return graphicsFamily.has_value() && presentFamily.has_value(); }
 };
 
+// matches the uniform block in shaders/camera.glsl - one per swapchain image, updated each frame
+struct cameraUniforms {
+	glm::mat4 viewProjection;
+	glm::vec4 meshCenter; // quantized positions are dequantized as center + snorm * extent
+	glm::vec4 meshExtent;
+	glm::vec4 cameraPosition;
+	glm::vec4 frustumPlanes[5]; // left, right, bottom, top, near - xyz is the inward normal, the far plane is at infinity
+	glm::mat4 view; // lights are binned in view space
+	glm::vec4 clusterDepth; // x near plane, y depth slices per unit of log(depth / near)
+	glm::vec4 clusterScale; // xy view space x and y per unit of depth at the right and top edges, zw framebuffer size
+	uint32_t lightCount;
+	float time; // seconds since startup
+	float deltaTime; // since the last frame, for exposure adaptation
+	uint32_t padding;
+};
+
+// matches pointLight in shaders/clusters.glsl - spot lights too, with a cone
+struct pointLight {
+	glm::vec4 position; // xyz world space, w range
+	glm::vec4 color; // rgb
+	glm::vec4 direction; // xyz spot axis, w cosine of the cone angle - -1 for point lights
+};
+
+// matches the exposure buffer in shaders/post.glsl
+struct postExposure {
+	float adaptedLuminance;
+	float exposure;
+	uint32_t histogram[histogramBins];
+};
+
+// matches postParameters in shaders/post.glsl
+struct postPushConstants {
+	uint32_t writeNextLevel;
+	uint32_t swapRedBlue;
+};
+
+// push constants for shaders/cull.comp - the meshlet range of the LOD being drawn
+struct cullPushConstants {
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+	uint32_t indexBase; // the LOD's first index - each LOD has an index buffer of its own
+	uint32_t earlyPhase; // only draw what was visible last frame, the late pass draws the rest
+	uint32_t meshletStride; // meshlets of every LOD, the visibility bits of one instance
+	uint32_t instanceCount; // the dispatch wraps into y, so the groups past the last instance have to know to do nothing
+};
+
+// push constants for shaders/hiZ.comp
+struct hiZPushConstants {
+	uint32_t levelCount;
+	uint32_t sampleCount; // of the depth buffer
+};
+
+// matches particle in shaders/particles.comp
+struct particle {
+	glm::vec4 position; // xyz, w age in seconds
+	glm::vec4 velocity; // xyz, w lifetime in seconds
+};
+
+// matches the counter buffers in shaders/particles.comp - written by the last stage of each step, with the arguments for
+// drawing the particles and for the next step's simulation dispatch
+struct particleCounters {
+	VkDrawIndirectCommand draw; // instanceCount is the number of particles alive
+	VkDispatchIndirectCommand simulate;
+	uint32_t appended;
+};
+
+// push constants for shaders/particles.comp
+struct particlePushConstants {
+	glm::vec4 emitter; // xyz position, w launch speed
+	glm::vec4 collider; // xyz sphere center, w radius
+	float groundHeight;
+	float deltaTime; // seconds
+	float lifetime;
+	float gravity;
+	uint32_t emitCount;
+	uint32_t capacity;
+	uint32_t seed;
+	uint32_t padding;
+};
+
+// reads a whole file, used for SPIR-V
+std::vector<char> readFile(const std::string& filename);
+
 // simplifies the passing of swapchain details
 struct SwapchainSupportDetails {
   VkSurfaceCapabilitiesKHR capabilities;
@@ -63,13 +239,29 @@ struct SwapchainSupportDetails {
 
 class app {
 public:
+	app(int argc, char const* argv[]);
   	void run() { // high level program structure
+		PROFILE_THREAD("main");
 		initGLFW();
 		initVulkan();
-		mainLoop();
+		if (pipelineBenchmark) runPipelineBenchmark(); // --bench-pipelines, instead of running
+		else if (particleBenchmark) runParticleBenchmark(); // --bench-particles
+		else mainLoop();
 		cleanup();
+		writeProfile();
 	}
 private:
+	// host memory for the driver - declared first, so it outlives every object created with its callbacks
+	hostAllocator host;
+	bool traceAllocations = false; // --trace-allocations, prints every allocation the driver makes while drawing a frame
+
+	// --profile, where the CPU profile is written on exit - only with the profiler built in, see profiler.h
+	const char* profilePath = nullptr;
+	void writeProfile();
+
+	// worker threads for CPU side work, like mesh import and the scene update
+	threadPool workers;
+
 	// setting up a window to display + input callbacks
 	GLFWwindow* window;
 	void initGLFW();
@@ -77,18 +269,44 @@ private:
 	// setting up the graphics API
 	VkInstance instance;
 	void initVulkan() {
+		PROFILE_ZONE("initVulkan");
 		// startup sequence
 		createInstance();
 		initDebugCallback();
 		createSurface();
 		pickPhysicalDevice();
+		pickSampleCount();
+		pickDepthFormat();
+		pickHdrFormat();
 		createLogicalDevice();
 		createSwapchain();
 		createImageViews();
 		createRenderPass();
+		createDescriptorSetLayout();
+		createPipelineManager();
 		createGraphicsPipeline();
+		createColorResources();
+		createDepthResources();
 		createFramebuffers();
+		createQueryPool();
 		createCommandPool();
+		loadMesh();
+		buildScene();
+		createParticlePipeline();
+		createParticleBuffers(particleCapacity);
+		createUniformBuffers();
+		createInstanceBuffers();
+		placeLights();
+		createClusterPipeline();
+		createClusterResources();
+		createDescriptorPool();
+		createDescriptorSets();
+		createCullPipeline();
+		createHiZPipeline();
+		createHiZResources();
+		createCullResources();
+		createPostPipeline();
+		createPostResources();
 		createCommandBuffers();
 		createSyncObjects();
 	}
@@ -114,8 +332,17 @@ private:
 	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 	void pickPhysicalDevice();
 
+	// multisampling - sample count is picked from the device limits, and can be cycled at runtime
+	VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+	VkSampleCountFlags supportedSampleCounts = VK_SAMPLE_COUNT_1_BIT;
+	void pickSampleCount();
+	void cycleSampleCount();
+
 	// logical device
 	VkDevice device;
+	bool pipelineStatisticsSupported = false; // optional feature, used to count fragment shader invocations
+	bool multiDrawIndirectSupported = false; // optional features, multiDrawIndirect and drawIndirectFirstInstance - required by meshlet culling
+	bool drawIndirectCountSupported = false; // Vulkan 1.2 feature, lets the culling pass set the number of draws
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
 	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
@@ -124,10 +351,10 @@ private:
 
 	// swapchain
 	std::vector<VkImage> swapchainImages;
-	VkSwapchainKHR swapchain;
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
 	void createSwapchain();
 	SwapchainSupportDetails querySwapchainSupport(VkPhysicalDevice device);
-	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
+	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats, bool storageUsage);
 	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
 	bool checkDeviceExtensionSupport(VkPhysicalDevice device);
@@ -137,16 +364,355 @@ private:
 	VkFormat swapchainImageFormat;
 	VkExtent2D swapchainExtent;
 	void createImageViews();
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t baseLevel = 0, uint32_t levelCount = 1);
+
+	// image, buffer + memory allocation helpers
+	std::optional<uint32_t> findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory, const VkAllocationCallbacks* allocator);
+	void uploadBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory); // through a staging buffer, into device local memory
+	void createImage(uint32_t w, uint32_t h, VkSampleCountFlagBits samples, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t mipLevels = 1);
+
+	// multisampled color target, resolved into the HDR target at the end of the subpass
+	VkImage colorImage = VK_NULL_HANDLE;
+	VkDeviceMemory colorImageMemory = VK_NULL_HANDLE;
+	VkImageView colorImageView = VK_NULL_HANDLE;
+	void createColorResources();
+
+	// reversed-Z depth buffer - cleared to 0.0, with 1.0 at the near plane and GREATER depth compare
+	VkFormat depthFormat;
+	VkImage depthImage;
+	VkDeviceMemory depthImageMemory;
+	VkImageView depthImageView;
+	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
+	void pickDepthFormat();
+	void createDepthResources();
+
+	// optional depth-only subpass ahead of the color subpass, which then uses EQUAL compare so each pixel is shaded once
+	bool depthPrepass = true;
+	void toggleDepthPrepass();
+
+	// mesh - imported from the path given on the command line, or the procedural overdraw benchmark without one. A
+	// baked cache is written after the first import, and uploaded straight from its mapping on later runs
+	std::string meshPath;
+	meshBounds bounds;
+	std::vector<meshLod> lods;
+	uint32_t lodLevel = 0; // index into lods, cycled with 'L'
+	uint32_t drawnLod = 0; // lodLevel, or the nearest coarser LOD that's resident while it isn't
+	VkBuffer vertexBuffer;
+	VkDeviceMemory vertexBufferMemory;
+	std::vector<VkBuffer> lodIndexBuffers; // one per LOD, VK_NULL_HANDLE while evicted
+	std::vector<VkDeviceMemory> lodIndexBuffersMemory;
+	std::vector<uint32_t> hostIndices; // every LOD's indices, for streaming evicted ones back in
+	uint32_t meshletTotal = 0; // over every LOD
+	void loadMesh();
+	void uploadMesh(const meshView& mesh);
+	void cycleLodLevel();
 
-	// graphics pipeline
+	// device memory budget and residency (residency.cc) - per heap budget and usage are sampled every frame, from
+	// VK_EXT_memory_budget where the device has it. Mesh LODs other than the coarsest are streamable: once the device
+	// local heap crosses its high watermark, the least recently used ones not recorded into any command buffer are
+	// evicted, and an evicted LOD is streamed back in when it's selected again, with the nearest coarser one drawn if
+	// there's no room for it. --memory-budget caps the budget of device local heaps, to exercise eviction on devices
+	// with plenty of memory, lavapipe included
+	bool memoryBudgetSupported = false;
+	uint64_t simulatedBudget = 0; // bytes, 0 without --memory-budget
+	uint32_t deviceLocalHeap = 0; // where the mesh lives, and the heap that's reported
+	std::vector<heapBudget> heapBudgets; // indexed by heap, as of the last sample
+	residencyManager residency;
+	std::vector<uint32_t> lodResources; // residency ids, indexed by LOD
+	std::vector<uint32_t> recordedLods; // the LOD each command buffer draws
+	uint64_t residencyFrame = 0;
+	uint64_t evictionCooldown = 0; // no evictions before this frame
+	int64_t minHeadroom = INT64_MAX; // bytes, over the report interval
+	void sampleMemoryBudget();
+	void registerLods();
+	void uploadLod(uint32_t lod);
+	uint32_t residentLod(uint32_t wanted) const;
+	void updateResidency();
+
+	// instanced scene (sceneInstances.cc) - copies of the mesh placed by a transform hierarchy. World matrices are written
+	// by the scene graph straight into a persistently mapped instance buffer per swapchain image, each of which only gets
+	// the transforms that changed since it was last used. The count is set with --instances on the command line
+	uint32_t instanceCount = 1;
+	sceneGraph scene;
+	std::vector<std::pair<uint32_t, nodeTransform>> spinningGroups; // scene handle and resting transform of each animated group
+	std::vector<uint32_t> instanceNodes; // scene handle of each instance
+	glm::vec3 sceneCenter; // bounds of the whole scene, framed by the camera
+	float sceneRadius;
+	std::vector<VkBuffer> instanceBuffers;
+	std::vector<VkDeviceMemory> instanceBuffersMemory;
+	std::vector<void*> instanceBuffersMapped; // host coherent
+	std::vector<uint64_t> instanceBufferVersions; // scene version each buffer was last brought up to date with
+	double sceneUpdateAccumulator = 0.0; // milliseconds
+	double sceneTransformsWritten = 0.0;
+	void buildScene();
+	void createInstanceBuffers();
+	void cleanupInstanceBuffers();
+	void updateScene(uint32_t imageIndex);
+
+	// camera uniforms, one buffer + descriptor set per swapchain image - the set also holds the instance buffer
+	VkDescriptorSetLayout descriptorSetLayout;
+	VkDescriptorPool descriptorPool;
+	std::vector<VkDescriptorSet> descriptorSets;
+	std::vector<VkBuffer> uniformBuffers;
+	std::vector<VkDeviceMemory> uniformBuffersMemory;
+	std::vector<void*> uniformBuffersMapped; // persistently mapped, host coherent
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	void createDescriptorSetLayout();
+	void createUniformBuffers();
+	void createDescriptorPool();
+	void createDescriptorSets();
+	void updateUniformBuffer(uint32_t imageIndex);
+
+	// GPU meshlet culling (meshletCulling.cc) - before the render pass, a compute pass tests each meshlet of the current LOD
+	// in every instance against the frustum and its normal cone, and appends an indexed indirect draw for each one that
+	// survives. Indirect and statistics buffers are per swapchain image, like the uniforms. 'C' toggles it
+	bool meshletCulling = true;
+	VkBuffer meshletBuffer;
+	VkDeviceMemory meshletBufferMemory;
+	VkDescriptorSetLayout cullDescriptorSetLayout;
+	VkPipelineLayout cullPipelineLayout;
+	VkPipeline cullPipeline;
+	VkPipeline cullLatePipeline; // the second phase of Hi-Z culling, see hiZCulling.cc
+	VkBuffer visibilityBuffer; // a bit per meshlet of every LOD in every instance, drawn last frame
+	VkDeviceMemory visibilityBufferMemory;
+	VkDescriptorPool cullDescriptorPool;
+	std::vector<VkDescriptorSet> cullDescriptorSets;
+	std::vector<VkBuffer> indirectBuffers; // VkDrawIndexedIndirectCommand per meshlet and instance, compacted
+	std::vector<VkDeviceMemory> indirectBuffersMemory;
+	std::vector<VkBuffer> cullStatisticsBuffers; // draw count, visible triangles, late draw count, occluded + tested meshlets, host visible
+	std::vector<VkDeviceMemory> cullStatisticsBuffersMemory;
+	std::vector<void*> cullStatisticsMapped;
+	std::vector<bool> cullStatisticsPending;
+	double visibleTriangleAccumulator = 0.0;
+	double visibleMeshletAccumulator = 0.0;
+	double lateMeshletAccumulator = 0.0;
+	double occludedMeshletAccumulator = 0.0;
+	double testedMeshletAccumulator = 0.0;
+	uint32_t cullStatisticsSamples = 0;
+	void createCullPipeline();
+	void createCullResources();
+	void cleanupCullResources();
+	cullPushConstants cullParameters() const;
+	void dispatchMeshletCulling(VkCommandBuffer commandBuffer) const; // every meshlet of the drawn LOD in every instance
+	void recordMeshletCulling(VkCommandBuffer commandBuffer, size_t imageIndex);
+	void recordMeshDraw(VkCommandBuffer commandBuffer, size_t imageIndex, bool late);
+	void readCullStatistics(uint32_t imageIndex);
+	void toggleMeshletCulling();
+
+	// two phase Hi-Z occlusion culling (hiZCulling.cc) - on top of meshlet culling, the frame is drawn in two render
+	// passes. The early one only draws the meshlets that were visible last frame, then a single compute dispatch reduces
+	// its depth into a pyramid of mips, keeping the farthest depth of each texel's footprint. A late culling pass tests
+	// every meshlet's bounding sphere against the pyramid, updates the visibility bits, and the late render pass draws
+	// the ones that just became visible. The depth buffer has to be kept and sampled for this, so it's no longer
+	// transient. 'H' toggles it, --bench-occlusion reports the frame time with and without it on the instance field
+	bool hiZCulling = true;
+	bool hiZSupported = false; // multi draw indirect, storage image array indexing and a sampleable depth format
+	VkSampleCountFlags hiZSampleCounts = 0; // depth sample counts the pyramid can be built from
+	bool hiZActive = false; // Hi-Z culling as of the last swapchain rebuild, what the targets and passes were made for
+	bool occlusionBenchmark = false;
+	double occlusionBaseline = 0.0; // ms/frame without Hi-Z culling, for --bench-occlusion
+	VkRenderPass earlyRenderPass = VK_NULL_HANDLE; // compatible with renderPass, but keeping depth and color for the late one
+	VkRenderPass lateRenderPass = VK_NULL_HANDLE;
+	VkSampler hiZSampler = VK_NULL_HANDLE;
+	VkDescriptorSetLayout hiZDescriptorSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout hiZPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline hiZPipeline = VK_NULL_HANDLE, hiZMultisampledPipeline = VK_NULL_HANDLE;
+	VkBuffer hiZCounterBuffer = VK_NULL_HANDLE; // workgroups done with their part of the pyramid, reset by the last one
+	VkDeviceMemory hiZCounterBufferMemory = VK_NULL_HANDLE;
+	VkImage pyramidImage = VK_NULL_HANDLE; // R32 float, level 0 is the largest power of two that fits in the framebuffer
+	VkDeviceMemory pyramidImageMemory;
+	VkImageView pyramidView; // every level, for the late culling pass
+	VkImageView pyramidLevelViews[maxPyramidLevels]; // one per level, for building it
+	VkExtent2D pyramidExtent;
+	uint32_t pyramidLevels = 0;
+	uint32_t pyramidSourceSamples = 1; // of the depth buffer it's built from
+	VkDescriptorPool hiZDescriptorPool;
+	VkDescriptorSet hiZDescriptorSet;
+	bool twoPhaseCulling() const { return meshletCulling && hiZActive; }
+	void createHiZPipeline();
+	void createHiZResources();
+	void cleanupHiZResources();
+	void recordHiZCulling(VkCommandBuffer commandBuffer, size_t imageIndex);
+	void toggleHiZCulling();
+
+	// CPU instance culling (instanceCulling.cc) - for when GPU culling isn't an option. Each frame the instance bounds are
+	// refit into a BVH and tested against the frustum, then optionally against a small software depth buffer holding the
+	// coarsest LOD of the nearest instances. The frame's command buffer is rerecorded with draws for the survivors only.
+	// On by default without GPU culling support, 'B' toggles it and 'O' toggles the occlusion test
+	bool cpuCulling = false;
+	bool occlusionCulling = true;
+	boundingVolumeHierarchy instanceBvh;
+	occlusionBuffer occlusion{occlusionBufferWidth, occlusionBufferHeight};
+	std::vector<aabb> instanceBounds; // world space
+	std::vector<float> occluderPositions; // coarsest LOD, 3 xyz mesh space vertices per triangle
+	std::vector<uint32_t> visibleInstances; // survivors for the frame being recorded, sorted
+	cameraUniforms frameCamera{}; // camera of the frame being recorded, kept by updateUniformBuffer
+	double cpuCullAccumulator = 0.0; // milliseconds
+	double cpuCullVisibleAccumulator = 0.0;
+	double cpuCullOccludedAccumulator = 0.0;
+	uint32_t cpuCullSamples = 0;
+	void buildOccluders(const meshView& mesh);
+	void cullInstances();
+	void toggleCpuCulling();
+	void toggleOcclusionCulling();
+
+	// GPU particles (particles.cc) - a fountain over the scene, bouncing off the ground and the bounding sphere of the
+	// mesh. Each step is three compute passes over SSBOs, recorded ahead of the render pass: simulation, which appends the
+	// survivors of the previous step to this step's buffer, emission, and a single invocation that writes the indirect
+	// arguments for the draw and the next simulation dispatch. The particle and counter buffers are per frame in flight,
+	// so the next frame's simulation only depends on the previous one's, and can overlap its rendering. The survivors are
+	// drawn as camera facing quads with one indirect draw. 'F' toggles them - the command buffer is recorded every frame
+	// while they're on, for the time step. --particles N sets the capacity, --bench-particles times steps of 10k to 10M
+	bool particles = false;
+	bool particleBenchmark = false;
+	uint32_t particleCapacity = defaultParticleCount;
+	VkDescriptorSetLayout particleDescriptorSetLayout;
+	VkPipelineLayout particlePipelineLayout;
+	VkPipeline particleSimulatePipeline, particleEmitPipeline, particleFinalizePipeline;
+	VkPipeline particlePipeline; // graphics, from the pipeline manager
+	VkDescriptorPool particleDescriptorPool;
+	VkDescriptorSet particleDescriptorSets[MAX_FRAMES_IN_FLIGHT]; // this frame's buffers, and the previous frame's
+	std::vector<VkDescriptorSet> particleDrawDescriptorSets; // graphics set layout, per swapchain image and frame in flight
+	VkBuffer particleBuffers[MAX_FRAMES_IN_FLIGHT];
+	VkDeviceMemory particleBuffersMemory[MAX_FRAMES_IN_FLIGHT];
+	VkBuffer particleCounterBuffers[MAX_FRAMES_IN_FLIGHT]; // particleCounters, host visible
+	VkDeviceMemory particleCounterBuffersMemory[MAX_FRAMES_IN_FLIGHT];
+	void* particleCountersMapped[MAX_FRAMES_IN_FLIGHT];
+	bool particleStatisticsPending[MAX_FRAMES_IN_FLIGHT] = {};
+	particlePushConstants particleParameters{};
+	std::chrono::steady_clock::time_point lastParticleTime;
+	float particleEmitAccumulator = 0.0f; // fractional particles carried over to the next frame
+	double particleAliveAccumulator = 0.0;
+	double particleEmittedAccumulator = 0.0;
+	uint32_t particleSamples = 0;
+	void createParticlePipeline();
+	void createParticleBuffers(uint32_t capacity);
+	void cleanupParticleBuffers();
+	void writeParticleDrawDescriptorSets(); // allocated from the swapchain's descriptor pool
+	void updateParticles(); // this frame's time step and emission
+	void recordParticleSimulation(VkCommandBuffer commandBuffer, uint32_t frame, const particlePushConstants& parameters);
+	void recordParticleDraw(VkCommandBuffer commandBuffer, size_t imageIndex);
+	void readParticleStatistics();
+	void runParticleBenchmark();
+	void toggleParticles();
+
+	// clustered lighting (clusteredLighting.cc) - up to 16k point and spot lights drifting around the scene, animated on
+	// the CPU into a light buffer per swapchain image. Before the render pass a compute pass bins them into a froxel grid
+	// of 16x9 screen tiles by 24 depth slices, writing a compact light index list per cluster, and the color pass only
+	// shades a fragment with the lights of its own cluster. Light ranges shrink as the count grows, so about the same
+	// number reach any point of the scene. 'N' cycles the light count from 16 to 16k, --lights N sets it, and
+	// --bench-lights steps through every count, one frame time report each, before closing the window
+	uint32_t lightCount = defaultLightCount;
+	bool lightBenchmark = false;
+	std::vector<pointLight> lightOrigins; // everything but the position is as drawn, the position is the orbit center
+	std::vector<glm::vec2> lightOrbits; // angular speed in radians per second, starting angle
+	float lightVolume; // of the box the lights move in, sets their range
+	VkDescriptorSetLayout clusterDescriptorSetLayout;
+	VkPipelineLayout clusterPipelineLayout;
+	VkPipeline clusterPipeline;
+	VkDescriptorPool clusterDescriptorPool;
+	std::vector<VkDescriptorSet> clusterDescriptorSets;
+	std::vector<VkBuffer> lightBuffers; // pointLight * maxLightCount, host visible
+	std::vector<VkDeviceMemory> lightBuffersMemory;
+	std::vector<void*> lightBuffersMapped;
+	std::vector<VkBuffer> clusterBuffers; // first index + count per cluster
+	std::vector<VkDeviceMemory> clusterBuffersMemory;
+	std::vector<VkBuffer> lightIndexBuffers; // maxLightsPerCluster per cluster at most
+	std::vector<VkDeviceMemory> lightIndexBuffersMemory;
+	std::vector<VkBuffer> clusterStatisticsBuffers; // index count + dropped lights, host visible
+	std::vector<VkDeviceMemory> clusterStatisticsBuffersMemory;
+	std::vector<void*> clusterStatisticsMapped;
+	std::vector<bool> clusterStatisticsPending;
+	double clusterIndexAccumulator = 0.0;
+	double clusterDroppedAccumulator = 0.0;
+	uint32_t clusterStatisticsSamples = 0;
+	void placeLights();
+	void createClusterPipeline();
+	void createClusterResources();
+	void cleanupClusterResources();
+	void updateLights(uint32_t imageIndex);
+	void recordLightBinning(VkCommandBuffer commandBuffer, size_t imageIndex);
+	void readClusterStatistics(uint32_t imageIndex);
+	void cycleLightCount();
+
+	// HDR rendering and post-processing (postProcessing.cc) - the scene is rendered into a floating point target, which a
+	// chain of compute passes turns into the swapchain image. Bloom is the bright parts downsampled into a chain of levels
+	// and added back up, the exposure is eased towards a luminance histogram gathered alongside the first downsample, and
+	// the last pass composites the bloom, tonemaps and dithers. Adjacent stages share a dispatch where they can - two
+	// bloom levels per downsample, the second one from the first one's tile in shared memory. The final image goes
+	// straight into the swapchain image where the surface allows storage usage, and through a copy otherwise
+	VkFormat hdrFormat;
+	VkImage hdrImage;
+	VkDeviceMemory hdrImageMemory;
+	VkImageView hdrImageView;
+	bool storageWriteWithoutFormatSupported = false; // lets the tonemapping pass write BGRA swapchain images
+	bool swapchainStorage = false; // the tonemapping pass writes the swapchain image, instead of an image copied into it
+	VkSampler postSampler;
+	VkDescriptorSetLayout postDescriptorSetLayout;
+	VkPipelineLayout postPipelineLayout;
+	VkPipeline bloomPrefilterPipeline, bloomDownsamplePipeline, bloomUpsamplePipeline, exposurePipeline, tonemapPipeline;
+	VkBuffer exposureBuffer; // postExposure, persists across frames
+	VkDeviceMemory exposureBufferMemory;
+	VkImage bloomImages[bloomLevels];
+	VkDeviceMemory bloomImagesMemory[bloomLevels];
+	VkImageView bloomImageViews[bloomLevels];
+	VkImage postOutputImage = VK_NULL_HANDLE; // without swapchainStorage - RGBA8, copied into the swapchain image
+	VkDeviceMemory postOutputImageMemory;
+	VkImageView postOutputImageView;
+	VkDescriptorPool postDescriptorPool;
+	VkDescriptorSet bloomDownsampleSets[bloomDownsamplePasses];
+	VkDescriptorSet bloomUpsampleSets[bloomLevels - 1]; // into each level from the one below it
+	std::vector<VkDescriptorSet> postDescriptorSets; // per swapchain image, for exposure and tonemapping - the uniforms and the output
+	void pickHdrFormat();
+	bool storageOutputFormat(VkFormat format); // whether the tonemapping pass can write it
+	void createPostPipeline();
+	void createPostResources();
+	void cleanupPostResources();
+	void recordPostProcessing(VkCommandBuffer commandBuffer, size_t imageIndex);
+
+	// graphics pipelines (pipelines.cc) - every variant comes out of the pipeline manager, which outlives the swapchain.
+	// All materials are warmed up for each sample count and pre-pass setting ahead of the first frame, in parallel, so
+	// none of the toggles wait on a compile. --bench-pipelines measures the compile throughput on 1 to all threads instead
+	pipelineManager pipelines;
+	uint32_t vertexShader, fragmentShader, depthShader, particleVertexShader, particleFragmentShader; // shader ids, the same for every manager set up by initPipelineManager
+	uint32_t material = 0; // shading model * paletteCount + palette
+	bool pipelineBenchmark = false;
 	VkPipelineLayout pipelineLayout;
 	VkPipeline graphicsPipeline;
-	void createGraphicsPipeline();
+	VkPipeline depthPrepassPipeline = VK_NULL_HANDLE; // position only, for the depth pre-pass
+	void initPipelineManager(pipelineManager& manager, const std::vector<char>& cacheData);
+	void createPipelineManager();
+	void createGraphicsPipeline(); // picks the variants for the current settings
+	pipelineState colorPipelineState(VkSampleCountFlagBits samples, bool prepass, uint32_t material) const;
+	pipelineState prepassPipelineState(VkSampleCountFlagBits samples) const;
+	pipelineState particlePipelineState(VkSampleCountFlagBits samples, bool prepass) const;
+	// every variant the app can use, registering a compatible render pass for each layout - destroyed by the caller
+	std::vector<pipelineState> pipelinePermutations(pipelineManager& manager, std::vector<VkRenderPass>& renderPasses);
+	void runPipelineBenchmark();
+	void cycleMaterial();
 	VkShaderModule createShaderModule(const std::vector<char>& code);
 
-	// render pass
+	// render pass - subpass 0 is the depth pre-pass if enabled, followed by the color subpass
 	VkRenderPass renderPass;
 	void createRenderPass();
+	// the early and late phases are variants for two phase Hi-Z culling, which split the frame over two passes
+	enum renderPassPhase { singlePhase, earlyPhase, latePhase };
+	VkRenderPass buildRenderPass(VkSampleCountFlagBits samples, bool prepass, const VkAllocationCallbacks* allocator, renderPassPhase phase = singlePhase);
+
+	// pipeline statistics queries, one per command buffer, used to count fragment shader invocations - and timestamps,
+	// gpuStageCount + 1 per command buffer, for the GPU time of each stage of the frame
+	VkQueryPool statisticsQueryPool = VK_NULL_HANDLE;
+	VkQueryPool timestampQueryPool = VK_NULL_HANDLE; // without timestamp support on the graphics queue, there's none
+	float timestampPeriod = 0.0f; // nanoseconds per tick
+	uint64_t timestampMask = 0; // the valid bits of a timestamp
+	std::vector<bool> statisticsQueryPending; // set once a command buffer has been submitted with its queries
+	double fragmentInvocationAccumulator = 0.0;
+	uint32_t fragmentInvocationSamples = 0;
+	double gpuStageAccumulators[gpuStageCount] = {}; // milliseconds
+	uint32_t gpuTimeSamples = 0;
+	void createQueryPool();
+	void readStatisticsQuery(uint32_t imageIndex);
 
 	// framebuffers
 	std::vector<VkFramebuffer> swapchainFramebuffers;
@@ -157,6 +723,23 @@ private:
 	VkCommandPool commandPool;
 	void createCommandPool(); // pool manages the memory that is used by buffers
 	void createCommandBuffers(); // allocated out of the pool
+	void recordCommandBuffer(size_t imageIndex); // only executes the chunks, which have to be up to date
+
+	// command chunks - each is rerecorded only once the inputs it was recorded from change, compared by hash, and
+	// otherwise replayed as it is. A primary command buffer is rerecorded along with any of its chunks
+	std::vector<VkCommandBuffer> chunkBuffers; // commandChunkCount per swapchain image
+	std::vector<uint64_t> chunkKeys; // hash of the inputs of each, 0 when it isn't recorded
+	double chunkRecordTimes[commandChunkCount] = {}; // milliseconds, the last time each chunk was recorded
+	double chunksReusedAccumulator = 0.0;
+	double chunksRecordedAccumulator = 0.0;
+	double recordingSavedAccumulator = 0.0; // milliseconds, the chunks reused at what they last took to record
+	bool chunkUsed(commandChunk chunk) const;
+	uint64_t chunkKey(commandChunk chunk) const;
+	void recordChunk(commandChunk chunk, size_t imageIndex);
+	void recordMeshState(VkCommandBuffer commandBuffer, size_t imageIndex); // buffers, descriptors and dynamic state, not inherited by a secondary
+	void recordViewportState(VkCommandBuffer commandBuffer);
+	bool updateCommandChunks(size_t imageIndex); // returns whether the primary needs rerecording
+	void executeChunks(VkCommandBuffer commandBuffer, size_t imageIndex, std::initializer_list<commandChunk> chunks);
 
 	// synchronization objects
 	std::vector<VkSemaphore> imageAvailableSemaphores;
@@ -166,11 +749,28 @@ private:
 	void createSyncObjects();
 	size_t currentFrame = 0;
 
+	// deferred destruction - objects that submitted work may still reference are handed to the queue, stamped with the
+	// latest submission, and destroyed once the fence of a later or equal submission has been waited on
+	deletionQueue deletions;
+	uint64_t submissionCount = 0;
+	uint64_t fenceSubmissions[MAX_FRAMES_IN_FLIGHT] = {}; // last submission signaling each in flight fence
+
 	// contains program main loop behavior
 	void drawFrame();
 	void mainLoop();
 
-	// just handling escape event to close the window more easily right now
+	// frame timing, averaged over frameTimeReportInterval frames and reported along with the current settings
+	std::chrono::steady_clock::time_point lastFrameTime;
+	double frameTimeAccumulator = 0.0; // milliseconds
+	uint32_t framesAccumulated = 0;
+	double hostAllocationAccumulator = 0.0; // driver host allocations between the fence wait and present
+	double hostAllocationBytesAccumulator = 0.0;
+	void updateFrameTime();
+	void resetFrameTime();
+
+	// escape closes the window, 'M' cycles the MSAA sample count, 'P' toggles the depth pre-pass, 'L' cycles the mesh LOD,
+	// 'K' cycles the material, 'C' toggles meshlet culling, 'B' toggles CPU culling, 'O' toggles its occlusion test,
+	// 'F' toggles the particles, 'N' cycles the light count, 'H' toggles Hi-Z occlusion culling
 	static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 	static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
 
@@ -178,6 +778,17 @@ private:
 	bool framebufferResized = false;
 	void recreateSwapchain();
 
+	// swapchains replaced by a rebuild, with their image views. No fence covers the presents still queued on them, so
+	// they're only handed to the deletion queue once the new swapchain has presented - the presentation engine is done
+	// with the old images by the time it takes one from the new swapchain
+	struct retiredSwapchain {
+		VkSwapchainKHR swapchain;
+		std::vector<VkImageView> imageViews;
+		const VkAllocationCallbacks* allocator; // of its generation, kept alive by the swapchain's own allocations
+	};
+	std::vector<retiredSwapchain> retiredSwapchains;
+	void releaseRetiredSwapchains();
+
 	// destroying vk objects and shutting down glfw
 	void cleanupSwapchain(); // broken out for swapchain recreation
 	void cleanup();
@@ -0,0 +1,224 @@
+#include "app.h"
+
+#include <cmath>
+#include <random>
+
+// ╔═╗┬  ┬ ┬┌─┐┌┬┐┌─┐┬─┐┌─┐┌┬┐  ╦  ┬┌─┐┬ ┬┌┬┐┬┌┐┌┌─┐
+// ║  │  │ │└─┐ │ ├┤ ├┬┘├┤  ││  ║  ││ ┬├─┤ │ ││││││ ┬
+// ╚═╝┴─┘└─┘└─┘ ┴ └─┘┴└─└─┘─┴┘  ╩═╝┴└─┘┴ ┴ ┴ ┴┘└┘└─┘
+// one compute invocation per cluster, see shaders/clusters.comp - the lists are read by shaders/basic.frag
+
+void app::placeLights() {
+	// scattered through a box around the scene - as tall as the scene for a single mesh, and a slab a couple of meshes
+	// high over a field of instances. Every light up to maxLightCount is placed up front, so changing the count only
+	// adds or removes lights and rescales their ranges
+	const float meshRadius = glm::length(glm::vec3(bounds.extent[0], bounds.extent[1], bounds.extent[2]));
+	const glm::vec3 halfExtent(sceneRadius, std::min(sceneRadius, 2.0f * meshRadius), sceneRadius);
+	lightVolume = 8.0f * halfExtent.x * halfExtent.y * halfExtent.z;
+
+	std::mt19937 rng(4321);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	lightOrigins.resize(maxLightCount);
+	lightOrbits.resize(maxLightCount);
+	for (uint32_t i = 0; i < maxLightCount; i++) {
+		pointLight& light = lightOrigins[i];
+		light.position = glm::vec4(sceneCenter + halfExtent * glm::vec3(unit(rng), unit(rng), unit(rng)), 0.0f);
+		const float hue = 3.1415927f * unit(rng); // same palette as the materials in shaders/basic.frag, at half strength
+		light.color = glm::vec4(0.25f + 0.25f * std::cos(hue), 0.25f + 0.25f * std::cos(hue + 2.0735f), 0.25f + 0.25f * std::cos(hue + 4.2097f), 0.0f);
+		if (i % 2 == 0) // every other one is a spot light, pointing roughly down with a 20 to 40 degree cone
+			light.direction = glm::vec4(glm::normalize(glm::vec3(0.5f * unit(rng), -1.0f, 0.5f * unit(rng))), std::cos(0.5236f + 0.1745f * unit(rng)));
+		else
+			light.direction = glm::vec4(0.0f, -1.0f, 0.0f, -1.0f);
+		lightOrbits[i] = glm::vec2(0.6f * unit(rng), 3.1415927f * unit(rng));
+	}
+}
+
+void app::createClusterPipeline() {
+	// camera uniforms, then lights, clusters and light indices at the same bindings as in the graphics set, and statistics
+	VkDescriptorSetLayoutBinding bindings[5]{};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	for (uint32_t i = 1; i < 5; i++) {
+		bindings[i].binding = 4 + i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = nullptr;
+	layoutInfo.bindingCount = 5;
+	layoutInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, host.callbacks(), &clusterDescriptorSetLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create light binning descriptor set layout!");
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &clusterDescriptorSetLayout;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, host.callbacks(), &clusterPipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create light binning pipeline layout!");
+
+	auto clusterShaderCode = readFile("shaders/clusters.spv");
+	VkShaderModule clusterShaderModule = createShaderModule(clusterShaderCode);
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.pNext = nullptr;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = clusterShaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = clusterPipelineLayout;
+	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, host.callbacks(), &clusterPipeline) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create light binning pipeline!");
+	vkDestroyShaderModule(device, clusterShaderModule, host.callbacks());
+}
+
+void app::createClusterResources() {
+	const size_t imageCount = swapchainImages.size();
+	const VkDeviceSize lightSize = sizeof(pointLight) * maxLightCount;
+	const VkDeviceSize clusterSize = 2 * sizeof(uint32_t) * clusterCount;
+	const VkDeviceSize indexSize = sizeof(uint32_t) * clusterCount * maxLightsPerCluster;
+	const VkDeviceSize statisticsSize = 2 * sizeof(uint32_t);
+
+	lightBuffers.resize(imageCount);
+	lightBuffersMemory.resize(imageCount);
+	lightBuffersMapped.resize(imageCount);
+	clusterBuffers.resize(imageCount);
+	clusterBuffersMemory.resize(imageCount);
+	lightIndexBuffers.resize(imageCount);
+	lightIndexBuffersMemory.resize(imageCount);
+	clusterStatisticsBuffers.resize(imageCount);
+	clusterStatisticsBuffersMemory.resize(imageCount);
+	clusterStatisticsMapped.resize(imageCount);
+	clusterStatisticsPending.assign(imageCount, false);
+	for (size_t i = 0; i < imageCount; i++) {
+		createBuffer(lightSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			lightBuffers[i], lightBuffersMemory[i], host.swapchainCallbacks());
+		vkMapMemory(device, lightBuffersMemory[i], 0, lightSize, 0, &lightBuffersMapped[i]);
+		createBuffer(clusterSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, clusterBuffers[i], clusterBuffersMemory[i], host.swapchainCallbacks());
+		createBuffer(indexSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lightIndexBuffers[i], lightIndexBuffersMemory[i], host.swapchainCallbacks());
+		createBuffer(statisticsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			clusterStatisticsBuffers[i], clusterStatisticsBuffersMemory[i], host.swapchainCallbacks());
+		vkMapMemory(device, clusterStatisticsBuffersMemory[i], 0, statisticsSize, 0, &clusterStatisticsMapped[i]);
+	}
+
+	VkDescriptorPoolSize poolSizes[2]{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = static_cast<uint32_t>(imageCount);
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = static_cast<uint32_t>(imageCount * 4);
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	poolInfo.maxSets = static_cast<uint32_t>(imageCount);
+	if (vkCreateDescriptorPool(device, &poolInfo, host.swapchainCallbacks(), &clusterDescriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create light binning descriptor pool!");
+
+	std::vector<VkDescriptorSetLayout> layouts(imageCount, clusterDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = clusterDescriptorPool;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(imageCount);
+	allocInfo.pSetLayouts = layouts.data();
+	clusterDescriptorSets.resize(imageCount);
+	if (vkAllocateDescriptorSets(device, &allocInfo, clusterDescriptorSets.data()) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate light binning descriptor sets!");
+
+	for (size_t i = 0; i < imageCount; i++) {
+		VkDescriptorBufferInfo bufferInfos[5]{};
+		bufferInfos[0] = {uniformBuffers[i], 0, sizeof(cameraUniforms)};
+		bufferInfos[1] = {lightBuffers[i], 0, VK_WHOLE_SIZE};
+		bufferInfos[2] = {clusterBuffers[i], 0, VK_WHOLE_SIZE};
+		bufferInfos[3] = {lightIndexBuffers[i], 0, VK_WHOLE_SIZE};
+		bufferInfos[4] = {clusterStatisticsBuffers[i], 0, VK_WHOLE_SIZE};
+
+		VkWriteDescriptorSet descriptorWrites[5]{};
+		for (uint32_t b = 0; b < 5; b++) {
+			descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[b].dstSet = clusterDescriptorSets[i];
+			descriptorWrites[b].dstBinding = b == 0 ? 0 : 4 + b;
+			descriptorWrites[b].dstArrayElement = 0;
+			descriptorWrites[b].descriptorType = b == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[b].descriptorCount = 1;
+			descriptorWrites[b].pBufferInfo = &bufferInfos[b];
+		}
+		vkUpdateDescriptorSets(device, 5, descriptorWrites, 0, nullptr);
+	}
+}
+
+void app::cleanupClusterResources() {
+	for (size_t i = 0; i < lightBuffers.size(); i++) {
+		deletions.destroy(lightBuffers[i], host.swapchainCallbacks());
+		deletions.destroy(lightBuffersMemory[i], host.swapchainCallbacks()); // implicitly unmapped
+		deletions.destroy(clusterBuffers[i], host.swapchainCallbacks());
+		deletions.destroy(clusterBuffersMemory[i], host.swapchainCallbacks());
+		deletions.destroy(lightIndexBuffers[i], host.swapchainCallbacks());
+		deletions.destroy(lightIndexBuffersMemory[i], host.swapchainCallbacks());
+		deletions.destroy(clusterStatisticsBuffers[i], host.swapchainCallbacks());
+		deletions.destroy(clusterStatisticsBuffersMemory[i], host.swapchainCallbacks());
+	}
+	deletions.destroy(clusterDescriptorPool, host.swapchainCallbacks());
+}
+
+void app::updateLights(uint32_t imageIndex) {
+	// ranges scale with the spacing between lights, so the number reaching any one point (about 4/3 pi 1.2^3, or 7) stays
+	// the same whatever the count - each light circles its origin at half its range
+	const float range = 1.2f * std::cbrt(lightVolume / std::max(lightCount, 1u));
+	const float time = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+	pointLight* lights = static_cast<pointLight*>(lightBuffersMapped[imageIndex]);
+	for (uint32_t i = 0; i < lightCount; i++) {
+		pointLight light = lightOrigins[i];
+		const float angle = lightOrbits[i].y + lightOrbits[i].x * time;
+		light.position.x += 0.5f * range * std::cos(angle);
+		light.position.z += 0.5f * range * std::sin(angle);
+		light.position.w = range;
+		lights[i] = light;
+	}
+}
+
+void app::recordLightBinning(VkCommandBuffer commandBuffer, size_t imageIndex) {
+	// the lists of this image were last read by its previous submission, which has completed, so only the counters need
+	// to be reset first
+	vkCmdFillBuffer(commandBuffer, clusterStatisticsBuffers[imageIndex], 0, VK_WHOLE_SIZE, 0);
+	VkMemoryBarrier clearBarrier{};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, clusterPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, clusterPipelineLayout, 0, 1, &clusterDescriptorSets[imageIndex], 0, nullptr);
+	vkCmdDispatch(commandBuffer, (clusterCount + 63) / 64, 1, 1); // local size is 64
+
+	// the color subpass reads the lists, and the host reads the statistics once the frame's fence has signaled
+	VkMemoryBarrier binBarrier{};
+	binBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	binBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	binBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &binBarrier, 0, nullptr, 0, nullptr);
+}
+
+void app::readClusterStatistics(uint32_t imageIndex) {
+	// like the culling statistics, only valid once the command buffer's last submission has completed
+	if (!clusterStatisticsPending[imageIndex]) return;
+	const uint32_t* statistics = static_cast<const uint32_t*>(clusterStatisticsMapped[imageIndex]);
+	clusterIndexAccumulator += statistics[0];
+	clusterDroppedAccumulator += statistics[1];
+	clusterStatisticsSamples++;
+	clusterStatisticsPending[imageIndex] = false;
+}
+
+void app::cycleLightCount() {
+	// the count is a uniform, nothing needs rerecording
+	lightCount = lightCount >= maxLightCount ? minLightCount : std::min(std::max(lightCount * 4, minLightCount), maxLightCount);
+	cout << lightCount << " lights" << endl;
+	resetFrameTime();
+}
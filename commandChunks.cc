@@ -0,0 +1,200 @@
+#include "app.h"
+
+// ╔═╗┌─┐┌┬┐┌┬┐┌─┐┌┐┌┌┬┐  ╔═╗┬ ┬┬ ┬┌┐┌┬┌─┌─┐
+// ║  │ │││││││├─┤│││ ││  ║  ├─┤│ │││││├┴┐└─┐
+// ╚═╝└─┘┴ ┴┴ ┴┴ ┴┘└┘─┴┘  ╚═╝┴ ┴└─┘┘└┘┴ ┴└─┘
+// the frame is recorded in pieces, secondary command buffers per swapchain image, and each frame only the pieces whose
+// inputs changed since they were recorded are rerecorded. The primary command buffer just executes them, so it's cheap
+// to rerecord whenever any of them is.
+//
+// Nothing needs VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT: every chunk reads per image buffers and descriptor sets,
+// so it's only executed by its own image's primary, and that is never resubmitted before the fence of its last
+// submission has been waited on - see drawFrame. Rerecording happens after that wait as well
+
+bool app::chunkUsed(commandChunk chunk) const {
+	switch (chunk) {
+		case particleSimulationChunk:
+		case particleDrawChunk:
+			return particles;
+		case depthPrepassChunk:
+			return depthPrepass;
+		case hiZChunk:
+		case lateOpaqueChunk:
+			return twoPhaseCulling();
+		case lateDepthPrepassChunk:
+			return twoPhaseCulling() && depthPrepass;
+		default:
+			return true;
+	}
+}
+
+uint64_t app::chunkKey(commandChunk chunk) const {
+	// everything a chunk is recorded from that can change without a swapchain rebuild, which rerecords them all anyway
+	uint64_t inputs[9] = {chunk};
+	switch (chunk) {
+		case particleSimulationChunk: // the time step and the emission change every frame, so this one never matches
+			inputs[1] = currentFrame;
+			inputs[2] = hashBytes(reinterpret_cast<const uint8_t*>(&particleParameters), sizeof(particleParameters));
+			break;
+		case cullingChunk:
+		case hiZChunk:
+			inputs[1] = meshletCulling;
+			inputs[2] = drawnLod;
+			inputs[3] = twoPhaseCulling(); // the early pass only draws what was visible last frame
+			break;
+		case depthPrepassChunk:
+		case opaqueChunk:
+		case lateDepthPrepassChunk:
+		case lateOpaqueChunk:
+			inputs[1] = (uint64_t) (chunk == opaqueChunk || chunk == lateOpaqueChunk ? graphicsPipeline : depthPrepassPipeline);
+			inputs[2] = meshletCulling;
+			inputs[3] = cpuCulling;
+			if (cpuCulling) // the survivors - only changes when an instance crosses the frustum or comes out from behind an occluder
+				inputs[4] = hashBytes(reinterpret_cast<const uint8_t*>(visibleInstances.data()), sizeof(uint32_t) * visibleInstances.size());
+			// the index buffer's handle alone isn't enough, an evicted LOD's can come back for another one - and any upload
+			// may have replaced a buffer that a chunk recorded before its eviction still refers to
+			inputs[5] = (uint64_t) lodIndexBuffers[drawnLod];
+			inputs[6] = drawnLod;
+			inputs[7] = lods[drawnLod].indexCount;
+			inputs[8] = residency.stats().uploads;
+			break;
+		case particleDrawChunk:
+			inputs[1] = (uint64_t) particlePipeline;
+			inputs[2] = currentFrame;
+			break;
+		default: // the post-processing chain only changes with the swapchain
+			break;
+	}
+	return hashBytes(reinterpret_cast<const uint8_t*>(inputs), sizeof(inputs));
+}
+
+void app::recordMeshState(VkCommandBuffer commandBuffer, size_t imageIndex) {
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &offset);
+	vkCmdBindIndexBuffer(commandBuffer, lodIndexBuffers[drawnLod], 0, VK_INDEX_TYPE_UINT32);
+	recordedLods[imageIndex] = drawnLod; // can't be evicted while this is around
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[imageIndex], 0, nullptr);
+	recordViewportState(commandBuffer);
+}
+
+void app::recordViewportState(VkCommandBuffer commandBuffer) {
+	// dynamic in every pipeline variant - (0,0) to (width,height), the whole framebuffer
+	VkViewport viewport{};
+	viewport.x = 0.0f;	viewport.width  = (float) swapchainExtent.width;
+	viewport.y = 0.0f;	viewport.height = (float) swapchainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	VkRect2D scissor{};
+	scissor.offset = {0, 0};
+	scissor.extent = swapchainExtent;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+void app::recordChunk(commandChunk chunk, size_t imageIndex) {
+	PROFILE_ZONE("recordChunk");
+	VkCommandBuffer commandBuffer = chunkBuffers[imageIndex * commandChunkCount + chunk];
+	const bool inRenderPass = chunk == depthPrepassChunk || chunk == opaqueChunk || chunk == lateDepthPrepassChunk || chunk == lateOpaqueChunk ||
+		chunk == particleDrawChunk;
+
+	// chunks inside a render pass continue it, all within the pipeline statistics query of the primary. The early and late
+	// render passes only differ from renderPass in load and store ops and layouts - not in their subpass dependencies, see
+	// buildRenderPass - so they're compatible with it
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.pNext = nullptr;
+	if (inRenderPass) {
+		inheritanceInfo.renderPass = renderPass;
+		inheritanceInfo.subpass = depthPrepass && chunk != depthPrepassChunk && chunk != lateDepthPrepassChunk ? 1 : 0;
+		inheritanceInfo.framebuffer = swapchainFramebuffers[imageIndex];
+	}
+	if (statisticsQueryPool != VK_NULL_HANDLE)
+		inheritanceInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = inRenderPass ? VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT : 0;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("Failed to begin recording a command chunk!");
+
+	switch (chunk) {
+		case particleSimulationChunk: // steps the particles of this frame in flight, see drawFrame
+			recordParticleSimulation(commandBuffer, static_cast<uint32_t>(currentFrame), particleParameters);
+			break;
+		case cullingChunk:
+			recordMeshletCulling(commandBuffer, imageIndex); // fills this image's indirect buffer for both subpasses, of the early render pass with Hi-Z
+			recordLightBinning(commandBuffer, imageIndex); // and its light lists, for the color subpass
+			break;
+		case depthPrepassChunk: // lay down depth for the whole frame first
+			recordMeshState(commandBuffer, imageIndex);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassPipeline);
+			recordMeshDraw(commandBuffer, imageIndex, false);
+			break;
+		case opaqueChunk:
+			recordMeshState(commandBuffer, imageIndex);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+			recordMeshDraw(commandBuffer, imageIndex, false); // the actual draw call
+			break;
+		case hiZChunk: // between the render passes, reads the depth the early one laid down
+			recordHiZCulling(commandBuffer, imageIndex);
+			break;
+		case lateDepthPrepassChunk: // only the meshlets the early pass missed, over its depth
+			recordMeshState(commandBuffer, imageIndex);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassPipeline);
+			recordMeshDraw(commandBuffer, imageIndex, true);
+			break;
+		case lateOpaqueChunk:
+			recordMeshState(commandBuffer, imageIndex);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+			recordMeshDraw(commandBuffer, imageIndex, true);
+			break;
+		case particleDrawChunk: // blended over the opaque geometry
+			recordViewportState(commandBuffer);
+			recordParticleDraw(commandBuffer, imageIndex);
+			break;
+		case postChunk: // from the HDR target into the swapchain image, writes the rest of the timestamps
+			recordPostProcessing(commandBuffer, imageIndex);
+			break;
+		default:
+			break;
+	}
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to record command chunk!");
+}
+
+bool app::updateCommandChunks(size_t imageIndex) {
+	// this image's last submission is done, so its chunks can be rerecorded
+	bool changed = false;
+	for (uint32_t i = 0; i < commandChunkCount; i++) {
+		const commandChunk chunk = static_cast<commandChunk>(i);
+		const uint64_t key = chunkUsed(chunk) ? chunkKey(chunk) : 0;
+		uint64_t& recordedKey = chunkKeys[imageIndex * commandChunkCount + i];
+		if (key == recordedKey) {
+			if (key != 0) {
+				chunksReusedAccumulator++;
+				recordingSavedAccumulator += chunkRecordTimes[i];
+			}
+			continue;
+		}
+		if (key != 0) { // otherwise it's just left out of the primary from now on
+			auto start = std::chrono::steady_clock::now();
+			recordChunk(chunk, imageIndex);
+			chunkRecordTimes[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			chunksRecordedAccumulator++;
+		}
+		recordedKey = key;
+		changed = true;
+	}
+	return changed;
+}
+
+void app::executeChunks(VkCommandBuffer commandBuffer, size_t imageIndex, std::initializer_list<commandChunk> chunks) {
+	VkCommandBuffer secondaries[commandChunkCount];
+	uint32_t count = 0;
+	for (commandChunk chunk : chunks)
+		if (chunkKeys[imageIndex * commandChunkCount + chunk] != 0)
+			secondaries[count++] = chunkBuffers[imageIndex * commandChunkCount + chunk];
+	if (count != 0)
+		vkCmdExecuteCommands(commandBuffer, count, secondaries);
+}
@@ -0,0 +1,287 @@
+#include "cpuCulling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define CULLING_SSE
+#endif
+
+namespace {
+
+// large but finite, so that an empty slot multiplied by a zero plane component stays 0 rather than NaN
+constexpr float emptyBound = 1e30f;
+
+constexpr aabb emptyBox() { return aabb{{emptyBound, emptyBound, emptyBound}, {-emptyBound, -emptyBound, -emptyBound}}; }
+
+void grow(aabb& box, const aabb& other) {
+	for (int c = 0; c < 3; c++) {
+		box.min[c] = std::min(box.min[c], other.min[c]);
+		box.max[c] = std::max(box.max[c], other.max[c]);
+	}
+}
+
+float surfaceArea(const aabb& box) {
+	float x = box.max[0] - box.min[0], y = box.max[1] - box.min[1], z = box.max[2] - box.min[2];
+	return x < 0.0f ? 0.0f : 2.0f * (x * y + y * z + z * x);
+}
+
+// clip space position of a point, column-major like the rest of the matrices
+inline void transformPoint(const matrix4& m, float x, float y, float z, float clip[4]) {
+	for (int row = 0; row < 4; row++)
+		clip[row] = m.m[row] * x + m.m[4 + row] * y + m.m[8 + row] * z + m.m[12 + row];
+}
+
+// points this close to the eye plane or behind it can't be projected
+constexpr float minimumW = 1e-5f;
+
+} // namespace
+
+aabb transformBounds(const aabb& box, const matrix4& transform) {
+	// transform the center, and take the extent along each axis from the absolute rotation/scale part (Arvo's method)
+	aabb result;
+	for (int row = 0; row < 3; row++) {
+		float center = transform.m[12 + row], extent = 0.0f;
+		for (int c = 0; c < 3; c++) {
+			center += transform.m[c * 4 + row] * (box.min[c] + box.max[c]) * 0.5f;
+			extent += std::abs(transform.m[c * 4 + row]) * (box.max[c] - box.min[c]) * 0.5f;
+		}
+		result.min[row] = center - extent;
+		result.max[row] = center + extent;
+	}
+	return result;
+}
+
+void boundingVolumeHierarchy::build(const aabb* boxes, uint32_t count) {
+	nodes.clear();
+	items.resize(count);
+	std::iota(items.begin(), items.end(), 0u);
+	std::vector<float> centroids(size_t(count) * 3); // doubled, only compared with each other
+	for (uint32_t i = 0; i < count; i++)
+		for (int c = 0; c < 3; c++)
+			centroids[i * 3 + c] = boxes[i].min[c] + boxes[i].max[c];
+
+	nodes.emplace_back();
+	buildNode(0, 0, count, boxes, centroids);
+	refit(boxes); // the build only sets up the topology, bounds are filled in bottom up
+	builtArea = currentArea;
+}
+
+void boundingVolumeHierarchy::buildNode(uint32_t nodeIndex, uint32_t first, uint32_t count, const aabb* boxes, const std::vector<float>& centroids) {
+	for (int slot = 0; slot < 4; slot++) {
+		nodes[nodeIndex].child[slot] = noChild;
+		nodes[nodeIndex].count[slot] = 0;
+		setSlot(nodeIndex, slot, emptyBox());
+	}
+
+	// split the largest range at the median of its widest centroid axis until there are four, or all of them fit a leaf
+	struct range { uint32_t first, count; };
+	range ranges[4] = {{first, count}};
+	int rangeCount = count > 0 ? 1 : 0;
+	while (rangeCount < 4) {
+		int largest = -1;
+		for (int r = 0; r < rangeCount; r++)
+			if (ranges[r].count > leafSize && (largest < 0 || ranges[r].count > ranges[largest].count)) largest = r;
+		if (largest < 0) break;
+
+		const range split = ranges[largest];
+		float low[3] = {emptyBound, emptyBound, emptyBound}, high[3] = {-emptyBound, -emptyBound, -emptyBound};
+		for (uint32_t i = split.first; i < split.first + split.count; i++)
+			for (int c = 0; c < 3; c++) {
+				low[c] = std::min(low[c], centroids[items[i] * 3 + c]);
+				high[c] = std::max(high[c], centroids[items[i] * 3 + c]);
+			}
+		int axis = 0;
+		for (int c = 1; c < 3; c++)
+			if (high[c] - low[c] > high[axis] - low[axis]) axis = c;
+
+		const uint32_t half = split.count / 2;
+		std::nth_element(items.begin() + split.first, items.begin() + split.first + half, items.begin() + split.first + split.count,
+			[&](uint32_t a, uint32_t b) { return centroids[a * 3 + axis] < centroids[b * 3 + axis]; });
+		ranges[largest] = {split.first, half};
+		ranges[rangeCount++] = {split.first + half, split.count - half};
+	}
+
+	for (int slot = 0; slot < rangeCount; slot++) {
+		if (ranges[slot].count <= leafSize) {
+			nodes[nodeIndex].child[slot] = ranges[slot].first;
+			nodes[nodeIndex].count[slot] = ranges[slot].count;
+		} else {
+			uint32_t childIndex = static_cast<uint32_t>(nodes.size());
+			nodes.emplace_back(); // may reallocate, nodes[nodeIndex] is looked up again below
+			nodes[nodeIndex].child[slot] = childIndex;
+			buildNode(childIndex, ranges[slot].first, ranges[slot].count, boxes, centroids);
+		}
+	}
+}
+
+void boundingVolumeHierarchy::setSlot(uint32_t nodeIndex, int slot, const aabb& box) {
+	node& n = nodes[nodeIndex];
+	n.minX[slot] = box.min[0]; n.minY[slot] = box.min[1]; n.minZ[slot] = box.min[2];
+	n.maxX[slot] = box.max[0]; n.maxY[slot] = box.max[1]; n.maxZ[slot] = box.max[2];
+}
+
+void boundingVolumeHierarchy::refit(const aabb* boxes) {
+	// children come after their parents, so walking backwards finishes every child before the node that holds it
+	currentArea = 0.0f;
+	for (size_t n = nodes.size(); n-- > 0;) {
+		for (int slot = 0; slot < 4; slot++) {
+			const uint32_t child = nodes[n].child[slot];
+			if (child == noChild) continue;
+			aabb box = emptyBox();
+			if (nodes[n].count[slot] > 0) {
+				for (uint32_t i = child; i < child + nodes[n].count[slot]; i++)
+					grow(box, boxes[items[i]]);
+			} else {
+				const node& c = nodes[child]; // empty slots hold an inverted box, which never grows anything
+				for (int s = 0; s < 4; s++)
+					grow(box, aabb{{c.minX[s], c.minY[s], c.minZ[s]}, {c.maxX[s], c.maxY[s], c.maxZ[s]}});
+			}
+			setSlot(static_cast<uint32_t>(n), slot, box);
+			currentArea += surfaceArea(box);
+		}
+	}
+}
+
+void boundingVolumeHierarchy::emitSubtree(uint32_t nodeIndex, std::vector<uint32_t>& visible) const {
+	const node& n = nodes[nodeIndex];
+	for (int slot = 0; slot < 4; slot++) {
+		if (n.child[slot] == noChild) continue;
+		if (n.count[slot] > 0) visible.insert(visible.end(), items.begin() + n.child[slot], items.begin() + n.child[slot] + n.count[slot]);
+		else emitSubtree(n.child[slot], visible);
+	}
+}
+
+void boundingVolumeHierarchy::cullFrustum(const float* planes, uint32_t planeCount, std::vector<uint32_t>& visible) const {
+	if (items.empty()) return;
+	uint32_t stack[256]; // depth is log4 of the item count, each level pushes at most 4
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const node& n = nodes[stack[--stackSize]];
+
+		// per plane, the corner furthest along the normal decides if a box is entirely outside, and the nearest corner
+		// whether it's entirely inside - in which case its whole subtree is visible without further tests
+		int outsideMask = 0, straddleMask = 0;
+#ifdef CULLING_SSE
+		const __m128 minX = _mm_load_ps(n.minX), minY = _mm_load_ps(n.minY), minZ = _mm_load_ps(n.minZ);
+		const __m128 maxX = _mm_load_ps(n.maxX), maxY = _mm_load_ps(n.maxY), maxZ = _mm_load_ps(n.maxZ);
+		const __m128 zero = _mm_setzero_ps();
+		__m128 outside = zero, straddle = zero;
+		for (uint32_t p = 0; p < planeCount; p++) {
+			const float* plane = planes + p * 4;
+			const __m128 nx = _mm_set1_ps(plane[0]), ny = _mm_set1_ps(plane[1]), nz = _mm_set1_ps(plane[2]), w = _mm_set1_ps(plane[3]);
+			__m128 farthest = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, plane[0] >= 0.0f ? maxX : minX), _mm_mul_ps(ny, plane[1] >= 0.0f ? maxY : minY)),
+				_mm_add_ps(_mm_mul_ps(nz, plane[2] >= 0.0f ? maxZ : minZ), w));
+			__m128 nearest = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, plane[0] >= 0.0f ? minX : maxX), _mm_mul_ps(ny, plane[1] >= 0.0f ? minY : maxY)),
+				_mm_add_ps(_mm_mul_ps(nz, plane[2] >= 0.0f ? minZ : maxZ), w));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(farthest, zero));
+			straddle = _mm_or_ps(straddle, _mm_cmplt_ps(nearest, zero));
+		}
+		outsideMask = _mm_movemask_ps(outside);
+		straddleMask = _mm_movemask_ps(straddle);
+#else
+		for (int slot = 0; slot < 4; slot++)
+			for (uint32_t p = 0; p < planeCount; p++) {
+				const float* plane = planes + p * 4;
+				float farthest = plane[0] * (plane[0] >= 0.0f ? n.maxX[slot] : n.minX[slot]) + plane[1] * (plane[1] >= 0.0f ? n.maxY[slot] : n.minY[slot])
+					+ plane[2] * (plane[2] >= 0.0f ? n.maxZ[slot] : n.minZ[slot]) + plane[3];
+				float nearest = plane[0] * (plane[0] >= 0.0f ? n.minX[slot] : n.maxX[slot]) + plane[1] * (plane[1] >= 0.0f ? n.minY[slot] : n.maxY[slot])
+					+ plane[2] * (plane[2] >= 0.0f ? n.minZ[slot] : n.maxZ[slot]) + plane[3];
+				if (farthest < 0.0f) outsideMask |= 1 << slot;
+				if (nearest < 0.0f) straddleMask |= 1 << slot;
+			}
+#endif
+
+		for (int slot = 0; slot < 4; slot++) {
+			if (n.child[slot] == noChild || (outsideMask & (1 << slot))) continue;
+			if (n.count[slot] > 0) // with one item per leaf, the slot test is the exact test for the item
+				visible.insert(visible.end(), items.begin() + n.child[slot], items.begin() + n.child[slot] + n.count[slot]);
+			else if (straddleMask & (1 << slot))
+				stack[stackSize++] = n.child[slot];
+			else
+				emitSubtree(n.child[slot], visible);
+		}
+	}
+}
+
+occlusionBuffer::occlusionBuffer(uint32_t width, uint32_t height) : width(width), height(height), depth(size_t(width) * height, 0.0f) {}
+
+void occlusionBuffer::begin(const matrix4& frameViewProjection) {
+	viewProjection = frameViewProjection;
+	std::fill(depth.begin(), depth.end(), 0.0f);
+}
+
+void occlusionBuffer::rasterize(const float* positions, size_t triangleCount, const matrix4& world) {
+	matrix4 transform;
+	multiplyMatrices(viewProjection, world, transform);
+	for (size_t t = 0; t < triangleCount; t++) {
+		float x[3], y[3], z[3];
+		bool projectable = true;
+		for (int v = 0; v < 3; v++) {
+			const float* p = positions + (t * 3 + v) * 3;
+			float clip[4];
+			transformPoint(transform, p[0], p[1], p[2], clip);
+			if (clip[3] < minimumW) { projectable = false; break; }
+			x[v] = (clip[0] / clip[3] * 0.5f + 0.5f) * width;
+			y[v] = (clip[1] / clip[3] * 0.5f + 0.5f) * height;
+			z[v] = clip[2] / clip[3];
+		}
+		if (!projectable) continue; // no clipping - dropping an occluder is always safe
+
+		// edge functions, sampled at pixel centers - either winding is an occluder
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if (area == 0.0f) continue;
+		const float orientation = area > 0.0f ? 1.0f : -1.0f;
+		int x0 = std::max(0, static_cast<int>(std::ceil(std::min({x[0], x[1], x[2]}) - 0.5f)));
+		int x1 = std::min(static_cast<int>(width) - 1, static_cast<int>(std::floor(std::max({x[0], x[1], x[2]}) - 0.5f)));
+		int y0 = std::max(0, static_cast<int>(std::ceil(std::min({y[0], y[1], y[2]}) - 0.5f)));
+		int y1 = std::min(static_cast<int>(height) - 1, static_cast<int>(std::floor(std::max({y[0], y[1], y[2]}) - 0.5f)));
+		const float flatDepth = std::min({z[0], z[1], z[2]}); // farthest vertex, with reversed-Z
+
+		for (int py = y0; py <= y1; py++) {
+			float* row = &depth[size_t(py) * width];
+			const float sy = py + 0.5f;
+			for (int px = x0; px <= x1; px++) {
+				const float sx = px + 0.5f;
+				bool inside = true;
+				for (int e = 0; e < 3 && inside; e++) {
+					const int a = e, b = (e + 1) % 3;
+					inside = orientation * ((x[b] - x[a]) * (sy - y[a]) - (y[b] - y[a]) * (sx - x[a])) >= 0.0f;
+				}
+				if (inside) row[px] = std::max(row[px], flatDepth);
+			}
+		}
+	}
+}
+
+bool occlusionBuffer::isVisible(const aabb& box) const {
+	float low[2] = {emptyBound, emptyBound}, high[2] = {-emptyBound, -emptyBound}, nearest = 0.0f;
+	for (int corner = 0; corner < 8; corner++) {
+		float clip[4];
+		transformPoint(viewProjection, corner & 1 ? box.max[0] : box.min[0], corner & 2 ? box.max[1] : box.min[1], corner & 4 ? box.max[2] : box.min[2], clip);
+		if (clip[3] < minimumW) return true; // reaches the eye plane, can't be behind anything
+		const float sx = (clip[0] / clip[3] * 0.5f + 0.5f) * width, sy = (clip[1] / clip[3] * 0.5f + 0.5f) * height;
+		low[0] = std::min(low[0], sx); high[0] = std::max(high[0], sx);
+		low[1] = std::min(low[1], sy); high[1] = std::max(high[1], sy);
+		nearest = std::max(nearest, clip[2] / clip[3]);
+	}
+	const int x0 = std::max(0, static_cast<int>(std::floor(low[0]))), x1 = std::min(static_cast<int>(width) - 1, static_cast<int>(std::floor(high[0])));
+	const int y0 = std::max(0, static_cast<int>(std::floor(low[1]))), y1 = std::min(static_cast<int>(height) - 1, static_cast<int>(std::floor(high[1])));
+	if (x0 > x1 || y0 > y1) return true; // off screen, that's for the frustum test to decide
+
+	// hidden only if every pixel it touches has an occluder in front of its nearest point
+	for (int py = y0; py <= y1; py++) {
+		const float* row = &depth[size_t(py) * width];
+		int px = x0;
+#ifdef CULLING_SSE
+		const __m128 boxDepth = _mm_set1_ps(nearest);
+		for (; px + 3 <= x1; px += 4)
+			if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + px), boxDepth)) != 0) return true;
+#endif
+		for (; px <= x1; px++)
+			if (row[px] <= nearest) return true;
+	}
+	return false;
+}
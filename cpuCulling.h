@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "scene.h"
+
+// axis aligned box in world space
+struct aabb {
+	float min[3];
+	float max[3];
+};
+
+// bounds of box after transform - the box around the transformed box, not the tightest fit of the contents
+aabb transformBounds(const aabb& box, const matrix4& transform);
+
+// four wide bounding volume hierarchy over a set of boxes, for culling on the CPU. Each node holds the bounds of its four
+// children as structure of arrays, so a frustum plane is tested against all four at once with SSE. Built top down by
+// median splits, and refit in place when the boxes move - refitting is linear but lets the tree quality decay, so
+// quality() tracks how far the summed node area has grown since the last build, for the caller to decide on a rebuild
+class boundingVolumeHierarchy {
+public:
+	static constexpr uint32_t leafSize = 1; // one item per leaf, so testing a node's slots is also the exact test for each item
+
+	void build(const aabb* boxes, uint32_t count);
+	void refit(const aabb* boxes); // boxes has to have the same count as the last build
+	float quality() const { return builtArea > 0.0f ? currentArea / builtArea : 1.0f; } // 1.0 right after a build
+	uint32_t size() const { return static_cast<uint32_t>(items.size()); }
+
+	// appends the index of every box not entirely outside one of the planes - planes are xyzw, with xyz the inward
+	// normal, so a point is inside when dot(xyz, p) + w >= 0
+	void cullFrustum(const float* planes, uint32_t planeCount, std::vector<uint32_t>& visible) const;
+
+private:
+	static constexpr uint32_t noChild = ~0u;
+	struct alignas(16) node {
+		float minX[4], minY[4], minZ[4];
+		float maxX[4], maxY[4], maxZ[4];
+		uint32_t child[4]; // node index for inner children, first item for leaves, noChild for an empty slot
+		uint32_t count[4]; // items in a leaf, 0 for inner children
+	};
+
+	void buildNode(uint32_t nodeIndex, uint32_t first, uint32_t count, const aabb* boxes, const std::vector<float>& centroids);
+	void setSlot(uint32_t nodeIndex, int slot, const aabb& box);
+	void emitSubtree(uint32_t nodeIndex, std::vector<uint32_t>& visible) const;
+
+	std::vector<node> nodes; // children always come after their parent
+	std::vector<uint32_t> items; // box indices, grouped by leaf
+	float builtArea = 0.0f, currentArea = 0.0f; // summed surface area of every slot
+};
+
+// small software depth buffer for occlusion culling - a handful of nearby occluders are rasterized with the same
+// reversed-Z projection as the frame, then boxes are tested against it by their nearest depth over their screen rect.
+// Occluders are drawn at the flat depth of their farthest vertex, which keeps the test conservative for the occluder
+// geometry itself
+class occlusionBuffer {
+public:
+	occlusionBuffer(uint32_t width, uint32_t height);
+
+	void begin(const matrix4& viewProjection); // clears the buffer
+	// triangleCount triangles, 3 xyz positions each, placed by world
+	void rasterize(const float* positions, size_t triangleCount, const matrix4& world);
+	bool isVisible(const aabb& box) const;
+
+private:
+	uint32_t width, height;
+	std::vector<float> depth; // nearest occluder per pixel, 0.0 is the far plane
+	matrix4 viewProjection;
+};
@@ -0,0 +1,41 @@
+#include "deletionQueue.h"
+
+void deletionQueue::push(VkObjectType type, uint64_t handle, const VkAllocationCallbacks* allocator, uint64_t owner) {
+	if (handle == 0) return; // optional objects that were never created
+	queue.push_back(retiredObject{latestSubmission, type, handle, owner, allocator});
+}
+
+void deletionQueue::collect(uint64_t completedSubmission) {
+	while (!queue.empty() && queue.front().submission <= completedSubmission) {
+		destroyObject(queue.front());
+		queue.pop_front();
+	}
+}
+
+void deletionQueue::flush() {
+	for (const retiredObject& object : queue)
+		destroyObject(object);
+	queue.clear();
+}
+
+void deletionQueue::destroyObject(const retiredObject& object) {
+	switch (object.type) {
+		case VK_OBJECT_TYPE_BUFFER: vkDestroyBuffer(device, reinterpret_cast<VkBuffer>(object.handle), object.allocator); break;
+		case VK_OBJECT_TYPE_IMAGE: vkDestroyImage(device, reinterpret_cast<VkImage>(object.handle), object.allocator); break;
+		case VK_OBJECT_TYPE_IMAGE_VIEW: vkDestroyImageView(device, reinterpret_cast<VkImageView>(object.handle), object.allocator); break;
+		case VK_OBJECT_TYPE_DEVICE_MEMORY: vkFreeMemory(device, reinterpret_cast<VkDeviceMemory>(object.handle), object.allocator); break;
+		case VK_OBJECT_TYPE_PIPELINE: vkDestroyPipeline(device, reinterpret_cast<VkPipeline>(object.handle), object.allocator); break;
+		case VK_OBJECT_TYPE_PIPELINE_LAYOUT: vkDestroyPipelineLayout(device, reinterpret_cast<VkPipelineLayout>(object.handle), object.allocator); break;
+		case VK_OBJECT_TYPE_RENDER_PASS: vkDestroyRenderPass(device, reinterpret_cast<VkRenderPass>(object.handle), object.allocator); break;
+		case VK_OBJECT_TYPE_FRAMEBUFFER: vkDestroyFramebuffer(device, reinterpret_cast<VkFramebuffer>(object.handle), object.allocator); break;
+		case VK_OBJECT_TYPE_DESCRIPTOR_POOL: vkDestroyDescriptorPool(device, reinterpret_cast<VkDescriptorPool>(object.handle), object.allocator); break;
+		case VK_OBJECT_TYPE_QUERY_POOL: vkDestroyQueryPool(device, reinterpret_cast<VkQueryPool>(object.handle), object.allocator); break;
+		case VK_OBJECT_TYPE_SWAPCHAIN_KHR: vkDestroySwapchainKHR(device, reinterpret_cast<VkSwapchainKHR>(object.handle), object.allocator); break;
+		case VK_OBJECT_TYPE_COMMAND_BUFFER: {
+			VkCommandBuffer commandBuffer = reinterpret_cast<VkCommandBuffer>(object.handle);
+			vkFreeCommandBuffers(device, reinterpret_cast<VkCommandPool>(object.owner), 1, &commandBuffer);
+			break;
+		}
+		default: break;
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vulkan/vulkan.h>
+
+// deferred destruction of Vulkan objects that submitted work may still be using. Objects are stamped with the value of
+// the latest queue submission when they are handed over, and destroyed once the GPU is known to have completed that
+// submission - the app counts submissions, and learns how far the GPU has got from the fence it waits on each frame.
+// Destroys run in the order the objects were handed over, each with the allocation callbacks it was created with. The
+// overloads rely on non-dispatchable handles being distinct types, which holds on 64-bit platforms
+class deletionQueue {
+public:
+	void init(VkDevice device) { this->device = device; }
+
+	void destroy(VkBuffer buffer, const VkAllocationCallbacks* allocator) { push(VK_OBJECT_TYPE_BUFFER, reinterpret_cast<uint64_t>(buffer), allocator); }
+	void destroy(VkImage image, const VkAllocationCallbacks* allocator) { push(VK_OBJECT_TYPE_IMAGE, reinterpret_cast<uint64_t>(image), allocator); }
+	void destroy(VkImageView view, const VkAllocationCallbacks* allocator) { push(VK_OBJECT_TYPE_IMAGE_VIEW, reinterpret_cast<uint64_t>(view), allocator); }
+	void destroy(VkDeviceMemory memory, const VkAllocationCallbacks* allocator) { push(VK_OBJECT_TYPE_DEVICE_MEMORY, reinterpret_cast<uint64_t>(memory), allocator); } // implicitly unmapped
+	void destroy(VkPipeline pipeline, const VkAllocationCallbacks* allocator) { push(VK_OBJECT_TYPE_PIPELINE, reinterpret_cast<uint64_t>(pipeline), allocator); }
+	void destroy(VkPipelineLayout layout, const VkAllocationCallbacks* allocator) { push(VK_OBJECT_TYPE_PIPELINE_LAYOUT, reinterpret_cast<uint64_t>(layout), allocator); }
+	void destroy(VkRenderPass renderPass, const VkAllocationCallbacks* allocator) { push(VK_OBJECT_TYPE_RENDER_PASS, reinterpret_cast<uint64_t>(renderPass), allocator); }
+	void destroy(VkFramebuffer framebuffer, const VkAllocationCallbacks* allocator) { push(VK_OBJECT_TYPE_FRAMEBUFFER, reinterpret_cast<uint64_t>(framebuffer), allocator); }
+	void destroy(VkDescriptorPool pool, const VkAllocationCallbacks* allocator) { push(VK_OBJECT_TYPE_DESCRIPTOR_POOL, reinterpret_cast<uint64_t>(pool), allocator); } // with its sets
+	void destroy(VkQueryPool pool, const VkAllocationCallbacks* allocator) { push(VK_OBJECT_TYPE_QUERY_POOL, reinterpret_cast<uint64_t>(pool), allocator); }
+	void destroy(VkSwapchainKHR swapchain, const VkAllocationCallbacks* allocator) { push(VK_OBJECT_TYPE_SWAPCHAIN_KHR, reinterpret_cast<uint64_t>(swapchain), allocator); }
+	void free(VkCommandPool pool, VkCommandBuffer commandBuffer) {
+		push(VK_OBJECT_TYPE_COMMAND_BUFFER, reinterpret_cast<uint64_t>(commandBuffer), nullptr, reinterpret_cast<uint64_t>(pool));
+	}
+
+	void submitted(uint64_t submission) { latestSubmission = submission; } // called after each queue submission
+	void collect(uint64_t completedSubmission); // destroys everything stamped with completedSubmission or earlier
+	void flush(); // destroys everything - only once the device is idle
+	size_t pending() const { return queue.size(); }
+
+private:
+	struct retiredObject {
+		uint64_t submission;
+		VkObjectType type;
+		uint64_t handle;
+		uint64_t owner; // command pool, for command buffers
+		const VkAllocationCallbacks* allocator; // the ones the object was created with
+	};
+
+	void push(VkObjectType type, uint64_t handle, const VkAllocationCallbacks* allocator, uint64_t owner = 0);
+	void destroyObject(const retiredObject& object);
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::deque<retiredObject> queue; // stamps never decrease, so the oldest are always at the front
+	uint64_t latestSubmission = 0;
+};
@@ -0,0 +1,253 @@
+#include "app.h"
+
+// ╦ ╦┬   ╔═╗  ╔═╗┬ ┬┬  ┬  ┬┌┐┌┌─┐
+// ╠═╣│───╔═╝  ║  │ ││  │  │││││ ┬
+// ╩ ╩┴   ╚═╝  ╚═╝└─┘┴─┘┴─┘┴┘└┘└─┘
+// the depth pyramid and the late culling pass between the two render passes, see shaders/hiZ.comp and shaders/cull.comp
+
+static uint32_t previousPowerOfTwo(uint32_t value) {
+	uint32_t result = 1;
+	while (result * 2 <= value) result *= 2;
+	return result;
+}
+
+void app::createHiZPipeline() {
+	if (!hiZSupported) return;
+
+	// texels are fetched, never filtered
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.pNext = nullptr;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	if (vkCreateSampler(device, &samplerInfo, host.callbacks(), &hiZSampler) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create Hi-Z sampler!");
+
+	// the depth buffer, every level of the pyramid, and the counter of workgroups done
+	VkDescriptorSetLayoutBinding bindings[3]{};
+	const VkDescriptorType types[3] = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER};
+	for (uint32_t i = 0; i < 3; i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = types[i];
+		bindings[i].descriptorCount = i == 1 ? maxPyramidLevels : 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = nullptr;
+	layoutInfo.bindingCount = 3;
+	layoutInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, host.callbacks(), &hiZDescriptorSetLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create Hi-Z descriptor set layout!");
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(hiZPushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &hiZDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, host.callbacks(), &hiZPipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create Hi-Z pipeline layout!");
+
+	// the multisampled variant reads every sample of the depth buffer, there's one for each kind of source
+	const char* shaderFiles[2] = {"shaders/hiZ.spv", "shaders/hiZMultisampled.spv"};
+	VkShaderModule shaderModules[2];
+	VkComputePipelineCreateInfo pipelineInfos[2]{};
+	for (uint32_t i = 0; i < 2; i++) {
+		shaderModules[i] = createShaderModule(readFile(shaderFiles[i]));
+		pipelineInfos[i].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfos[i].pNext = nullptr;
+		pipelineInfos[i].stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfos[i].stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfos[i].stage.module = shaderModules[i];
+		pipelineInfos[i].stage.pName = "main";
+		pipelineInfos[i].layout = hiZPipelineLayout;
+	}
+	VkPipeline computePipelines[2];
+	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 2, pipelineInfos, host.callbacks(), computePipelines) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create Hi-Z pipelines!");
+	hiZPipeline = computePipelines[0];
+	hiZMultisampledPipeline = computePipelines[1];
+	for (VkShaderModule shaderModule : shaderModules)
+		vkDestroyShaderModule(device, shaderModule, host.callbacks());
+
+	// starts at zero, and the last workgroup of each build leaves it at zero again
+	const uint32_t finishedGroups = 0;
+	uploadBuffer(&finishedGroups, sizeof(finishedGroups), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hiZCounterBuffer, hiZCounterBufferMemory);
+}
+
+void app::createHiZResources() {
+	if (!hiZActive) return;
+
+	// level 0 is the largest power of two that fits, so every level halves exactly - one texel covers up to 2x2 pixels
+	pyramidExtent = {previousPowerOfTwo(swapchainExtent.width), previousPowerOfTwo(swapchainExtent.height)};
+	pyramidLevels = 1;
+	while ((std::max(pyramidExtent.width, pyramidExtent.height) >> pyramidLevels) != 0 && pyramidLevels < maxPyramidLevels)
+		pyramidLevels++;
+	pyramidSourceSamples = static_cast<uint32_t>(msaaSamples);
+	createImage(pyramidExtent.width, pyramidExtent.height, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pyramidImage, pyramidImageMemory, pyramidLevels);
+	pyramidView = createImageView(pyramidImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramidLevels);
+	for (uint32_t level = 0; level < pyramidLevels; level++)
+		pyramidLevelViews[level] = createImageView(pyramidImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, level, 1);
+
+	// a single set, the pyramid is shared by every swapchain image like the depth buffer it's built from
+	VkDescriptorPoolSize poolSizes[3]{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = 1;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = maxPyramidLevels;
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[2].descriptorCount = 1;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+	poolInfo.poolSizeCount = 3;
+	poolInfo.pPoolSizes = poolSizes;
+	poolInfo.maxSets = 1;
+	if (vkCreateDescriptorPool(device, &poolInfo, host.swapchainCallbacks(), &hiZDescriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create Hi-Z descriptor pool!");
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = hiZDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &hiZDescriptorSetLayout;
+	if (vkAllocateDescriptorSets(device, &allocInfo, &hiZDescriptorSet) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate Hi-Z descriptor set!");
+
+	// the array always has every element written - past the last level, it repeats it
+	const VkDescriptorImageInfo depthInfo{hiZSampler, depthImageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL};
+	VkDescriptorImageInfo levelInfos[maxPyramidLevels];
+	for (uint32_t level = 0; level < maxPyramidLevels; level++)
+		levelInfos[level] = {VK_NULL_HANDLE, pyramidLevelViews[std::min(level, pyramidLevels - 1)], VK_IMAGE_LAYOUT_GENERAL};
+	const VkDescriptorBufferInfo counterInfo{hiZCounterBuffer, 0, VK_WHOLE_SIZE};
+
+	VkWriteDescriptorSet descriptorWrites[3]{};
+	for (uint32_t b = 0; b < 3; b++) {
+		descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[b].dstSet = hiZDescriptorSet;
+		descriptorWrites[b].dstBinding = b;
+		descriptorWrites[b].dstArrayElement = 0;
+		descriptorWrites[b].descriptorCount = 1;
+	}
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrites[0].pImageInfo = &depthInfo;
+	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	descriptorWrites[1].descriptorCount = maxPyramidLevels;
+	descriptorWrites[1].pImageInfo = levelInfos;
+	descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrites[2].pBufferInfo = &counterInfo;
+	vkUpdateDescriptorSets(device, 3, descriptorWrites, 0, nullptr);
+}
+
+void app::cleanupHiZResources() {
+	if (pyramidImage == VK_NULL_HANDLE) return; // Hi-Z culling was off for this swapchain
+	const VkAllocationCallbacks* allocator = host.swapchainCallbacks();
+	for (uint32_t level = 0; level < pyramidLevels; level++)
+		deletions.destroy(pyramidLevelViews[level], allocator);
+	deletions.destroy(pyramidView, allocator);
+	deletions.destroy(pyramidImage, allocator);
+	deletions.destroy(pyramidImageMemory, allocator);
+	deletions.destroy(hiZDescriptorPool, allocator); // frees the descriptor set too
+	pyramidImage = VK_NULL_HANDLE;
+}
+
+void app::recordHiZCulling(VkCommandBuffer commandBuffer, size_t imageIndex) {
+	// the render passes leave synchronizing with each other to this, so their dependencies stay those of renderPass - see
+	// buildRenderPass. Depth goes read only once the early pass is done writing it, including its store
+	const VkImageAspectFlags depthAspects = depthFormat == VK_FORMAT_D32_SFLOAT ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	VkImageMemoryBarrier depthBarrier{};
+	depthBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	depthBarrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depthBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	depthBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	depthBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	depthBarrier.image = depthImage;
+	depthBarrier.subresourceRange = {depthAspects, 0, 1, 0, 1};
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+
+	// nothing in the pyramid is kept from the previous frame, but its late culling pass has to be done reading it - and
+	// the early culling pass has to be done with the statistics the late one adds to
+	VkImageMemoryBarrier pyramidBarrier{};
+	pyramidBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	pyramidBarrier.srcAccessMask = 0;
+	pyramidBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	pyramidBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	pyramidBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	pyramidBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	pyramidBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	pyramidBarrier.image = pyramidImage;
+	pyramidBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramidLevels, 0, 1};
+	VkMemoryBarrier cullBarrier{};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &cullBarrier, 0, nullptr, 1, &pyramidBarrier);
+
+	// 16x16 invocations per workgroup, each reducing 2x2 texels of level 0
+	hiZPushConstants hiZParameters{pyramidLevels, pyramidSourceSamples};
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramidSourceSamples > 1 ? hiZMultisampledPipeline : hiZPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZPipelineLayout, 0, 1, &hiZDescriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, hiZPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(hiZParameters), &hiZParameters);
+	vkCmdDispatch(commandBuffer, (pyramidExtent.width + 31) / 32, (pyramidExtent.height + 31) / 32, 1);
+
+	VkMemoryBarrier pyramidDone{};
+	pyramidDone.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	pyramidDone.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	pyramidDone.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &pyramidDone, 0, nullptr, 0, nullptr);
+
+	// the late phase, with the same sets, parameters and dispatch as the early one
+	cullPushConstants pushConstants = cullParameters();
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullLatePipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptorSets[imageIndex], 0, nullptr);
+	vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+	dispatchMeshletCulling(commandBuffer);
+
+	// the late render pass draws what it appended, and the host reads the statistics
+	VkMemoryBarrier lateBarrier{};
+	lateBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	lateBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	lateBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &lateBarrier, 0, nullptr, 0, nullptr);
+
+	// and loads the early pass' color and depth - depth back in the attachment layout, once the pyramid is done reading it
+	VkMemoryBarrier colorBarrier{};
+	colorBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	colorBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	colorBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 1, &colorBarrier, 0, nullptr, 0, nullptr);
+	depthBarrier.srcAccessMask = 0;
+	depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+}
+
+void app::toggleHiZCulling() {
+	if (!hiZSupported) {
+		cout << "Hi-Z culling needs meshlet culling, storage image array indexing and a depth format that can be sampled, which this device does not support" << endl;
+		return;
+	}
+	hiZCulling = !hiZCulling;
+	if (hiZCulling && !(hiZSampleCounts & msaaSamples))
+		cout << "This device can't sample " << msaaSamples << "x depth, Hi-Z culling stays off until the sample count changes" << endl;
+	framebufferResized = true; // the depth and color targets are kept between two render passes, and depth is sampled
+}
@@ -0,0 +1,218 @@
+#include "hostAllocator.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+static const char* scopeNames[] = {"command", "object", "cache", "device", "instance"};
+
+hostAllocator::hostAllocator() {
+	initContext(heap, nullptr);
+	generationArenas.emplace_back();
+	generations.emplace_back();
+	initContext(generations.back(), &generationArenas.back());
+}
+
+hostAllocator::~hostAllocator() {
+	auto release = [](arena& target) {
+		for (arena::block& block : target.blocks) std::free(block.memory);
+		for (arena::block& block : target.large) std::free(block.memory);
+	};
+	release(scratch);
+	for (arena& generation : generationArenas)
+		release(generation);
+}
+
+void hostAllocator::initContext(context& target, arena* source) {
+	target.owner = this;
+	target.target = source;
+	target.callbacks.pUserData = &target;
+	target.callbacks.pfnAllocation = allocateCallback;
+	target.callbacks.pfnReallocation = reallocateCallback;
+	target.callbacks.pfnFree = freeCallback;
+	target.callbacks.pfnInternalAllocation = internalAllocationCallback;
+	target.callbacks.pfnInternalFree = internalFreeCallback;
+}
+
+void hostAllocator::retireSwapchain() {
+	std::lock_guard<std::mutex> lock(mutex);
+	generationArenas[current].retired = true;
+
+	// a generation that has already been reset, or a new one
+	for (size_t i = 0; i < generations.size(); i++)
+		if (!generationArenas[i].retired) {
+			current = i;
+			return;
+		}
+	generationArenas.emplace_back();
+	generations.emplace_back();
+	initContext(generations.back(), &generationArenas.back());
+	current = generations.size() - 1;
+}
+
+void hostAllocator::beginFrame() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (scratch.live == 0) // command scope allocations can't outlive their command, so this only fails on a driver bug
+		resetArena(scratch);
+	for (arena& generation : generationArenas)
+		if (generation.retired && generation.live == 0) {
+			resetArena(generation);
+			generation.retired = false;
+		}
+}
+
+void hostAllocator::resetArena(arena& target) {
+	for (arena::block& block : target.large)
+		std::free(block.memory);
+	target.large.clear();
+	target.currentBlock = 0;
+	target.cursor = 0;
+}
+
+char* hostAllocator::arenaReserve(arena& source, size_t bytes, uint32_t& block) {
+	if (bytes > blockSize) {
+		source.large.push_back({static_cast<char*>(std::malloc(bytes)), bytes});
+		block = largeBlock;
+		return source.large.back().memory;
+	}
+	if (source.blocks.empty() || source.cursor + bytes > blockSize) { // on to the next block
+		if (!source.blocks.empty()) source.currentBlock++;
+		if (source.currentBlock == source.blocks.size())
+			source.blocks.push_back({static_cast<char*>(std::malloc(blockSize)), blockSize});
+		source.cursor = 0;
+	}
+	block = static_cast<uint32_t>(source.currentBlock);
+	char* start = source.blocks[source.currentBlock].memory + source.cursor;
+	source.cursor += bytes;
+	return start;
+}
+
+void hostAllocator::track(uint32_t scope, int64_t bytes) {
+	hostAllocationStats& stats = scopes[std::min(scope, 4u)];
+	if (bytes > 0) {
+		stats.count++;
+		totalBytes += bytes;
+	}
+	stats.bytes += bytes;
+	stats.peak = std::max(stats.peak, stats.bytes);
+}
+
+void* hostAllocator::allocate(arena* source, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+	if (size == 0) return nullptr;
+	alignment = std::max<size_t>(alignment, 16); // keeps the header in front aligned too
+	const size_t reserved = sizeof(header) + alignment - 1 + size;
+	if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) source = &scratch; // whichever callbacks it came through
+
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t block = largeBlock;
+	char* start = source ? arenaReserve(*source, reserved, block) : static_cast<char*>(std::malloc(reserved));
+	if (!start) return nullptr;
+
+	char* memory = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(start) + sizeof(header) + alignment - 1) & ~uintptr_t(alignment - 1));
+	header* info = reinterpret_cast<header*>(memory) - 1;
+	info->start = start;
+	info->end = start + reserved;
+	info->source = source;
+	info->size = size;
+	info->block = block;
+	info->scope = scope;
+	if (source) source->live++;
+	track(scope, static_cast<int64_t>(size));
+	if (tracing)
+		std::cerr << "host allocation: " << size << " bytes, " << scopeNames[std::min<uint32_t>(scope, 4)] << " scope"
+			<< (source == &scratch ? ", scratch arena" : source ? ", swapchain arena" : "") << std::endl;
+	return memory;
+}
+
+void hostAllocator::free(void* memory) {
+	if (!memory) return;
+	header* info = reinterpret_cast<header*>(memory) - 1;
+	std::lock_guard<std::mutex> lock(mutex);
+	track(info->scope, -static_cast<int64_t>(info->size));
+	arena* source = info->source;
+	if (!source) {
+		std::free(info->start);
+		return;
+	}
+	source->live--;
+	// the latest allocation of the arena gives its space back - the rest waits for the reset
+	if (info->block == source->currentBlock && info->end == source->blocks[info->block].memory + source->cursor)
+		source->cursor = info->start - source->blocks[info->block].memory;
+}
+
+void* VKAPI_CALL hostAllocator::allocateCallback(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+	context* target = static_cast<context*>(userData);
+	return target->owner->allocate(target->target, size, alignment, scope);
+}
+
+void* VKAPI_CALL hostAllocator::reallocateCallback(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+	context* target = static_cast<context*>(userData);
+	if (!original) return target->owner->allocate(target->target, size, alignment, scope);
+	if (size == 0) {
+		target->owner->free(original);
+		return nullptr;
+	}
+	// always moves - the old contents are copied over and the original freed, as the spec requires on success
+	void* memory = target->owner->allocate(target->target, size, alignment, scope);
+	if (!memory) return nullptr; // the original is left untouched
+	memcpy(memory, original, std::min(size, (reinterpret_cast<header*>(original) - 1)->size));
+	target->owner->free(original);
+	return memory;
+}
+
+void VKAPI_CALL hostAllocator::freeCallback(void* userData, void* memory) {
+	static_cast<context*>(userData)->owner->free(memory);
+}
+
+void VKAPI_CALL hostAllocator::internalAllocationCallback(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+	hostAllocator* owner = static_cast<context*>(userData)->owner;
+	std::lock_guard<std::mutex> lock(owner->mutex);
+	owner->track(scope, static_cast<int64_t>(size));
+}
+
+void VKAPI_CALL hostAllocator::internalFreeCallback(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+	hostAllocator* owner = static_cast<context*>(userData)->owner;
+	std::lock_guard<std::mutex> lock(owner->mutex);
+	owner->track(scope, -static_cast<int64_t>(size));
+}
+
+hostAllocationStats hostAllocator::stats(VkSystemAllocationScope scope) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return scopes[std::min<uint32_t>(scope, 4)];
+}
+
+uint64_t hostAllocator::allocationCount() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	uint64_t count = 0;
+	for (const hostAllocationStats& stats : scopes)
+		count += stats.count;
+	return count;
+}
+
+uint64_t hostAllocator::allocationBytes() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return totalBytes;
+}
+
+size_t hostAllocator::arenaCapacity() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t bytes = 0;
+	auto add = [&](const arena& source) {
+		for (const arena::block& block : source.blocks) bytes += block.size;
+		for (const arena::block& block : source.large) bytes += block.size;
+	};
+	add(scratch);
+	for (const arena& generation : generationArenas)
+		add(generation);
+	return bytes;
+}
+
+void hostAllocator::report() const {
+	const size_t capacity = arenaCapacity();
+	std::lock_guard<std::mutex> lock(mutex);
+	std::cout << "Host allocations by scope:" << std::endl;
+	for (uint32_t scope = 0; scope < 5; scope++)
+		std::cout << "  " << scopeNames[scope] << ": " << scopes[scope].count << " allocations, " << scopes[scope].bytes / 1024.0
+			<< " KB live, " << scopes[scope].peak / 1024.0 << " KB peak" << std::endl;
+	std::cout << "  " << generations.size() << " swapchain generation arenas, " << capacity / 1024.0 << " KB held in arena blocks" << std::endl;
+}
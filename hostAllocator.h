@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// allocations made through one scope of the allocator - count is every allocation ever made, bytes is what is live now
+struct hostAllocationStats {
+	uint64_t count = 0;
+	uint64_t bytes = 0;
+	uint64_t peak = 0;
+};
+
+// host memory for the driver, through VkAllocationCallbacks. There are three places allocations can end up:
+// - the heap, for objects that live as long as the instance or device - these come and go one at a time (staging
+//   buffers, pipelines compiled at runtime), so they are freed individually
+// - the arena of the current swapchain generation, for everything created along with the swapchain. The arena is
+//   retired when the swapchain is torn down, and reset wholesale once everything in it has been freed - with deferred
+//   destruction that happens some frames later
+// - the per-frame scratch arena, for any allocation with command scope, which the driver has to free before the command
+//   returns. It's rewound at the start of every frame
+// Arenas are bump allocators over fixed size blocks that are kept across resets. Freeing the most recent allocation of
+// an arena rewinds it, so short lived allocate/free pairs don't make it grow. Every allocation has a small header in
+// front of it, recording where it came from, since pfnFree isn't told the scope. Stats are kept per
+// VkSystemAllocationScope, including the driver's internal allocation notifications
+class hostAllocator {
+public:
+	hostAllocator();
+	~hostAllocator();
+	hostAllocator(const hostAllocator&) = delete; // the callbacks point back into the allocator
+	hostAllocator& operator=(const hostAllocator&) = delete;
+
+	const VkAllocationCallbacks* callbacks() const { return &heap.callbacks; } // instance and device lifetime objects
+	const VkAllocationCallbacks* swapchainCallbacks() const { return &generations[current].callbacks; }
+
+	void retireSwapchain(); // the current swapchain generation is being destroyed, objects created from now on go to a new one
+	void beginFrame(); // rewinds the scratch arena, and resets retired generations with nothing left in them
+
+	// when tracing, every allocation is printed to cerr as it happens - used to hunt down allocations in the frame loop
+	void setTracing(bool enabled) { tracing = enabled; }
+	hostAllocationStats stats(VkSystemAllocationScope scope) const;
+	uint64_t allocationCount() const; // over all scopes
+	uint64_t allocationBytes() const; // allocated over all scopes, freed or not
+	size_t arenaCapacity() const; // bytes held in arena blocks, in use or not
+	void report() const; // stats for each scope, printed to cout
+
+private:
+	static constexpr size_t blockSize = 64 * 1024; // larger allocations get a block of their own, released on reset
+
+	struct arena {
+		struct block {
+			char* memory;
+			size_t size;
+		};
+		std::vector<block> blocks; // blockSize each
+		std::vector<block> large; // dedicated to a single allocation
+		size_t currentBlock = 0;
+		size_t cursor = 0; // into the current block
+		uint64_t live = 0; // allocations not yet freed
+		bool retired = false;
+	};
+
+	// pUserData of each set of callbacks - arena is nullptr for the heap
+	struct context {
+		hostAllocator* owner;
+		arena* target;
+		VkAllocationCallbacks callbacks;
+	};
+
+	static constexpr uint32_t largeBlock = ~0u;
+	struct header {
+		char* start; // where the reservation begins, before the header and alignment padding
+		char* end; // and where it ends
+		arena* source; // nullptr for the heap
+		size_t size;
+		uint32_t block; // arena block index, or largeBlock
+		uint32_t scope;
+	};
+
+	static void* VKAPI_CALL allocateCallback(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	static void* VKAPI_CALL reallocateCallback(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	static void VKAPI_CALL freeCallback(void* userData, void* memory);
+	static void VKAPI_CALL internalAllocationCallback(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+	static void VKAPI_CALL internalFreeCallback(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+
+	void initContext(context& target, arena* source);
+	void* allocate(arena* source, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	void free(void* memory);
+	char* arenaReserve(arena& source, size_t bytes, uint32_t& block); // with the mutex held
+	void resetArena(arena& target); // with the mutex held
+	void track(uint32_t scope, int64_t bytes); // with the mutex held
+
+	mutable std::mutex mutex; // drivers may allocate from any thread, e.g. parallel pipeline compiles
+	context heap;
+	arena scratch;
+	std::deque<arena> generationArenas; // stable addresses - retired generations are reused, never released
+	std::deque<context> generations;
+	size_t current = 0; // index of the current swapchain generation
+	hostAllocationStats scopes[5]; // indexed by VkSystemAllocationScope
+	uint64_t totalBytes = 0;
+	std::atomic<bool> tracing{false};
+};
@@ -0,0 +1,80 @@
+#include "app.h"
+
+// ╦┌┐┌┌─┐┌┬┐┌─┐┌┐┌┌─┐┌─┐  ╔═╗┬ ┬┬  ┬  ┬┌┐┌┌─┐
+// ║│││└─┐ │ ├─┤││││  ├┤   ║  │ ││  │  │││││ ┬
+// ╩┘└┘└─┘ ┴ ┴ ┴┘└┘└─┘└─┘  ╚═╝└─┘┴─┘┴─┘┴┘└┘└─┘
+// whole instances, on the CPU - see cpuCulling.h for the BVH and the occlusion buffer
+
+void app::buildOccluders(const meshView& mesh) {
+	// the coarsest LOD, dequantized - only ever a few hundred triangles, cheap enough to rasterize for several instances
+	const meshLod& coarsest = mesh.lods[mesh.lodCount - 1];
+	occluderPositions.resize(size_t(coarsest.indexCount) * 3);
+	for (uint32_t i = 0; i < coarsest.indexCount; i++) {
+		const packedVertex& vertex = mesh.vertices[mesh.indices[coarsest.firstIndex + i]];
+		for (int c = 0; c < 3; c++)
+			occluderPositions[i * 3 + c] = mesh.bounds.center[c] + vertex.position[c] / 32767.0f * mesh.bounds.extent[c];
+	}
+}
+
+void app::cullInstances() {
+	PROFILE_ZONE("cullInstances");
+	auto start = std::chrono::steady_clock::now();
+
+	// world bounds of every instance, from the transforms the scene update just produced
+	const aabb meshBox{{bounds.center[0] - bounds.extent[0], bounds.center[1] - bounds.extent[1], bounds.center[2] - bounds.extent[2]},
+		{bounds.center[0] + bounds.extent[0], bounds.center[1] + bounds.extent[1], bounds.center[2] + bounds.extent[2]}};
+	instanceBounds.resize(instanceCount);
+	workers.parallelFor(instanceCount, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			instanceBounds[i] = transformBounds(meshBox, scene.world(instanceNodes[i]));
+	}, 1024);
+
+	// refitting keeps up with the animation, until the boxes have drifted far enough that a rebuild pays off
+	if (instanceBvh.size() != instanceCount || instanceBvh.quality() > bvhRebuildThreshold)
+		instanceBvh.build(instanceBounds.data(), instanceCount);
+	else
+		instanceBvh.refit(instanceBounds.data());
+
+	visibleInstances.clear();
+	instanceBvh.cullFrustum(&frameCamera.frustumPlanes[0].x, 5, visibleInstances);
+	const size_t frustumVisible = visibleInstances.size();
+
+	if (occlusionCulling && visibleInstances.size() > occluderCount) {
+		// the nearest survivors are drawn into the occlusion buffer, and stay visible - everything else is tested against it
+		const glm::vec3 eye(frameCamera.cameraPosition.x, frameCamera.cameraPosition.y, frameCamera.cameraPosition.z);
+		auto distance = [&](uint32_t i) {
+			const aabb& box = instanceBounds[i];
+			glm::vec3 center((box.min[0] + box.max[0]) * 0.5f, (box.min[1] + box.max[1]) * 0.5f, (box.min[2] + box.max[2]) * 0.5f);
+			return glm::dot(center - eye, center - eye);
+		};
+		std::partial_sort(visibleInstances.begin(), visibleInstances.begin() + occluderCount, visibleInstances.end(),
+			[&](uint32_t a, uint32_t b) { return distance(a) < distance(b); });
+
+		matrix4 viewProjection;
+		memcpy(viewProjection.m, &frameCamera.viewProjection[0][0], sizeof(viewProjection.m));
+		occlusion.begin(viewProjection);
+		for (size_t i = 0; i < occluderCount; i++)
+			occlusion.rasterize(occluderPositions.data(), occluderPositions.size() / 9, scene.world(instanceNodes[visibleInstances[i]]));
+		visibleInstances.erase(std::remove_if(visibleInstances.begin() + occluderCount, visibleInstances.end(),
+			[&](uint32_t i) { return !occlusion.isVisible(instanceBounds[i]); }), visibleInstances.end());
+	}
+	std::sort(visibleInstances.begin(), visibleInstances.end()); // consecutive instances can share a draw
+
+	cpuCullAccumulator += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	cpuCullVisibleAccumulator += visibleInstances.size();
+	cpuCullOccludedAccumulator += frustumVisible - visibleInstances.size();
+	cpuCullSamples++;
+}
+
+void app::toggleCpuCulling() {
+	cpuCulling = !cpuCulling;
+	if (cpuCulling) meshletCulling = false; // instances are culled whole here, and drawn directly
+	cout << "CPU culling " << (cpuCulling ? "on" : "off") << endl;
+	resetFrameTime(); // the chunks it changes are rerecorded as each image comes up, see chunkKey
+}
+
+void app::toggleOcclusionCulling() {
+	occlusionCulling = !occlusionCulling;
+	cout << "Occlusion culling " << (occlusionCulling ? "on" : "off") << (cpuCulling ? "" : " - only used with CPU culling, 'B'") << endl;
+	resetFrameTime(); // with CPU culling, the draws are rerecorded whenever the survivors change anyway
+}
@@ -1,7 +1,12 @@
 #include "app.h"
 
 int main(int argc, char const *argv[]) {
-    app vkApp;
+    if (argc > 1 && strcmp(argv[1], "--bench-scene") == 0) { // no window, just the CPU side scene update
+        threadPool pool;
+        runSceneBenchmark(pool);
+        return EXIT_SUCCESS;
+    }
+    app vkApp(argc, argv);
     try{vkApp.run();}catch(const std::exception& e){
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
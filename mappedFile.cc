@@ -0,0 +1,55 @@
+#include "mappedFile.h"
+
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mappedFile::mappedFile(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Failed to open " + path);
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0) {
+		close(fd);
+		throw std::runtime_error("Failed to stat " + path);
+	}
+	length = static_cast<size_t>(fileStat.st_size);
+
+	if (length != 0) { // mapping zero bytes is an error, an empty file just stays empty
+		void* result = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (result == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Failed to map " + path);
+		}
+		madvise(result, length, MADV_SEQUENTIAL); // parsers walk the file front to back, so read ahead aggressively
+		mapping = static_cast<const uint8_t*>(result);
+	}
+	close(fd); // the mapping keeps its own reference to the file
+}
+
+mappedFile::~mappedFile() {
+	unmap();
+}
+
+mappedFile::mappedFile(mappedFile&& other) noexcept
+	: mapping(std::exchange(other.mapping, nullptr)), length(std::exchange(other.length, 0)) {}
+
+mappedFile& mappedFile::operator=(mappedFile&& other) noexcept {
+	if (this != &other) {
+		unmap();
+		mapping = std::exchange(other.mapping, nullptr);
+		length = std::exchange(other.length, 0);
+	}
+	return *this;
+}
+
+void mappedFile::unmap() {
+	if (mapping != nullptr)
+		munmap(const_cast<uint8_t*>(mapping), length);
+	mapping = nullptr;
+	length = 0;
+}
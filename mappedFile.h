@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// read-only memory mapping of a whole file, unmapped when it goes out of scope
+class mappedFile {
+public:
+	mappedFile() = default;
+	explicit mappedFile(const std::string& path); // throws std::runtime_error if the file can't be opened or mapped
+	~mappedFile();
+
+	mappedFile(mappedFile&& other) noexcept;
+	mappedFile& operator=(mappedFile&& other) noexcept;
+	mappedFile(const mappedFile&) = delete;
+	mappedFile& operator=(const mappedFile&) = delete;
+
+	const uint8_t* data() const { return mapping; }
+	size_t size() const { return length; }
+	const char* begin() const { return reinterpret_cast<const char*>(mapping); }
+	const char* end() const { return reinterpret_cast<const char*>(mapping) + length; }
+
+private:
+	void unmap();
+	const uint8_t* mapping = nullptr;
+	size_t length = 0;
+};
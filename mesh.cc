@@ -0,0 +1,1087 @@
+#include "mesh.h"
+#include "mappedFile.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+using std::cout, std::endl;
+
+namespace {
+
+using importClock = std::chrono::steady_clock;
+double millisecondsSince(importClock::time_point start) {
+	return std::chrono::duration<double, std::milli>(importClock::now() - start).count();
+}
+
+// attributes as they come out of the parsers, before quantization - normals and uvs may be empty
+struct rawMesh {
+	std::vector<float> positions; // 3 per vertex
+	std::vector<float> normals; // 3 per vertex
+	std::vector<float> uvs; // 2 per vertex
+	std::vector<uint32_t> indices; // triangle list
+	std::vector<std::string> dependencies; // external files the source refers to, relative to its directory
+	size_t vertexCount() const { return positions.size() / 3; }
+};
+
+// ╔═╗┌─┐┌─┐┌┐┌  ╔═╗┌┬┐┌┬┐┬─┐┌─┐┌─┐┌─┐┬┌┐┌┌─┐
+// ║ ║├─┘├┤ │││  ╠═╣ ││ ││├┬┘├┤ └─┐└─┐│││││ ┬
+// ╚═╝┴  └─┘┘└┘  ╩ ╩─┴┘─┴┘┴└─└─┘└─┘└─┘┴┘└┘└─┘
+// linear probing hash table storing only indices of the first occurrence of each key, so the table itself costs
+// 4 bytes per slot. Returns the remap from every input element to its unique index, and fills uniqueSources with
+// the input index each unique element came from
+template <typename key, typename hashFunction, typename equalFunction>
+std::vector<uint32_t> deduplicate(const key* keys, size_t count, size_t expectedUnique, hashFunction hash, equalFunction equal, std::vector<uint32_t>& uniqueSources) {
+	constexpr uint32_t empty = ~0u;
+	size_t capacity = 64;
+	while (capacity < expectedUnique * 2) capacity <<= 1;
+	std::vector<uint32_t> table(capacity, empty);
+	std::vector<uint32_t> remap(count);
+	uniqueSources.clear();
+	uniqueSources.reserve(expectedUnique);
+
+	for (size_t i = 0; i < count; i++) {
+		// keep the load factor under 70%, growing and reinserting all the unique keys when it gets there
+		if ((uniqueSources.size() + 1) * 10 > capacity * 7) {
+			capacity <<= 1;
+			table.assign(capacity, empty);
+			for (uint32_t u = 0; u < uniqueSources.size(); u++) {
+				size_t slot = hash(keys[uniqueSources[u]]) & (capacity - 1);
+				while (table[slot] != empty) slot = (slot + 1) & (capacity - 1);
+				table[slot] = u;
+			}
+		}
+
+		size_t slot = hash(keys[i]) & (capacity - 1);
+		for (;;) {
+			uint32_t entry = table[slot];
+			if (entry == empty) { // first time this key has been seen
+				entry = static_cast<uint32_t>(uniqueSources.size());
+				uniqueSources.push_back(static_cast<uint32_t>(i));
+				table[slot] = entry;
+				remap[i] = entry;
+				break;
+			}
+			if (equal(keys[uniqueSources[entry]], keys[i])) {
+				remap[i] = entry;
+				break;
+			}
+			slot = (slot + 1) & (capacity - 1);
+		}
+	}
+	return remap;
+}
+
+inline uint64_t mix64(uint64_t h) { // murmur3 finalizer
+	h ^= h >> 33; h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+// ╔═╗╔╗  ╦
+// ║ ║╠╩╗ ║
+// ╚═╝╚═╝╚╝
+// hand rolled number parsing - strtof is locale aware and several times slower, which adds up over millions of lines
+inline const char* skipSpaces(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+	return p;
+}
+
+inline const char* parseFloat(const char* p, const char* end, float& result) {
+	p = skipSpaces(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+	double value = 0.0;
+	while (p < end && *p >= '0' && *p <= '9') value = value * 10.0 + (*p++ - '0');
+	if (p < end && *p == '.') {
+		p++;
+		double scale = 0.1;
+		while (p < end && *p >= '0' && *p <= '9') {
+			value += (*p++ - '0') * scale;
+			scale *= 0.1;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool negativeExponent = false;
+		if (p < end && (*p == '-' || *p == '+')) negativeExponent = *p++ == '-';
+		int exponent = 0;
+		while (p < end && *p >= '0' && *p <= '9') exponent = exponent * 10 + (*p++ - '0');
+		value *= std::pow(10.0, negativeExponent ? -exponent : exponent);
+	}
+	result = static_cast<float>(negative ? -value : value);
+	return p;
+}
+
+inline const char* parseInt(const char* p, const char* end, int32_t& result) {
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+	int32_t value = 0;
+	while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+	result = negative ? -value : value;
+	return p;
+}
+
+// negative (relative) OBJ indices are relative to the number of elements defined so far, which a chunk only knows
+// locally - they are stored biased far below zero and resolved against the chunk's base once all counts are known
+constexpr int32_t relativeIndexBias = 1 << 30;
+constexpr int32_t missingIndex = -1;
+
+inline int32_t objIndex(int32_t raw, size_t localCount) {
+	if (raw > 0) return raw - 1; // absolute, 1-based
+	if (raw < 0) return static_cast<int32_t>(localCount) + raw - relativeIndexBias;
+	return missingIndex;
+}
+
+inline int32_t resolveObjIndex(int32_t stored, size_t chunkBase) {
+	if (stored < -(relativeIndexBias >> 1)) return stored + relativeIndexBias + static_cast<int32_t>(chunkBase);
+	return stored;
+}
+
+struct objChunk {
+	const char* begin;
+	const char* end;
+	std::vector<float> positions, normals, uvs;
+	std::vector<int32_t> corners; // (position, uv, normal) triples, already triangulated
+};
+
+void parseObjChunk(objChunk& chunk) {
+	// rough guess at the makeup of a typical file, to avoid most of the reallocation
+	size_t estimatedLines = (chunk.end - chunk.begin) / 32;
+	chunk.positions.reserve(estimatedLines);
+	chunk.corners.reserve(estimatedLines * 3);
+
+	std::vector<int32_t> polygon; // corners of the current face, before triangulation
+	const char* p = chunk.begin;
+	const char* end = chunk.end;
+	while (p < end) {
+		p = skipSpaces(p, end);
+		if (p + 1 < end && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+			float x, y, z;
+			p = parseFloat(p + 2, end, x);
+			p = parseFloat(p, end, y);
+			p = parseFloat(p, end, z);
+			chunk.positions.insert(chunk.positions.end(), {x, y, z});
+		} else if (p + 2 < end && p[0] == 'v' && p[1] == 'n') {
+			float x, y, z;
+			p = parseFloat(p + 2, end, x);
+			p = parseFloat(p, end, y);
+			p = parseFloat(p, end, z);
+			chunk.normals.insert(chunk.normals.end(), {x, y, z});
+		} else if (p + 2 < end && p[0] == 'v' && p[1] == 't') {
+			float u, v;
+			p = parseFloat(p + 2, end, u);
+			p = parseFloat(p, end, v);
+			chunk.uvs.insert(chunk.uvs.end(), {u, 1.0f - v}); // OBJ puts the origin at the bottom left
+		} else if (p + 1 < end && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+			polygon.clear();
+			p += 2;
+			for (;;) {
+				p = skipSpaces(p, end);
+				if (p >= end || !((*p >= '0' && *p <= '9') || *p == '-' || *p == '+')) break;
+				int32_t v = 0, t = 0, n = 0;
+				p = parseInt(p, end, v);
+				if (p < end && *p == '/') {
+					p++;
+					if (p < end && *p != '/') p = parseInt(p, end, t);
+					if (p < end && *p == '/') p = parseInt(p + 1, end, n);
+				}
+				polygon.push_back(objIndex(v, chunk.positions.size() / 3));
+				polygon.push_back(objIndex(t, chunk.uvs.size() / 2));
+				polygon.push_back(objIndex(n, chunk.normals.size() / 3));
+			}
+			// fan triangulation - fine for the convex polygons exporters produce
+			for (size_t i = 2; i < polygon.size() / 3; i++) {
+				chunk.corners.insert(chunk.corners.end(), polygon.begin(), polygon.begin() + 3);
+				chunk.corners.insert(chunk.corners.end(), polygon.begin() + (i - 1) * 3, polygon.begin() + (i + 1) * 3);
+			}
+		}
+		// everything else (comments, groups, materials, ...) is ignored - skip to the next line
+		while (p < end && *p != '\n') p++;
+		p++;
+	}
+}
+
+struct objCorner {
+	int32_t position, uv, normal;
+};
+
+rawMesh loadObj(const mappedFile& file, threadPool& pool) {
+	PROFILE_ZONE("loadObj");
+	// split the file at line boundaries into a few chunks per thread
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(pool.size() * 4, file.size() / (1 << 16)));
+	std::vector<objChunk> chunks(chunkCount);
+	const char* cursor = file.begin();
+	for (size_t i = 0; i < chunkCount; i++) {
+		chunks[i].begin = cursor;
+		const char* split = (i + 1 == chunkCount) ? file.end() : std::max(cursor, file.begin() + file.size() * (i + 1) / chunkCount);
+		while (split < file.end() && split[-1] != '\n') split++;
+		chunks[i].end = split;
+		cursor = split;
+	}
+	pool.parallelFor(chunkCount, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) parseObjChunk(chunks[i]);
+	});
+
+	// prefix sums give each chunk the global index of its first position/uv/normal, and where its corners go
+	std::vector<size_t> positionBase(chunkCount), uvBase(chunkCount), normalBase(chunkCount), cornerBase(chunkCount);
+	size_t positionCount = 0, uvCount = 0, normalCount = 0, cornerCount = 0;
+	for (size_t i = 0; i < chunkCount; i++) {
+		positionBase[i] = positionCount; positionCount += chunks[i].positions.size() / 3;
+		uvBase[i] = uvCount; uvCount += chunks[i].uvs.size() / 2;
+		normalBase[i] = normalCount; normalCount += chunks[i].normals.size() / 3;
+		cornerBase[i] = cornerCount; cornerCount += chunks[i].corners.size() / 3;
+	}
+	if (cornerCount == 0)
+		throw std::runtime_error("OBJ file contains no faces");
+
+	std::vector<float> positions(positionCount * 3), uvs(uvCount * 2), normals(normalCount * 3);
+	std::vector<objCorner> corners(cornerCount);
+	std::atomic<bool> invalidIndex(false);
+	pool.parallelFor(chunkCount, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const objChunk& chunk = chunks[i];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + positionBase[i] * 3);
+			std::copy(chunk.uvs.begin(), chunk.uvs.end(), uvs.begin() + uvBase[i] * 2);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + normalBase[i] * 3);
+			for (size_t c = 0; c < chunk.corners.size() / 3; c++) {
+				objCorner& corner = corners[cornerBase[i] + c];
+				corner.position = resolveObjIndex(chunk.corners[c * 3 + 0], positionBase[i]);
+				corner.uv = resolveObjIndex(chunk.corners[c * 3 + 1], uvBase[i]);
+				corner.normal = resolveObjIndex(chunk.corners[c * 3 + 2], normalBase[i]);
+				if (corner.position < 0 || size_t(corner.position) >= positionCount || corner.uv >= int32_t(uvCount) || corner.normal >= int32_t(normalCount) || corner.uv < missingIndex || corner.normal < missingIndex)
+					invalidIndex = true;
+			}
+		}
+	});
+	if (invalidIndex)
+		throw std::runtime_error("OBJ file references an attribute that doesn't exist");
+	chunks.clear();
+
+	// an OBJ vertex is the combination of its three indices - dedup those first, it's cheaper than comparing attributes
+	std::vector<uint32_t> uniqueCorners;
+	std::vector<uint32_t> remap = deduplicate(corners.data(), corners.size(), std::max({positionCount, uvCount, normalCount}),
+		[](const objCorner& c) { return mix64((uint64_t(uint32_t(c.position)) << 32) ^ (uint64_t(uint32_t(c.uv)) << 16) ^ uint32_t(c.normal)); },
+		[](const objCorner& a, const objCorner& b) { return a.position == b.position && a.uv == b.uv && a.normal == b.normal; },
+		uniqueCorners);
+
+	rawMesh mesh;
+	mesh.indices = std::move(remap);
+	size_t vertexCount = uniqueCorners.size();
+	mesh.positions.resize(vertexCount * 3);
+	if (uvCount != 0) mesh.uvs.resize(vertexCount * 2);
+	if (normalCount != 0) mesh.normals.resize(vertexCount * 3);
+	pool.parallelFor(vertexCount, [&](size_t begin, size_t end) {
+		for (size_t v = begin; v < end; v++) {
+			const objCorner& corner = corners[uniqueCorners[v]];
+			std::copy_n(&positions[size_t(corner.position) * 3], 3, &mesh.positions[v * 3]);
+			if (uvCount != 0) {
+				if (corner.uv >= 0) std::copy_n(&uvs[size_t(corner.uv) * 2], 2, &mesh.uvs[v * 2]);
+				else mesh.uvs[v * 2] = mesh.uvs[v * 2 + 1] = 0.0f;
+			}
+			if (normalCount != 0) {
+				if (corner.normal >= 0) std::copy_n(&normals[size_t(corner.normal) * 3], 3, &mesh.normals[v * 3]);
+				else mesh.normals[v * 3] = mesh.normals[v * 3 + 1] = mesh.normals[v * 3 + 2] = 0.0f;
+			}
+		}
+	}, 4096);
+	return mesh;
+}
+
+// ╦╔═╗╔═╗╔╗╔
+// ║╚═╗║ ║║║║
+// ╚╝╚═╝╚═╝╝╚╝
+// just enough JSON to read glTF - the document is small next to its binary buffers, so this doesn't need to be fast
+struct jsonValue {
+	enum kind { null, boolean, number, string, array, object } type = null;
+	bool booleanValue = false;
+	double numberValue = 0.0;
+	std::string stringValue;
+	std::vector<jsonValue> elements; // array elements, or object values
+	std::vector<std::string> keys; // object keys, parallel to elements
+
+	const jsonValue* find(const char* key) const {
+		for (size_t i = 0; i < keys.size(); i++)
+			if (keys[i] == key) return &elements[i];
+		return nullptr;
+	}
+	const jsonValue& at(const char* key) const {
+		const jsonValue* value = find(key);
+		if (value == nullptr) throw std::runtime_error(std::string("glTF: missing required property ") + key);
+		return *value;
+	}
+	size_t index(const char* key) const { return static_cast<size_t>(at(key).numberValue); }
+	double numberOr(const char* key, double fallback) const {
+		const jsonValue* value = find(key);
+		return value ? value->numberValue : fallback;
+	}
+};
+
+class jsonParser {
+public:
+	jsonParser(const char* begin, const char* end) : p(begin), end(end) {}
+	jsonValue parse() {
+		jsonValue value = parseValue();
+		skipWhitespace();
+		return value;
+	}
+private:
+	const char* p;
+	const char* end;
+
+	[[noreturn]] void fail() { throw std::runtime_error("glTF: malformed JSON"); }
+	void skipWhitespace() { while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++; }
+	void expect(char c) { skipWhitespace(); if (p >= end || *p != c) fail(); p++; }
+	bool consume(const char* literal) {
+		size_t length = strlen(literal);
+		if (size_t(end - p) < length || strncmp(p, literal, length) != 0) return false;
+		p += length;
+		return true;
+	}
+
+	jsonValue parseValue() {
+		skipWhitespace();
+		if (p >= end) fail();
+		jsonValue value;
+		if (*p == '{') {
+			value.type = jsonValue::object;
+			p++;
+			skipWhitespace();
+			if (p < end && *p == '}') { p++; return value; }
+			do {
+				skipWhitespace();
+				value.keys.push_back(parseString());
+				expect(':');
+				value.elements.push_back(parseValue());
+				skipWhitespace();
+			} while (p < end && *p == ',' && ++p);
+			expect('}');
+		} else if (*p == '[') {
+			value.type = jsonValue::array;
+			p++;
+			skipWhitespace();
+			if (p < end && *p == ']') { p++; return value; }
+			do {
+				value.elements.push_back(parseValue());
+				skipWhitespace();
+			} while (p < end && *p == ',' && ++p);
+			expect(']');
+		} else if (*p == '"') {
+			value.type = jsonValue::string;
+			value.stringValue = parseString();
+		} else if (consume("true")) {
+			value.type = jsonValue::boolean;
+			value.booleanValue = true;
+		} else if (consume("false")) {
+			value.type = jsonValue::boolean;
+		} else if (consume("null")) {
+			value.type = jsonValue::null;
+		} else {
+			value.type = jsonValue::number;
+			char* numberEnd = nullptr;
+			std::string token(p, std::find_if(p, end, [](char c){ return c == ',' || c == '}' || c == ']' || c == ' ' || c == '\n' || c == '\r' || c == '\t'; }));
+			value.numberValue = strtod(token.c_str(), &numberEnd);
+			if (numberEnd == token.c_str()) fail();
+			p += numberEnd - token.c_str();
+		}
+		return value;
+	}
+
+	std::string parseString() {
+		if (p >= end || *p != '"') fail();
+		p++;
+		std::string result;
+		while (p < end && *p != '"') {
+			if (*p == '\\' && p + 1 < end) {
+				p++;
+				switch (*p) {
+					case 'n': result += '\n'; break;
+					case 't': result += '\t'; break;
+					case 'r': result += '\r'; break;
+					case 'b': result += '\b'; break;
+					case 'f': result += '\f'; break;
+					case 'u': result += '?'; p += std::min<ptrdiff_t>(4, end - p - 1); break; // names only, never needed verbatim
+					default: result += *p; break; // \" \\ \/
+				}
+				p++;
+			} else {
+				result += *p++;
+			}
+		}
+		if (p >= end) fail();
+		p++; // closing quote
+		return result;
+	}
+};
+
+// view of one accessor's elements inside a mapped buffer
+struct gltfAccessor {
+	const uint8_t* data = nullptr;
+	size_t count = 0;
+	size_t stride = 0;
+	uint32_t componentType = 0;
+	uint32_t components = 0;
+	bool normalized = false;
+
+	float component(size_t element, uint32_t c) const {
+		const uint8_t* source = data + element * stride;
+		switch (componentType) {
+			case 5126: { float f; memcpy(&f, source + c * 4, 4); return f; }
+			case 5121: return normalized ? source[c] / 255.0f : source[c];
+			case 5120: { int8_t v = int8_t(source[c]); return normalized ? std::max(v / 127.0f, -1.0f) : v; }
+			case 5123: { uint16_t v; memcpy(&v, source + c * 2, 2); return normalized ? v / 65535.0f : v; }
+			case 5122: { int16_t v; memcpy(&v, source + c * 2, 2); return normalized ? std::max(v / 32767.0f, -1.0f) : v; }
+			default: throw std::runtime_error("glTF: unsupported accessor component type");
+		}
+	}
+	uint32_t index(size_t element) const {
+		const uint8_t* source = data + element * stride;
+		switch (componentType) {
+			case 5121: return source[0];
+			case 5123: { uint16_t v; memcpy(&v, source, 2); return v; }
+			case 5125: { uint32_t v; memcpy(&v, source, 4); return v; }
+			default: throw std::runtime_error("glTF: unsupported index component type");
+		}
+	}
+};
+
+uint32_t componentSize(uint32_t componentType) {
+	switch (componentType) {
+		case 5120: case 5121: return 1;
+		case 5122: case 5123: return 2;
+		case 5125: case 5126: return 4;
+		default: throw std::runtime_error("glTF: unsupported accessor component type");
+	}
+}
+
+gltfAccessor readAccessor(const jsonValue& document, size_t accessorIndex, const std::vector<std::pair<const uint8_t*, size_t>>& buffers) {
+	const jsonValue& accessor = document.at("accessors").elements.at(accessorIndex);
+	gltfAccessor result;
+	result.count = accessor.index("count");
+	result.componentType = static_cast<uint32_t>(accessor.index("componentType"));
+	const std::string& type = accessor.at("type").stringValue;
+	result.components = type == "SCALAR" ? 1 : type == "VEC2" ? 2 : type == "VEC3" ? 3 : type == "VEC4" ? 4 : 0;
+	if (result.components == 0) throw std::runtime_error("glTF: unsupported accessor type " + type);
+	if (const jsonValue* normalized = accessor.find("normalized")) result.normalized = normalized->booleanValue;
+	if (accessor.find("bufferView") == nullptr) throw std::runtime_error("glTF: accessors without a bufferView are not supported");
+
+	const jsonValue& view = document.at("bufferViews").elements.at(accessor.index("bufferView"));
+	const auto& buffer = buffers.at(view.index("buffer"));
+	size_t offset = static_cast<size_t>(view.numberOr("byteOffset", 0) + accessor.numberOr("byteOffset", 0));
+	size_t elementSize = componentSize(result.componentType) * result.components;
+	result.stride = static_cast<size_t>(view.numberOr("byteStride", 0));
+	if (result.stride == 0) result.stride = elementSize;
+	if (result.count != 0 && offset + (result.count - 1) * result.stride + elementSize > buffer.second)
+		throw std::runtime_error("glTF: accessor runs past the end of its buffer");
+	result.data = buffer.first + offset;
+	return result;
+}
+
+rawMesh loadGltf(const std::string& path, const mappedFile& file, threadPool& pool) {
+	PROFILE_ZONE("loadGltf");
+	std::vector<mappedFile> externalBuffers;
+	std::vector<std::string> dependencies; // their URIs, for the mesh cache to track
+	std::vector<std::pair<const uint8_t*, size_t>> buffers;
+	const char* jsonBegin = file.begin();
+	const char* jsonEnd = file.end();
+	std::pair<const uint8_t*, size_t> binaryChunk{nullptr, 0};
+
+	// binary container - 12 byte header, then a JSON chunk optionally followed by a BIN chunk
+	if (file.size() >= 12 && memcmp(file.data(), "glTF", 4) == 0) {
+		uint32_t jsonLength, jsonType;
+		if (file.size() < 20) throw std::runtime_error("glTF: truncated .glb file");
+		memcpy(&jsonLength, file.data() + 12, 4);
+		memcpy(&jsonType, file.data() + 16, 4);
+		if (jsonType != 0x4E4F534A || 20 + size_t(jsonLength) > file.size()) throw std::runtime_error("glTF: bad JSON chunk in .glb file");
+		jsonBegin = file.begin() + 20;
+		jsonEnd = jsonBegin + jsonLength;
+		size_t binaryOffset = 20 + size_t(jsonLength);
+		if (binaryOffset + 8 <= file.size()) {
+			uint32_t binaryLength, binaryType;
+			memcpy(&binaryLength, file.data() + binaryOffset, 4);
+			memcpy(&binaryType, file.data() + binaryOffset + 4, 4);
+			if (binaryType == 0x004E4942 && binaryOffset + 8 + binaryLength <= file.size())
+				binaryChunk = {file.data() + binaryOffset + 8, binaryLength};
+		}
+	}
+	jsonValue document = jsonParser(jsonBegin, jsonEnd).parse();
+
+	// external buffers are mapped too, relative to the .gltf file
+	std::string directory = path.substr(0, path.find_last_of('/') + 1);
+	if (const jsonValue* bufferList = document.find("buffers")) {
+		for (const jsonValue& buffer : bufferList->elements) {
+			const jsonValue* uri = buffer.find("uri");
+			if (uri == nullptr) { // the .glb BIN chunk
+				buffers.push_back(binaryChunk);
+			} else if (uri->stringValue.rfind("data:", 0) == 0) {
+				throw std::runtime_error("glTF: embedded base64 buffers are not supported, export with a separate .bin");
+			} else {
+				externalBuffers.emplace_back(directory + uri->stringValue);
+				buffers.push_back({externalBuffers.back().data(), externalBuffers.back().size()});
+				dependencies.push_back(uri->stringValue);
+			}
+		}
+	}
+
+	// all triangle primitives of all meshes end up in one mesh, in mesh space - instance transforms are the scene's job
+	struct primitiveSource {
+		gltfAccessor positions, normals, uvs, indices;
+		bool hasNormals = false, hasUvs = false, hasIndices = false;
+		size_t vertexBase = 0, indexBase = 0;
+	};
+	std::vector<primitiveSource> primitives;
+	size_t vertexCount = 0, indexCount = 0;
+	bool allNormals = true, allUvs = true;
+	const jsonValue* meshes = document.find("meshes");
+	if (meshes == nullptr) throw std::runtime_error("glTF: file contains no meshes");
+	for (const jsonValue& mesh : meshes->elements) {
+		for (const jsonValue& primitive : mesh.at("primitives").elements) {
+			if (primitive.numberOr("mode", 4) != 4) continue; // triangle lists only
+			const jsonValue& attributes = primitive.at("attributes");
+			primitiveSource source;
+			source.positions = readAccessor(document, attributes.index("POSITION"), buffers);
+			if (attributes.find("NORMAL")) { source.normals = readAccessor(document, attributes.index("NORMAL"), buffers); source.hasNormals = true; }
+			if (attributes.find("TEXCOORD_0")) { source.uvs = readAccessor(document, attributes.index("TEXCOORD_0"), buffers); source.hasUvs = true; }
+			if (primitive.find("indices")) { source.indices = readAccessor(document, primitive.index("indices"), buffers); source.hasIndices = true; }
+			source.vertexBase = vertexCount;
+			source.indexBase = indexCount;
+			vertexCount += source.positions.count;
+			indexCount += source.hasIndices ? source.indices.count : source.positions.count;
+			allNormals &= source.hasNormals;
+			allUvs &= source.hasUvs;
+			primitives.push_back(source);
+		}
+	}
+	if (indexCount == 0) throw std::runtime_error("glTF: file contains no triangles");
+
+	rawMesh result;
+	result.positions.resize(vertexCount * 3);
+	if (allNormals) result.normals.resize(vertexCount * 3); // normals are generated if any primitive is missing them
+	result.uvs.resize(vertexCount * 2, 0.0f);
+	result.indices.resize(indexCount);
+	result.dependencies = std::move(dependencies);
+	std::atomic<bool> invalidIndex(false);
+	for (const primitiveSource& source : primitives) {
+		pool.parallelFor(source.positions.count, [&](size_t begin, size_t end) {
+			for (size_t v = begin; v < end; v++) {
+				size_t out = source.vertexBase + v;
+				for (uint32_t c = 0; c < 3; c++) result.positions[out * 3 + c] = source.positions.component(v, c);
+				if (allNormals) for (uint32_t c = 0; c < 3; c++) result.normals[out * 3 + c] = source.normals.component(v, c);
+				if (source.hasUvs) for (uint32_t c = 0; c < 2; c++) result.uvs[out * 2 + c] = source.uvs.component(v, c);
+			}
+		}, 4096);
+		size_t primitiveIndices = source.hasIndices ? source.indices.count : source.positions.count;
+		pool.parallelFor(primitiveIndices, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				uint32_t index = source.hasIndices ? source.indices.index(i) : static_cast<uint32_t>(i);
+				if (index >= source.positions.count) invalidIndex = true;
+				result.indices[source.indexBase + i] = static_cast<uint32_t>(source.vertexBase) + index;
+			}
+		}, 16384);
+	}
+	if (invalidIndex) throw std::runtime_error("glTF: index out of range");
+	if (!allUvs && !std::any_of(primitives.begin(), primitives.end(), [](const primitiveSource& s){ return s.hasUvs; }))
+		result.uvs.clear();
+	result.indices.resize(indexCount / 3 * 3); // drop a trailing partial triangle, if any
+	return result;
+}
+
+// ╔═╗┬┌┐┌┌─┐┬  ┬┌─┐┌─┐┌┬┐┬┌─┐┌┐┌
+// ╠╣ ││││├─┤│  │┌─┘├─┤ │ ││ ││││
+// ╚  ┴┘└┘┴ ┴┴─┘┴└─┘┴ ┴ ┴ ┴└─┘┘└┘
+void generateNormals(rawMesh& mesh) {
+	// area weighted face normals, accumulated on the vertices - the cross product length is twice the area
+	mesh.normals.assign(mesh.positions.size(), 0.0f);
+	for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+		const float* a = &mesh.positions[mesh.indices[t] * 3];
+		const float* b = &mesh.positions[mesh.indices[t + 1] * 3];
+		const float* c = &mesh.positions[mesh.indices[t + 2] * 3];
+		float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+		float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+		float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+		for (uint32_t corner = 0; corner < 3; corner++)
+			for (uint32_t c = 0; c < 3; c++)
+				mesh.normals[mesh.indices[t + corner] * 3 + c] += n[c];
+	}
+}
+
+inline int16_t toSnorm16(float value) {
+	return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+inline int8_t toSnorm8(float value) {
+	return static_cast<int8_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 127.0f));
+}
+
+meshBounds computeBounds(const std::vector<float>& positions, threadPool& pool) {
+	size_t vertexCount = positions.size() / 3;
+	std::mutex mergeMutex;
+	float lower[3] = { std::numeric_limits<float>::max(),  std::numeric_limits<float>::max(),  std::numeric_limits<float>::max()};
+	float upper[3] = {-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()};
+	pool.parallelFor(vertexCount, [&](size_t begin, size_t end) {
+		float localLower[3] = {lower[0], lower[1], lower[2]};
+		float localUpper[3] = {upper[0], upper[1], upper[2]};
+		for (size_t v = begin; v < end; v++)
+			for (uint32_t c = 0; c < 3; c++) {
+				localLower[c] = std::min(localLower[c], positions[v * 3 + c]);
+				localUpper[c] = std::max(localUpper[c], positions[v * 3 + c]);
+			}
+		std::lock_guard<std::mutex> lock(mergeMutex);
+		for (uint32_t c = 0; c < 3; c++) {
+			lower[c] = std::min(lower[c], localLower[c]);
+			upper[c] = std::max(upper[c], localUpper[c]);
+		}
+	}, 16384);
+
+	meshBounds bounds;
+	for (uint32_t c = 0; c < 3; c++) {
+		bounds.center[c] = 0.5f * (lower[c] + upper[c]);
+		bounds.extent[c] = std::max(0.5f * (upper[c] - lower[c]), 1e-20f); // flat meshes still need a nonzero scale
+	}
+	return bounds;
+}
+
+std::vector<packedVertex> quantize(const rawMesh& mesh, const meshBounds& bounds, threadPool& pool) {
+	std::vector<packedVertex> vertices(mesh.vertexCount());
+	const bool hasUvs = !mesh.uvs.empty();
+	pool.parallelFor(vertices.size(), [&](size_t begin, size_t end) {
+		for (size_t v = begin; v < end; v++) {
+			packedVertex& out = vertices[v];
+			for (uint32_t c = 0; c < 3; c++)
+				out.position[c] = toSnorm16((mesh.positions[v * 3 + c] - bounds.center[c]) / bounds.extent[c]);
+			out.position[3] = 0;
+
+			const float* n = &mesh.normals[v * 3];
+			float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			float scale = length > 0.0f ? 1.0f / length : 0.0f;
+			for (uint32_t c = 0; c < 3; c++)
+				out.normal[c] = toSnorm8(n[c] * scale);
+			out.normal[3] = 0;
+
+			out.uv[0] = floatToHalf(hasUvs ? mesh.uvs[v * 2] : 0.0f);
+			out.uv[1] = floatToHalf(hasUvs ? mesh.uvs[v * 2 + 1] : 0.0f);
+		}
+	}, 4096);
+	return vertices;
+}
+
+// Tom Forsyth's linear-speed vertex cache optimization - greedily emits the triangle whose vertices score highest,
+// where the score favors vertices already in a simulated LRU cache and vertices with few remaining triangles
+//   https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount) {
+	PROFILE_ZONE("optimizeVertexCache");
+	constexpr int cacheSize = 32;
+	constexpr uint32_t maxValence = 32; // valence scores are clamped past this
+	const size_t triangleCount = indices.size() / 3;
+
+	float cacheScores[cacheSize];
+	for (int i = 0; i < cacheSize; i++) // the last triangle's vertices get a fixed score, so it doesn't get reused immediately
+		cacheScores[i] = i < 3 ? 0.75f : std::pow(1.0f - float(i - 3) / float(cacheSize - 3), 1.5f);
+	float valenceScores[maxValence + 1];
+	valenceScores[0] = 0.0f;
+	for (uint32_t i = 1; i <= maxValence; i++)
+		valenceScores[i] = 2.0f / std::sqrt(float(i));
+
+	// vertex -> triangle adjacency, the first `remaining` entries of each vertex's range are the unemitted triangles
+	std::vector<uint32_t> remaining(vertexCount, 0), adjacencyOffset(vertexCount + 1, 0);
+	for (uint32_t index : indices) remaining[index]++;
+	for (size_t v = 0; v < vertexCount; v++) adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+	std::vector<uint32_t> adjacency(indices.size());
+	{
+		std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++) adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<int32_t> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	auto scoreVertex = [&](uint32_t v) {
+		if (remaining[v] == 0) return -1.0f;
+		float score = cachePosition[v] >= 0 ? cacheScores[cachePosition[v]] : 0.0f;
+		return score + valenceScores[std::min(remaining[v], maxValence)];
+	};
+	for (size_t v = 0; v < vertexCount; v++) vertexScore[v] = scoreVertex(static_cast<uint32_t>(v));
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (size_t t = 0; t < triangleCount; t++)
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	uint32_t cache[cacheSize + 3];
+	uint32_t cacheCount = 0;
+	size_t scanCursor = 0; // fallback when the cache holds no candidates - next unemitted triangle in input order
+
+	uint32_t best = 0;
+	for (size_t t = 1; t < triangleCount; t++)
+		if (triangleScore[t] > triangleScore[best]) best = static_cast<uint32_t>(t);
+
+	for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+		const uint32_t* tri = &indices[size_t(best) * 3];
+		output.insert(output.end(), tri, tri + 3);
+		emitted[best] = true;
+
+		// remove the triangle from its vertices' adjacency lists
+		for (uint32_t c = 0; c < 3; c++) {
+			uint32_t v = tri[c];
+			uint32_t* list = &adjacency[adjacencyOffset[v]];
+			for (uint32_t i = 0; i < remaining[v]; i++)
+				if (list[i] == best) { std::swap(list[i], list[remaining[v] - 1]); break; }
+			remaining[v]--;
+		}
+
+		// move the triangle's vertices to the front of the LRU cache, anything pushed past the end falls out
+		uint32_t newCache[cacheSize + 3];
+		uint32_t newCount = 0;
+		for (uint32_t c = 0; c < 3; c++) newCache[newCount++] = tri[c];
+		for (uint32_t i = 0; i < cacheCount; i++) {
+			uint32_t v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2]) newCache[newCount++] = v;
+		}
+		for (uint32_t i = cacheSize; i < newCount; i++) {
+			cachePosition[newCache[i]] = -1;
+			vertexScore[newCache[i]] = scoreVertex(newCache[i]);
+		}
+		cacheCount = std::min<uint32_t>(newCount, cacheSize);
+		std::copy(newCache, newCache + cacheCount, cache);
+
+		// rescore everything in the cache, and the triangles touching it - the best of those is the next candidate
+		for (uint32_t i = 0; i < cacheCount; i++) {
+			cachePosition[cache[i]] = static_cast<int32_t>(i);
+			vertexScore[cache[i]] = scoreVertex(cache[i]);
+		}
+		float bestScore = -1.0f;
+		for (uint32_t i = 0; i < cacheCount; i++) {
+			uint32_t v = cache[i];
+			const uint32_t* list = &adjacency[adjacencyOffset[v]];
+			for (uint32_t j = 0; j < remaining[v]; j++) {
+				uint32_t t = list[j];
+				const uint32_t* corners = &indices[size_t(t) * 3];
+				triangleScore[t] = vertexScore[corners[0]] + vertexScore[corners[1]] + vertexScore[corners[2]];
+				if (triangleScore[t] > bestScore) { bestScore = triangleScore[t]; best = t; }
+			}
+		}
+		if (bestScore < 0.0f) { // dead end, nothing in the cache has triangles left
+			while (scanCursor < triangleCount && emitted[scanCursor]) scanCursor++;
+			best = static_cast<uint32_t>(scanCursor);
+		}
+	}
+	indices.swap(output);
+}
+
+// renumbers vertices in order of first use, so the vertex fetches walk memory linearly - also drops unused vertices
+void optimizeVertexFetch(std::vector<packedVertex>& vertices, std::vector<uint32_t>& indices) {
+	std::vector<uint32_t> remap(vertices.size(), ~0u);
+	std::vector<packedVertex> reordered;
+	reordered.reserve(vertices.size());
+	for (uint32_t& index : indices) {
+		if (remap[index] == ~0u) {
+			remap[index] = static_cast<uint32_t>(reordered.size());
+			reordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+	vertices.swap(reordered);
+}
+
+// vertex clustering simplification - snaps every vertex to a uniform grid and collapses each cell onto the first vertex
+// that falls into it, so the LODs only need new index lists over the existing vertex buffer. The cell size doubles until
+// the triangle count drops to about a quarter of the previous level. Each LOD is appended to the index stream
+void buildLods(meshData& mesh, uint32_t maxLods) {
+	PROFILE_ZONE("buildLods");
+	const float worldExtent = std::max({mesh.bounds.extent[0], mesh.bounds.extent[1], mesh.bounds.extent[2]});
+	const size_t vertexCount = mesh.vertices.size();
+	mesh.lods.assign(1, meshLod{0, static_cast<uint32_t>(mesh.indices.size()), 0.0f, 0, 0});
+
+	float cellSize = 2.0f * worldExtent / 1024.0f;
+	std::vector<uint64_t> cells(vertexCount);
+	std::vector<uint32_t> representatives;
+	while (mesh.lods.size() < maxLods && mesh.lods.back().indexCount / 3 > 256) {
+		const meshLod previous = mesh.lods.back();
+		std::vector<uint32_t> simplified;
+		for (; cellSize < 4.0f * worldExtent; cellSize *= 2.0f) {
+			for (size_t v = 0; v < vertexCount; v++) {
+				uint64_t cell = 0;
+				for (uint32_t c = 0; c < 3; c++) // quantized position -> offset from the minimum corner, in cells
+					cell = (cell << 21) | static_cast<uint64_t>((mesh.vertices[v].position[c] / 32767.0f + 1.0f) * mesh.bounds.extent[c] / cellSize);
+				cells[v] = cell;
+			}
+			std::vector<uint32_t> remap = deduplicate(cells.data(), cells.size(), vertexCount / 4,
+				[](uint64_t cell) { return mix64(cell); }, [](uint64_t a, uint64_t b) { return a == b; }, representatives);
+
+			simplified.clear();
+			for (uint32_t t = previous.firstIndex; t < previous.firstIndex + previous.indexCount; t += 3) {
+				uint32_t a = representatives[remap[mesh.indices[t]]];
+				uint32_t b = representatives[remap[mesh.indices[t + 1]]];
+				uint32_t c = representatives[remap[mesh.indices[t + 2]]];
+				if (a != b && b != c && a != c) simplified.insert(simplified.end(), {a, b, c});
+			}
+			if (simplified.size() * 4 <= size_t(previous.indexCount) + 3) break;
+		}
+		if (simplified.empty() || simplified.size() >= previous.indexCount) break;
+
+		optimizeVertexCache(simplified, vertexCount);
+		mesh.lods.push_back(meshLod{static_cast<uint32_t>(mesh.indices.size()), static_cast<uint32_t>(simplified.size()), cellSize, 0, 0});
+		mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+	}
+}
+
+// splits each LOD's triangles into meshlets, in their existing order - after the vertex cache optimization consecutive
+// triangles share most of their vertices, so the clusters come out spatially compact without any extra sorting
+void buildMeshlets(meshData& mesh) {
+	PROFILE_ZONE("buildMeshlets");
+	std::vector<float> positions(mesh.vertices.size() * 3); // dequantized, the bounds have to be in mesh space
+	for (size_t v = 0; v < mesh.vertices.size(); v++)
+		for (uint32_t c = 0; c < 3; c++)
+			positions[v * 3 + c] = mesh.bounds.center[c] + mesh.vertices[v].position[c] / 32767.0f * mesh.bounds.extent[c];
+
+	std::vector<uint32_t> lastMeshlet(mesh.vertices.size(), ~0u); // which meshlet last counted each vertex
+	std::vector<uint32_t> clusterVertices;
+	mesh.meshlets.clear();
+
+	auto finishMeshlet = [&](uint32_t firstIndex, uint32_t indexCount) {
+		meshlet cluster{};
+		cluster.firstIndex = firstIndex;
+		cluster.indexCount = indexCount;
+
+		// sphere around the center of the cluster's bounding box - not minimal, but close enough for culling
+		float lower[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, upper[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+		for (uint32_t v : clusterVertices)
+			for (uint32_t c = 0; c < 3; c++) {
+				lower[c] = std::min(lower[c], positions[v * 3 + c]);
+				upper[c] = std::max(upper[c], positions[v * 3 + c]);
+			}
+		for (uint32_t c = 0; c < 3; c++) cluster.center[c] = 0.5f * (lower[c] + upper[c]);
+		float radiusSquared = 0.0f;
+		for (uint32_t v : clusterVertices) {
+			float d[3] = {positions[v * 3] - cluster.center[0], positions[v * 3 + 1] - cluster.center[1], positions[v * 3 + 2] - cluster.center[2]};
+			radiusSquared = std::max(radiusSquared, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		}
+		cluster.radius = std::sqrt(radiusSquared);
+
+		// normal cone - the axis is the average face normal, and the widest angle to any face normal sets the cutoff
+		std::vector<std::array<float, 3>> normals;
+		float axis[3] = {0.0f, 0.0f, 0.0f};
+		for (uint32_t t = firstIndex; t < firstIndex + indexCount; t += 3) {
+			const float* a = &positions[mesh.indices[t] * 3];
+			const float* b = &positions[mesh.indices[t + 1] * 3];
+			const float* c = &positions[mesh.indices[t + 2] * 3];
+			float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+			float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+			std::array<float, 3> n = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+			float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length == 0.0f) continue; // degenerate after dequantization, can't face anywhere
+			for (uint32_t i = 0; i < 3; i++) { n[i] /= length; axis[i] += n[i]; }
+			normals.push_back(n);
+		}
+		float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+		float minimumDot = 1.0f;
+		for (const auto& n : normals)
+			minimumDot = std::min(minimumDot, (n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2]) / std::max(axisLength, 1e-20f));
+		cluster.coneCutoff = 1.0f;
+		if (axisLength > 0.0f && minimumDot > 0.0f) { // a cone wider than a hemisphere always has a front facing triangle
+			for (uint32_t i = 0; i < 3; i++) cluster.coneAxis[i] = axis[i] / axisLength;
+			cluster.coneCutoff = std::sqrt(1.0f - minimumDot * minimumDot);
+		}
+		mesh.meshlets.push_back(cluster);
+	};
+
+	for (meshLod& lod : mesh.lods) {
+		lod.firstMeshlet = static_cast<uint32_t>(mesh.meshlets.size());
+		uint32_t meshletStart = lod.firstIndex;
+		clusterVertices.clear();
+		for (uint32_t t = lod.firstIndex; t < lod.firstIndex + lod.indexCount; t += 3) {
+			uint32_t newVertices = 0;
+			for (uint32_t c = 0; c < 3; c++)
+				newVertices += lastMeshlet[mesh.indices[t + c]] != mesh.meshlets.size() ? 1 : 0;
+			if (clusterVertices.size() + newVertices > maxMeshletVertices || (t - meshletStart) / 3 == maxMeshletTriangles) {
+				finishMeshlet(meshletStart, t - meshletStart);
+				meshletStart = t;
+				clusterVertices.clear();
+			}
+			for (uint32_t c = 0; c < 3; c++) {
+				uint32_t v = mesh.indices[t + c];
+				if (lastMeshlet[v] != mesh.meshlets.size()) {
+					lastMeshlet[v] = static_cast<uint32_t>(mesh.meshlets.size());
+					clusterVertices.push_back(v);
+				}
+			}
+		}
+		if (lod.firstIndex + lod.indexCount > meshletStart)
+			finishMeshlet(meshletStart, lod.firstIndex + lod.indexCount - meshletStart);
+		lod.meshletCount = static_cast<uint32_t>(mesh.meshlets.size()) - lod.firstMeshlet;
+	}
+}
+
+} // namespace
+
+meshData importMesh(const std::string& path, threadPool& pool) {
+	PROFILE_ZONE("importMesh");
+	auto start = importClock::now();
+	mappedFile file(path);
+
+	std::string extension = path.substr(path.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c){ return std::tolower(c); });
+	rawMesh mesh;
+	if (extension == "obj") mesh = loadObj(file, pool);
+	else if (extension == "gltf" || extension == "glb") mesh = loadGltf(path, file, pool);
+	else throw std::runtime_error("Unsupported mesh format: " + path);
+	if (mesh.normals.empty()) generateNormals(mesh);
+	double parseTime = millisecondsSince(start);
+
+	// quantize first, then dedup on the packed form - vertices that only differ below the quantization step merge too
+	auto stageStart = importClock::now();
+	meshData result;
+	result.bounds = computeBounds(mesh.positions, pool);
+	std::vector<packedVertex> quantized = quantize(mesh, result.bounds, pool);
+	double quantizeTime = millisecondsSince(stageStart);
+
+	stageStart = importClock::now();
+	std::vector<uint32_t> uniqueVertices;
+	std::vector<uint32_t> remap = deduplicate(quantized.data(), quantized.size(), quantized.size(),
+		[](const packedVertex& v) { uint64_t a, b; memcpy(&a, &v, 8); memcpy(&b, reinterpret_cast<const uint8_t*>(&v) + 8, 8); return mix64(a ^ mix64(b)); },
+		[](const packedVertex& a, const packedVertex& b) { return memcmp(&a, &b, sizeof(packedVertex)) == 0; },
+		uniqueVertices);
+	result.vertices.resize(uniqueVertices.size());
+	for (size_t v = 0; v < uniqueVertices.size(); v++) result.vertices[v] = quantized[uniqueVertices[v]];
+	result.indices = std::move(mesh.indices);
+	for (uint32_t& index : result.indices) index = remap[index];
+	result.sourceDependencies = std::move(mesh.dependencies);
+
+	// degenerate triangles can show up after quantization merges vertices - they'd never produce fragments anyway
+	size_t kept = 0;
+	for (size_t t = 0; t + 2 < result.indices.size(); t += 3) {
+		uint32_t a = result.indices[t], b = result.indices[t + 1], c = result.indices[t + 2];
+		if (a == b || b == c || a == c) continue;
+		result.indices[kept++] = a; result.indices[kept++] = b; result.indices[kept++] = c;
+	}
+	result.indices.resize(kept);
+	double dedupTime = millisecondsSince(stageStart);
+
+	stageStart = importClock::now();
+	float acmrBefore = averageCacheMissRatio(result.indices, result.vertices.size());
+	optimizeVertexCache(result.indices, result.vertices.size());
+	float acmrAfter = averageCacheMissRatio(result.indices, result.vertices.size());
+	double cacheTime = millisecondsSince(stageStart);
+
+	stageStart = importClock::now();
+	optimizeVertexFetch(result.vertices, result.indices);
+	double fetchTime = millisecondsSince(stageStart);
+
+	stageStart = importClock::now();
+	buildLods(result, maxMeshLods);
+	double lodTime = millisecondsSince(stageStart);
+
+	stageStart = importClock::now();
+	buildMeshlets(result);
+	double meshletTime = millisecondsSince(stageStart);
+
+	double totalTime = millisecondsSince(start);
+	size_t triangles = result.lods[0].indexCount / 3;
+	cout << "Imported " << path << ": " << triangles << " triangles, " << result.vertices.size() << " vertices in " << totalTime
+		<< " ms (" << triangles / (totalTime * 1000.0) << " M triangles/s on " << pool.size() << " threads)" << endl;
+	cout << "  map + parse " << parseTime << " ms, quantize " << quantizeTime << " ms, dedup " << dedupTime << " ms, vertex cache "
+		<< cacheTime << " ms (ACMR " << acmrBefore << " -> " << acmrAfter << "), vertex fetch " << fetchTime << " ms, "
+		<< result.lods.size() - 1 << " LODs " << lodTime << " ms, " << result.lods[0].meshletCount << " meshlets " << meshletTime << " ms" << endl;
+	return result;
+}
+
+meshData generateOverdrawMesh(uint32_t layerCount) {
+	rawMesh mesh;
+	const float corners[4][2] = {{-1.0f, -1.0f}, {1.0f, -1.0f}, {1.0f, 1.0f}, {-1.0f, 1.0f}};
+	for (uint32_t layer = 0; layer < layerCount; layer++) {
+		float distance = 2.0f + float(layerCount - layer); // back to front
+		// offset each layer a little so the edges are visible - size grows with distance, so each covers about the same area
+		float offset[2] = {0.15f * std::sin(layer * 1.7f), 0.15f * std::cos(layer * 2.3f)};
+		uint32_t base = static_cast<uint32_t>(mesh.vertexCount());
+		for (const auto& corner : corners) {
+			mesh.positions.insert(mesh.positions.end(), {(corner[0] * 1.2f + offset[0]) * distance, (corner[1] * 0.8f + offset[1]) * distance, -distance});
+			mesh.normals.insert(mesh.normals.end(), {0.0f, 0.0f, 1.0f});
+			mesh.uvs.insert(mesh.uvs.end(), {float(layer) / float(layerCount), 0.0f}); // u picks the layer's color
+		}
+		mesh.indices.insert(mesh.indices.end(), {base, base + 1, base + 2, base, base + 2, base + 3}); // counter-clockwise
+	}
+
+	threadPool serial(1); // too small to be worth spreading out
+	meshData result;
+	result.bounds = computeBounds(mesh.positions, serial);
+	result.vertices = quantize(mesh, result.bounds, serial);
+	result.indices = std::move(mesh.indices);
+	result.lods.assign(1, meshLod{0, static_cast<uint32_t>(result.indices.size()), 0.0f, 0, 0});
+	buildMeshlets(result);
+	return result;
+}
+
+meshView meshData::view() const {
+	return meshView{vertices.data(), vertices.size(), indices.data(), indices.size(), lods.data(), static_cast<uint32_t>(lods.size()),
+		meshlets.data(), meshlets.size(), bounds};
+}
+
+float averageCacheMissRatio(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize) {
+	if (indices.empty()) return 0.0f;
+	// a vertex is still in a FIFO cache if fewer than cacheSize vertices have been loaded since it was
+	std::vector<uint32_t> loadedAt(vertexCount, 0);
+	uint32_t clock = cacheSize + 1, misses = 0;
+	for (uint32_t index : indices)
+		if (clock - loadedAt[index] > cacheSize) {
+			loadedAt[index] = clock++;
+			misses++;
+		}
+	return float(misses) / float(indices.size() / 3);
+}
+
+uint16_t floatToHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t mantissa = bits & 0x7fffff;
+	int32_t exponent = int32_t((bits >> 23) & 0xff) - 127 + 15;
+
+	if (((bits >> 23) & 0xff) == 0xff) // inf, nan
+		return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	if (exponent >= 31) // too large, becomes inf
+		return static_cast<uint16_t>(sign | 0x7c00);
+	if (exponent <= 0) { // half subnormal, or too small and flushed to zero
+		if (exponent < -10) return static_cast<uint16_t>(sign);
+		mantissa |= 0x800000;
+		uint32_t shift = static_cast<uint32_t>(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		uint32_t roundBit = 1u << (shift - 1);
+		if ((mantissa & roundBit) && (mantissa & (3 * roundBit - 1))) half++; // round to nearest even
+		return static_cast<uint16_t>(sign | half);
+	}
+	uint32_t half = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+	if ((mantissa & 0x1000) && (mantissa & 0x2fff)) half++; // round to nearest even, carry into the exponent is correct
+	return static_cast<uint16_t>(half);
+}
+
+float halfToFloat(uint16_t value) {
+	uint32_t sign = uint32_t(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1f;
+	uint32_t mantissa = value & 0x3ff;
+	uint32_t bits;
+	if (exponent == 0) {
+		if (mantissa == 0) {
+			bits = sign;
+		} else { // subnormal - renormalize
+			uint32_t e = 113;
+			while (!(mantissa & 0x400)) { mantissa <<= 1; e--; }
+			bits = sign | (e << 23) | ((mantissa & 0x3ff) << 13);
+		}
+	} else if (exponent == 31) {
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	} else {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+	float result;
+	memcpy(&result, &bits, 4);
+	return result;
+}
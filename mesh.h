@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "threadPool.h"
+
+// GPU vertex format - 16 bytes, interleaved, fed to the pipeline as
+//   location 0: R16G16B16A16_SNORM position, relative to the mesh bounds (w is padding)
+//   location 1: R8G8B8A8_SNORM normal (w is padding)
+//   location 2: R16G16_SFLOAT texcoord
+struct packedVertex {
+	int16_t position[4];
+	int8_t normal[4];
+	uint16_t uv[2];
+};
+static_assert(sizeof(packedVertex) == 16, "packedVertex must stay tightly packed");
+
+// axis aligned bounds, also used to dequantize positions: position = center + snorm * extent
+struct meshBounds {
+	float center[3];
+	float extent[3];
+};
+
+// level of detail - a range of the shared index stream, drawn with the same vertex buffer. error is the size of the
+// simplification grid cell in mesh units, 0.0 for the full detail mesh at lods[0]. The LOD's indices are also split
+// into a range of meshlets
+struct meshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+};
+
+// meshlet limits - 64 vertices and 124 triangles keeps a cluster's vertices inside a typical post-transform cache
+constexpr uint32_t maxMeshletVertices = 64;
+constexpr uint32_t maxMeshletTriangles = 124;
+
+// cluster of triangles, a contiguous range of a LOD's indices with bounds for culling - matches shaders/cull.comp
+struct meshlet {
+	float center[3]; // bounding sphere, mesh space
+	float radius;
+	float coneAxis[3]; // normal cone - every triangle faces away from viewers inside the cone around -axis
+	float coneCutoff; // sin of the cone's half angle, 1.0 when the normals are too spread out to ever cull
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t padding[2];
+};
+static_assert(sizeof(meshlet) == 48, "meshlet must match the std430 layout in shaders/cull.comp");
+
+// maximum number of LODs generated on import, including the full detail mesh
+constexpr uint32_t maxMeshLods = 6;
+
+// non-owning view of mesh streams in GPU layout - points either into a meshData or into a mapped mesh cache
+struct meshView {
+	const packedVertex* vertices;
+	size_t vertexCount;
+	const uint32_t* indices;
+	size_t indexCount;
+	const meshLod* lods;
+	uint32_t lodCount;
+	const meshlet* meshlets;
+	size_t meshletCount;
+	meshBounds bounds;
+};
+
+// output of the import pipeline - deduplicated, cache optimized and quantized, ready to copy into buffers
+struct meshData {
+	std::vector<packedVertex> vertices;
+	std::vector<uint32_t> indices; // all LODs, back to back
+	std::vector<meshLod> lods;
+	std::vector<meshlet> meshlets; // all LODs, back to back
+	meshBounds bounds;
+	std::vector<std::string> sourceDependencies; // a .gltf's external buffers, relative to its directory - see meshCache
+	meshView view() const;
+};
+
+// memory maps and imports a .obj, .gltf (with external .bin buffers) or .glb file. Parsing and attribute conversion
+// are spread across the pool, and timings for each stage are reported to the console. Throws std::runtime_error
+meshData importMesh(const std::string& path, threadPool& pool);
+
+// procedural overdraw benchmark - layerCount screen covering quads stacked along -z in front of a camera at the
+// origin, ordered back to front so that without a depth pre-pass every layer gets shaded
+meshData generateOverdrawMesh(uint32_t layerCount);
+
+// average cache miss ratio (vertex shader invocations per triangle) of a FIFO post-transform cache of the given size
+float averageCacheMissRatio(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = 32);
+
+// float <-> half conversion, used for the texcoords
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t value);
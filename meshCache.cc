@@ -0,0 +1,276 @@
+#include "meshCache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+using std::cout, std::endl;
+
+namespace {
+
+// bump whenever the layout of anything below, or of packedVertex/meshLod/meshlet, changes - old caches are then rebuilt
+constexpr uint32_t meshCacheVersion = 3;
+constexpr char meshCacheMagic[4] = {'V', 'K', 'M', 'C'};
+constexpr uint64_t sectionAlignment = 64;
+
+// on-disk layout, little endian: header, section table, then each section's data at an aligned offset
+struct meshCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceSize;
+	int64_t sourceModified; // nanoseconds
+	uint64_t sourceHash;
+	meshBounds bounds;
+	uint32_t sectionCount;
+	uint32_t reserved;
+};
+
+enum meshCacheSectionType : uint32_t {
+	vertexSection = 1, // packedVertex[]
+	indexSection = 2, // uint32_t[], all LODs
+	lodSection = 3, // meshLod[]
+	meshletSection = 4, // meshlet[], all LODs
+	dependencySection = 5, // meshCacheDependency[], the source's external files
+	dependencyPathSection = 6, // char[], their paths back to back
+};
+
+struct meshCacheSection {
+	uint32_t type;
+	uint32_t elementSize; // checked against the running build, catches layout changes that missed a version bump
+	uint64_t offset;
+	uint64_t count;
+};
+
+// an external file the source refers to, like a .gltf's .bin buffers - the path is relative to the source's directory
+struct meshCacheDependency {
+	uint64_t size;
+	int64_t modified; // nanoseconds
+	uint64_t hash;
+	uint32_t pathOffset; // into the path section
+	uint32_t pathLength;
+};
+
+struct sourceInfo {
+	uint64_t size;
+	int64_t modified;
+};
+
+std::string directoryOf(const std::string& sourcePath) {
+	return sourcePath.substr(0, sourcePath.find_last_of('/') + 1);
+}
+
+bool statSource(const std::string& path, sourceInfo& info) {
+	struct stat sourceStat;
+	if (stat(path.c_str(), &sourceStat) != 0) return false;
+	info.size = static_cast<uint64_t>(sourceStat.st_size);
+	info.modified = static_cast<int64_t>(sourceStat.st_mtim.tv_sec) * 1000000000 + sourceStat.st_mtim.tv_nsec;
+	return true;
+}
+
+uint64_t hashFile(const std::string& path) {
+	mappedFile source(path);
+	return hashBytes(source.data(), source.size());
+}
+
+inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+} // namespace
+
+uint64_t hashBytes(const uint8_t* data, size_t size) {
+	// four independent multiply-rotate lanes over 32 byte blocks (the xxHash64 structure), then the tail a word at a time
+	constexpr uint64_t prime1 = 0x9e3779b185ebca87ull, prime2 = 0xc2b2ae3d27d4eb4full, prime3 = 0x165667b19e3779f9ull;
+	uint64_t lanes[4] = {prime1 + prime2, prime2, 0, 0 - prime1};
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32)
+		for (int lane = 0; lane < 4; lane++) {
+			uint64_t word;
+			memcpy(&word, data + i + lane * 8, 8);
+			lanes[lane] = rotl64(lanes[lane] + word * prime2, 31) * prime1;
+		}
+	uint64_t hash = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18) + size;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		hash = rotl64(hash ^ (rotl64(word * prime2, 31) * prime1), 27) * prime1 + prime3;
+	}
+	for (; i < size; i++)
+		hash = rotl64(hash ^ (data[i] * prime3), 11) * prime1;
+	hash ^= hash >> 33; hash *= prime2;
+	hash ^= hash >> 29; hash *= prime3;
+	return hash ^ (hash >> 32);
+}
+
+std::string meshCache::pathFor(const std::string& sourcePath) {
+	return sourcePath + ".meshcache";
+}
+
+bool meshCache::open(const std::string& sourcePath) {
+	sourceInfo source;
+	if (!statSource(sourcePath, source)) return false;
+	try {
+		file = mappedFile(pathFor(sourcePath));
+	} catch (const std::runtime_error&) {
+		return false; // no cache yet
+	}
+
+	meshCacheHeader header;
+	if (file.size() < sizeof(header)) return false;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, meshCacheMagic, 4) != 0 || header.version != meshCacheVersion || header.sourceSize != source.size)
+		return false;
+	// a new modification time alone (checkout, copy) doesn't invalidate the cache if the contents are the same - the
+	// new time is written back below, offset into the cache and value
+	std::vector<std::pair<uint64_t, int64_t>> newTimes;
+	if (header.sourceModified != source.modified) {
+		if (header.sourceHash != hashFile(sourcePath)) return false;
+		newTimes.push_back({offsetof(meshCacheHeader, sourceModified), source.modified});
+	}
+
+	// make sure every section is where it claims to be - the contents are trusted from here on
+	if (sizeof(header) + uint64_t(header.sectionCount) * sizeof(meshCacheSection) > file.size()) return false;
+	streams = meshView{};
+	streams.bounds = header.bounds;
+	const meshCacheDependency* dependencies = nullptr;
+	uint64_t dependencyCount = 0, dependenciesOffset = 0;
+	const char* dependencyPaths = nullptr;
+	uint64_t dependencyPathsSize = 0;
+	for (uint32_t i = 0; i < header.sectionCount; i++) {
+		meshCacheSection section;
+		memcpy(&section, file.data() + sizeof(header) + i * sizeof(section), sizeof(section));
+		if (section.offset % sectionAlignment != 0 || section.offset > file.size()
+			|| section.count > (file.size() - section.offset) / std::max(section.elementSize, 1u))
+			return false;
+		const uint8_t* sectionData = file.data() + section.offset;
+		switch (section.type) {
+			case vertexSection:
+				if (section.elementSize != sizeof(packedVertex)) return false;
+				streams.vertices = reinterpret_cast<const packedVertex*>(sectionData);
+				streams.vertexCount = section.count;
+				break;
+			case indexSection:
+				if (section.elementSize != sizeof(uint32_t)) return false;
+				streams.indices = reinterpret_cast<const uint32_t*>(sectionData);
+				streams.indexCount = section.count;
+				break;
+			case lodSection:
+				if (section.elementSize != sizeof(meshLod)) return false;
+				streams.lods = reinterpret_cast<const meshLod*>(sectionData);
+				streams.lodCount = static_cast<uint32_t>(section.count);
+				break;
+			case meshletSection:
+				if (section.elementSize != sizeof(meshlet)) return false;
+				streams.meshlets = reinterpret_cast<const meshlet*>(sectionData);
+				streams.meshletCount = section.count;
+				break;
+			case dependencySection:
+				if (section.elementSize != sizeof(meshCacheDependency)) return false;
+				dependencies = reinterpret_cast<const meshCacheDependency*>(sectionData);
+				dependencyCount = section.count;
+				dependenciesOffset = section.offset;
+				break;
+			case dependencyPathSection:
+				if (section.elementSize != 1) return false;
+				dependencyPaths = reinterpret_cast<const char*>(sectionData);
+				dependencyPathsSize = section.count;
+				break;
+			default: // sections this version doesn't know about are skipped
+				break;
+		}
+	}
+	if (streams.vertexCount == 0 || streams.indexCount == 0 || streams.lodCount == 0 || streams.meshletCount == 0) return false;
+	for (uint32_t i = 0; i < streams.lodCount; i++)
+		if (uint64_t(streams.lods[i].firstIndex) + streams.lods[i].indexCount > streams.indexCount
+			|| uint64_t(streams.lods[i].firstMeshlet) + streams.lods[i].meshletCount > streams.meshletCount)
+			return false;
+
+	// the external files, checked the same way as the source itself
+	const std::string directory = directoryOf(sourcePath);
+	for (uint64_t i = 0; i < dependencyCount; i++) {
+		meshCacheDependency dependency;
+		memcpy(&dependency, dependencies + i, sizeof(dependency));
+		if (dependencyPaths == nullptr || uint64_t(dependency.pathOffset) + dependency.pathLength > dependencyPathsSize) return false;
+		const std::string path = directory + std::string(dependencyPaths + dependency.pathOffset, dependency.pathLength);
+		sourceInfo current;
+		if (!statSource(path, current) || current.size != dependency.size) return false;
+		if (current.modified != dependency.modified) {
+			if (dependency.hash != hashFile(path)) return false;
+			newTimes.push_back({dependenciesOffset + i * sizeof(dependency) + offsetof(meshCacheDependency, modified), current.modified});
+		}
+	}
+
+	// a failure to update the times only means hashing again next time
+	if (!newTimes.empty()) {
+		std::fstream out(pathFor(sourcePath), std::ios::binary | std::ios::in | std::ios::out);
+		for (const auto& [offset, modified] : newTimes) {
+			out.seekp(static_cast<std::streamoff>(offset));
+			out.write(reinterpret_cast<const char*>(&modified), sizeof(modified));
+		}
+	}
+	return true;
+}
+
+void meshCache::write(const std::string& sourcePath, const meshData& mesh) {
+	sourceInfo source;
+	if (!statSource(sourcePath, source)) return;
+
+	meshCacheHeader header{};
+	memcpy(header.magic, meshCacheMagic, 4);
+	header.version = meshCacheVersion;
+	header.sourceSize = source.size;
+	header.sourceModified = source.modified;
+	header.sourceHash = hashFile(sourcePath);
+	header.bounds = mesh.bounds;
+
+	const std::string directory = directoryOf(sourcePath);
+	std::vector<meshCacheDependency> dependencies;
+	std::string dependencyPaths;
+	for (const std::string& path : mesh.sourceDependencies) {
+		sourceInfo dependency;
+		if (!statSource(directory + path, dependency)) return;
+		dependencies.push_back(meshCacheDependency{dependency.size, dependency.modified, hashFile(directory + path),
+			static_cast<uint32_t>(dependencyPaths.size()), static_cast<uint32_t>(path.size())});
+		dependencyPaths += path;
+	}
+
+	struct sectionSource { meshCacheSectionType type; uint32_t elementSize; const void* data; size_t count; };
+	const sectionSource sources[] = {
+		{vertexSection, sizeof(packedVertex), mesh.vertices.data(), mesh.vertices.size()},
+		{indexSection, sizeof(uint32_t), mesh.indices.data(), mesh.indices.size()},
+		{lodSection, sizeof(meshLod), mesh.lods.data(), mesh.lods.size()},
+		{meshletSection, sizeof(meshlet), mesh.meshlets.data(), mesh.meshlets.size()},
+		{dependencySection, sizeof(meshCacheDependency), dependencies.data(), dependencies.size()},
+		{dependencyPathSection, 1, dependencyPaths.data(), dependencyPaths.size()},
+	};
+	header.sectionCount = sizeof(sources) / sizeof(sources[0]);
+
+	std::vector<meshCacheSection> sections;
+	uint64_t offset = sizeof(header) + header.sectionCount * sizeof(meshCacheSection);
+	for (const sectionSource& s : sources) {
+		offset = (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+		sections.push_back(meshCacheSection{s.type, s.elementSize, offset, s.count});
+		offset += uint64_t(s.elementSize) * s.count;
+	}
+
+	// written to a temporary file and renamed into place, so a crash never leaves a truncated cache behind
+	std::string cachePath = pathFor(sourcePath);
+	std::string temporaryPath = cachePath + ".tmp";
+	std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(sections.data()), sections.size() * sizeof(meshCacheSection));
+	for (size_t i = 0; i < sections.size() && out; i++) {
+		static const char padding[sectionAlignment] = {};
+		out.write(padding, sections[i].offset - out.tellp());
+		out.write(static_cast<const char*>(sources[i].data), sources[i].elementSize * sources[i].count);
+	}
+	out.close();
+	if (!out || std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0) {
+		std::remove(temporaryPath.c_str());
+		cout << "Failed to write mesh cache " << cachePath << endl;
+		return;
+	}
+	cout << "Wrote mesh cache " << cachePath << " (" << offset / (1024.0 * 1024.0) << " MB)" << endl;
+}
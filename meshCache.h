@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+
+#include "mappedFile.h"
+#include "mesh.h"
+
+// baked mesh container, written next to the source file after an import - <source>.meshcache. It holds the streams
+// exactly as they are uploaded, so loading is a mapping and a copy per stream with no parsing or per-vertex work.
+// The header records the size, modification time and hash of the source file, and a section does the same for each
+// external buffer of a .gltf - the cache is rebuilt when any of them changes. A file that only has a new modification
+// time is hashed once, and the cache is updated with the new time so later runs don't hash it again
+class meshCache {
+public:
+	static std::string pathFor(const std::string& sourcePath);
+
+	// maps the cache for sourcePath, returns false if it is missing, stale, or from a different format version
+	bool open(const std::string& sourcePath);
+
+	// writes the cache for sourcePath - a failure to write is reported, but is not an error
+	static void write(const std::string& sourcePath, const meshData& mesh);
+
+	// valid for as long as this object is, pointing straight into the mapping
+	const meshView& view() const { return streams; }
+
+private:
+	mappedFile file;
+	meshView streams{};
+};
+
+// hash of a whole file's contents, used to detect changes to the source
+uint64_t hashBytes(const uint8_t* data, size_t size);
@@ -0,0 +1,249 @@
+#include "app.h"
+
+// ╔╦╗┌─┐┌─┐┬ ┬┬  ┌─┐┌┬┐  ╔═╗┬ ┬┬  ┬  ┬┌┐┌┌─┐
+// ║║║├┤ └─┐├─┤│  ├┤  │   ║  │ ││  │  │││││ ┬
+// ╩ ╩└─┘└─┘┴ ┴┴─┘└─┘ ┴   ╚═╝└─┘┴─┘┴─┘┴┘└┘└─┘
+// one compute invocation per meshlet and instance, see shaders/cull.comp
+
+void app::createCullPipeline() {
+	// the camera uniforms are shared with the graphics pipeline, the rest is culling specific
+	VkDescriptorSetLayoutBinding bindings[7]{};
+	for (uint32_t i = 0; i < 7; i++) { // then meshlets, draw commands, statistics, instance transforms, visibility bits
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	bindings[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER; // and the depth pyramid, for the late phase
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = nullptr;
+	layoutInfo.bindingCount = 7;
+	layoutInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, host.callbacks(), &cullDescriptorSetLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create culling descriptor set layout!");
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(cullPushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &cullDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, host.callbacks(), &cullPipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create culling pipeline layout!");
+
+	// the late phase of Hi-Z culling is the same shader built with LATE_PHASE, with the same layout
+	const char* shaderFiles[2] = {"shaders/cull.spv", "shaders/cullLate.spv"};
+	VkShaderModule shaderModules[2];
+	VkComputePipelineCreateInfo pipelineInfos[2]{};
+	for (uint32_t i = 0; i < 2; i++) {
+		shaderModules[i] = createShaderModule(readFile(shaderFiles[i]));
+		pipelineInfos[i].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfos[i].pNext = nullptr;
+		pipelineInfos[i].stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfos[i].stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfos[i].stage.module = shaderModules[i];
+		pipelineInfos[i].stage.pName = "main";
+		pipelineInfos[i].layout = cullPipelineLayout;
+	}
+	VkPipeline computePipelines[2];
+	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 2, pipelineInfos, host.callbacks(), computePipelines) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create culling pipelines!");
+	cullPipeline = computePipelines[0];
+	cullLatePipeline = computePipelines[1];
+	for (VkShaderModule shaderModule : shaderModules)
+		vkDestroyShaderModule(device, shaderModule, host.callbacks());
+
+	// outlives the swapchain, so what was visible carries over a resize - starts out with nothing visible, which the
+	// late phase of the first frame makes up for
+	std::vector<uint32_t> visibility(std::max((uint64_t(meshletTotal) * instanceCount + 31) / 32, uint64_t(1)), 0);
+	uploadBuffer(visibility.data(), sizeof(uint32_t) * visibility.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, visibilityBuffer, visibilityBufferMemory);
+}
+
+void app::createCullResources() {
+	const size_t imageCount = swapchainImages.size();
+	uint32_t maxMeshlets = 0; // the indirect buffers have to fit every instance of the LOD with the most meshlets
+	for (const meshLod& lod : lods)
+		maxMeshlets = std::max(maxMeshlets, lod.meshletCount);
+	// the late phase of Hi-Z culling appends its draws after the early phase's
+	const VkDeviceSize indirectSize = sizeof(VkDrawIndexedIndirectCommand) * std::max(maxMeshlets, 1u) * instanceCount * (hiZActive ? 2 : 1);
+	const VkDeviceSize statisticsSize = 5 * sizeof(uint32_t);
+
+	indirectBuffers.resize(imageCount);
+	indirectBuffersMemory.resize(imageCount);
+	cullStatisticsBuffers.resize(imageCount);
+	cullStatisticsBuffersMemory.resize(imageCount);
+	cullStatisticsMapped.resize(imageCount);
+	cullStatisticsPending.assign(imageCount, false);
+	for (size_t i = 0; i < imageCount; i++) {
+		createBuffer(indirectSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirectBuffers[i], indirectBuffersMemory[i], host.swapchainCallbacks());
+		// doubles as the count buffer for vkCmdDrawIndexedIndirectCount, and is read back for the frame time report
+		createBuffer(statisticsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cullStatisticsBuffers[i], cullStatisticsBuffersMemory[i], host.swapchainCallbacks());
+		vkMapMemory(device, cullStatisticsBuffersMemory[i], 0, statisticsSize, 0, &cullStatisticsMapped[i]);
+	}
+
+	VkDescriptorPoolSize poolSizes[3]{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = static_cast<uint32_t>(imageCount);
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = static_cast<uint32_t>(imageCount * 5);
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[2].descriptorCount = static_cast<uint32_t>(imageCount);
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+	poolInfo.poolSizeCount = 3;
+	poolInfo.pPoolSizes = poolSizes;
+	poolInfo.maxSets = static_cast<uint32_t>(imageCount);
+	if (vkCreateDescriptorPool(device, &poolInfo, host.swapchainCallbacks(), &cullDescriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create culling descriptor pool!");
+
+	std::vector<VkDescriptorSetLayout> layouts(imageCount, cullDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = cullDescriptorPool;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(imageCount);
+	allocInfo.pSetLayouts = layouts.data();
+	cullDescriptorSets.resize(imageCount);
+	if (vkAllocateDescriptorSets(device, &allocInfo, cullDescriptorSets.data()) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate culling descriptor sets!");
+
+	// the pyramid is only there with Hi-Z culling, and only the late phase reads it
+	const VkDescriptorImageInfo pyramidInfo{hiZSampler, pyramidImage != VK_NULL_HANDLE ? pyramidView : VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL};
+	for (size_t i = 0; i < imageCount; i++) {
+		VkDescriptorBufferInfo bufferInfos[6]{};
+		bufferInfos[0] = {uniformBuffers[i], 0, sizeof(cameraUniforms)};
+		bufferInfos[1] = {meshletBuffer, 0, VK_WHOLE_SIZE};
+		bufferInfos[2] = {indirectBuffers[i], 0, VK_WHOLE_SIZE};
+		bufferInfos[3] = {cullStatisticsBuffers[i], 0, VK_WHOLE_SIZE};
+		bufferInfos[4] = {instanceBuffers[i], 0, VK_WHOLE_SIZE};
+		bufferInfos[5] = {visibilityBuffer, 0, VK_WHOLE_SIZE};
+
+		VkWriteDescriptorSet descriptorWrites[7]{};
+		for (uint32_t b = 0; b < 7; b++) {
+			descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[b].dstSet = cullDescriptorSets[i];
+			descriptorWrites[b].dstBinding = b;
+			descriptorWrites[b].dstArrayElement = 0;
+			descriptorWrites[b].descriptorType = b == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[b].descriptorCount = 1;
+			if (b < 6) descriptorWrites[b].pBufferInfo = &bufferInfos[b];
+		}
+		descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[6].pImageInfo = &pyramidInfo;
+		vkUpdateDescriptorSets(device, pyramidImage != VK_NULL_HANDLE ? 7 : 6, descriptorWrites, 0, nullptr);
+	}
+}
+
+void app::cleanupCullResources() {
+	for (size_t i = 0; i < indirectBuffers.size(); i++) {
+		deletions.destroy(indirectBuffers[i], host.swapchainCallbacks());
+		deletions.destroy(indirectBuffersMemory[i], host.swapchainCallbacks());
+		deletions.destroy(cullStatisticsBuffers[i], host.swapchainCallbacks());
+		deletions.destroy(cullStatisticsBuffersMemory[i], host.swapchainCallbacks()); // implicitly unmapped
+	}
+	deletions.destroy(cullDescriptorPool, host.swapchainCallbacks());
+}
+
+cullPushConstants app::cullParameters() const {
+	const meshLod& lod = lods[drawnLod];
+	return cullPushConstants{lod.firstMeshlet, lod.meshletCount, lod.firstIndex, twoPhaseCulling() ? 1u : 0u, meshletTotal, instanceCount};
+}
+
+// groups along x before wrapping into y - matches groupsX in shaders/cull.comp, and stays well under the 65535 every
+// device supports. Each instance gets a run of groups, 64 meshlets to a group
+static constexpr uint32_t cullGroupsX = 32768;
+
+void app::dispatchMeshletCulling(VkCommandBuffer commandBuffer) const {
+	const uint32_t groups = (lods[drawnLod].meshletCount + 63) / 64 * instanceCount;
+	vkCmdDispatch(commandBuffer, std::min(groups, cullGroupsX), (groups + cullGroupsX - 1) / cullGroupsX, 1);
+}
+
+void app::recordMeshletCulling(VkCommandBuffer commandBuffer, size_t imageIndex) {
+	if (!meshletCulling) return;
+
+	// reset the counters - without the count buffer every slot gets drawn, so the commands for culled meshlets need to
+	// be zero as well, which turns them into empty draws
+	vkCmdFillBuffer(commandBuffer, cullStatisticsBuffers[imageIndex], 0, VK_WHOLE_SIZE, 0);
+	if (!drawIndirectCountSupported)
+		vkCmdFillBuffer(commandBuffer, indirectBuffers[imageIndex], 0, VK_WHOLE_SIZE, 0);
+
+	// and the visibility bits read here were written by the previous frame's late phase
+	VkMemoryBarrier clearBarrier{};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+	cullPushConstants pushConstants = cullParameters();
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptorSets[imageIndex], 0, nullptr);
+	vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+	dispatchMeshletCulling(commandBuffer);
+
+	// draws consume the commands, and the host reads the statistics once the frame's fence has signaled
+	VkMemoryBarrier cullBarrier{};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+}
+
+void app::recordMeshDraw(VkCommandBuffer commandBuffer, size_t imageIndex, bool late) {
+	const meshLod& lod = lods[drawnLod];
+	if (cpuCulling) {
+		// instances that survived culling on the CPU this frame - runs of consecutive ones share a draw
+		for (size_t i = 0; i < visibleInstances.size();) {
+			uint32_t run = 1;
+			while (i + run < visibleInstances.size() && visibleInstances[i + run] == visibleInstances[i] + run) run++;
+			vkCmdDrawIndexed(commandBuffer, lod.indexCount, run, 0, 0, visibleInstances[i]);
+			i += run;
+		}
+		return;
+	}
+	// the late phase's commands follow every slot the early phase could have used, and its count is the third statistic
+	const uint32_t maxDraws = lod.meshletCount * instanceCount;
+	const VkDeviceSize commandOffset = late ? sizeof(VkDrawIndexedIndirectCommand) * maxDraws : 0;
+	const VkDeviceSize countOffset = late ? 2 * sizeof(uint32_t) : 0;
+	if (!meshletCulling)
+		vkCmdDrawIndexed(commandBuffer, lod.indexCount, instanceCount, 0, 0, 0);
+	else if (drawIndirectCountSupported)
+		vkCmdDrawIndexedIndirectCount(commandBuffer, indirectBuffers[imageIndex], commandOffset, cullStatisticsBuffers[imageIndex], countOffset, maxDraws,
+			sizeof(VkDrawIndexedIndirectCommand));
+	else
+		vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffers[imageIndex], commandOffset, maxDraws, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void app::readCullStatistics(uint32_t imageIndex) {
+	// like the pipeline statistics query, only valid once the command buffer's last submission has completed
+	if (!cullStatisticsPending[imageIndex]) return;
+	const uint32_t* statistics = static_cast<const uint32_t*>(cullStatisticsMapped[imageIndex]);
+	visibleMeshletAccumulator += statistics[0] + statistics[2];
+	visibleTriangleAccumulator += statistics[1];
+	lateMeshletAccumulator += statistics[2];
+	occludedMeshletAccumulator += statistics[3];
+	testedMeshletAccumulator += statistics[4];
+	cullStatisticsSamples++;
+	cullStatisticsPending[imageIndex] = false;
+}
+
+void app::toggleMeshletCulling() {
+	if (!multiDrawIndirectSupported) {
+		cout << "Meshlet culling needs the multiDrawIndirect and drawIndirectFirstInstance features, which this device does not support" << endl;
+		return;
+	}
+	meshletCulling = !meshletCulling;
+	if (meshletCulling) cpuCulling = false;
+	resetFrameTime(); // the chunks it changes are rerecorded as each image comes up, see chunkKey
+}
@@ -0,0 +1,335 @@
+#include "app.h"
+
+// ╔═╗┌─┐┬─┐┌┬┐┬┌─┐┬  ┌─┐┌─┐
+// ╠═╝├─┤├┬┘ │ ││  │  ├┤ └─┐
+// ╩  ┴ ┴┴└─ ┴ ┴└─┘┴─┘└─┘└─┘
+// compute simulated particles, see shaders/particles.comp - drawn through the pipeline manager, see pipelines.cc
+
+// groups along x before wrapping into y - matches groupsX in shaders/particles.comp, and stays well under the 65535
+// every device supports
+static constexpr uint32_t particleGroupsX = 32768;
+static constexpr uint32_t particleGroupSize = 128;
+
+static void dispatchParticles(VkCommandBuffer commandBuffer, uint32_t count) {
+	const uint32_t groups = (count + particleGroupSize - 1) / particleGroupSize;
+	vkCmdDispatch(commandBuffer, std::min(groups, particleGroupsX), (groups + particleGroupsX - 1) / particleGroupsX, 1);
+}
+
+void app::createParticlePipeline() {
+	// previous particles, this step's particles, previous counters, this step's counters
+	VkDescriptorSetLayoutBinding bindings[4]{};
+	for (uint32_t i = 0; i < 4; i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = nullptr;
+	layoutInfo.bindingCount = 4;
+	layoutInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, host.callbacks(), &particleDescriptorSetLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create particle descriptor set layout!");
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(particlePushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &particleDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, host.callbacks(), &particlePipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create particle pipeline layout!");
+
+	auto particleShaderCode = readFile("shaders/particles.spv");
+	VkShaderModule particleShaderModule = createShaderModule(particleShaderCode);
+
+	// one pipeline per stage, picked by constant_id 0
+	VkSpecializationMapEntry mapEntry{0, 0, sizeof(uint32_t)};
+	uint32_t stages[3] = {0, 1, 2};
+	VkSpecializationInfo specializationInfo[3]{};
+	VkComputePipelineCreateInfo pipelineInfos[3]{};
+	for (uint32_t i = 0; i < 3; i++) {
+		specializationInfo[i].mapEntryCount = 1;
+		specializationInfo[i].pMapEntries = &mapEntry;
+		specializationInfo[i].dataSize = sizeof(uint32_t);
+		specializationInfo[i].pData = &stages[i];
+		pipelineInfos[i].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfos[i].pNext = nullptr;
+		pipelineInfos[i].stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfos[i].stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfos[i].stage.module = particleShaderModule;
+		pipelineInfos[i].stage.pName = "main";
+		pipelineInfos[i].stage.pSpecializationInfo = &specializationInfo[i];
+		pipelineInfos[i].layout = particlePipelineLayout;
+	}
+	VkPipeline computePipelines[3];
+	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 3, pipelineInfos, host.callbacks(), computePipelines) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create particle pipelines!");
+	particleSimulatePipeline = computePipelines[0];
+	particleEmitPipeline = computePipelines[1];
+	particleFinalizePipeline = computePipelines[2];
+	vkDestroyShaderModule(device, particleShaderModule, host.callbacks());
+}
+
+void app::createParticleBuffers(uint32_t capacity) {
+	// outlives the swapchain, so the simulation carries on through rebuilds
+	const VkDeviceSize particleSize = sizeof(particle) * VkDeviceSize(capacity);
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		createBuffer(particleSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			particleBuffers[i], particleBuffersMemory[i], host.callbacks());
+		// read back for the frame time report, like the culling statistics - starts out with nothing alive
+		createBuffer(sizeof(particleCounters), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, particleCounterBuffers[i], particleCounterBuffersMemory[i], host.callbacks());
+		vkMapMemory(device, particleCounterBuffersMemory[i], 0, sizeof(particleCounters), 0, &particleCountersMapped[i]);
+		memset(particleCountersMapped[i], 0, sizeof(particleCounters));
+		particleStatisticsPending[i] = false;
+	}
+	particleParameters.capacity = capacity;
+
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = 4 * MAX_FRAMES_IN_FLIGHT;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+	if (vkCreateDescriptorPool(device, &poolInfo, host.callbacks(), &particleDescriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create particle descriptor pool!");
+
+	VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
+	std::fill(layouts, layouts + MAX_FRAMES_IN_FLIGHT, particleDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = particleDescriptorPool;
+	allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+	allocInfo.pSetLayouts = layouts;
+	if (vkAllocateDescriptorSets(device, &allocInfo, particleDescriptorSets) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate particle descriptor sets!");
+
+	// each frame in flight steps from the one before it - frames are submitted in order, so that's the last step
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		const uint32_t previous = (i + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+		VkDescriptorBufferInfo bufferInfos[4]{};
+		bufferInfos[0] = {particleBuffers[previous], 0, VK_WHOLE_SIZE};
+		bufferInfos[1] = {particleBuffers[i], 0, VK_WHOLE_SIZE};
+		bufferInfos[2] = {particleCounterBuffers[previous], 0, VK_WHOLE_SIZE};
+		bufferInfos[3] = {particleCounterBuffers[i], 0, VK_WHOLE_SIZE};
+
+		VkWriteDescriptorSet descriptorWrites[4]{};
+		for (uint32_t b = 0; b < 4; b++) {
+			descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[b].dstSet = particleDescriptorSets[i];
+			descriptorWrites[b].dstBinding = b;
+			descriptorWrites[b].dstArrayElement = 0;
+			descriptorWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[b].descriptorCount = 1;
+			descriptorWrites[b].pBufferInfo = &bufferInfos[b];
+		}
+		vkUpdateDescriptorSets(device, 4, descriptorWrites, 0, nullptr);
+	}
+}
+
+void app::cleanupParticleBuffers() {
+	// only called once the device is idle
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		vkDestroyBuffer(device, particleBuffers[i], host.callbacks());
+		vkFreeMemory(device, particleBuffersMemory[i], host.callbacks());
+		vkDestroyBuffer(device, particleCounterBuffers[i], host.callbacks());
+		vkFreeMemory(device, particleCounterBuffersMemory[i], host.callbacks()); // implicitly unmapped
+	}
+	vkDestroyDescriptorPool(device, particleDescriptorPool, host.callbacks());
+}
+
+void app::writeParticleDrawDescriptorSets() {
+	// the graphics set layout, with this image's camera at binding 0 and a frame's particles at 4 in place of the instances
+	const size_t imageCount = swapchainImages.size();
+	std::vector<VkDescriptorSetLayout> layouts(imageCount * MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+	allocInfo.pSetLayouts = layouts.data();
+	particleDrawDescriptorSets.resize(layouts.size());
+	if (vkAllocateDescriptorSets(device, &allocInfo, particleDrawDescriptorSets.data()) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate particle draw descriptor sets!");
+
+	for (size_t i = 0; i < imageCount; i++)
+		for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+			VkDescriptorBufferInfo bufferInfos[2]{};
+			bufferInfos[0] = {uniformBuffers[i], 0, sizeof(cameraUniforms)};
+			bufferInfos[1] = {particleBuffers[frame], 0, VK_WHOLE_SIZE};
+
+			VkWriteDescriptorSet descriptorWrites[2]{};
+			for (uint32_t b = 0; b < 2; b++) {
+				descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				descriptorWrites[b].dstSet = particleDrawDescriptorSets[i * MAX_FRAMES_IN_FLIGHT + frame];
+				descriptorWrites[b].dstBinding = b == 0 ? 0 : 4;
+				descriptorWrites[b].dstArrayElement = 0;
+				descriptorWrites[b].descriptorType = b == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				descriptorWrites[b].descriptorCount = 1;
+				descriptorWrites[b].pBufferInfo = &bufferInfos[b];
+			}
+			vkUpdateDescriptorSets(device, 2, descriptorWrites, 0, nullptr);
+		}
+}
+
+void app::updateParticles() {
+	// scaled to the mesh, so the fountain looks the same whatever units it's in - launched from just above the bounding
+	// sphere, rising about one mesh radius before falling back onto it and rolling off onto the ground below
+	const float meshRadius = glm::length(glm::vec3(bounds.extent[0], bounds.extent[1], bounds.extent[2]));
+	auto now = std::chrono::steady_clock::now();
+	const float deltaTime = std::min(std::chrono::duration<float>(now - lastParticleTime).count(), 0.05f);
+	lastParticleTime = now;
+
+	// capacity / lifetime per second - the average particle lives for 75% of the lifetime, so the buffer stays 75% full
+	particleEmitAccumulator += deltaTime * particleParameters.capacity / particleLifetime;
+	const uint32_t emitCount = static_cast<uint32_t>(particleEmitAccumulator);
+	particleEmitAccumulator -= emitCount;
+
+	particleParameters.emitter = glm::vec4(sceneCenter + glm::vec3(0.0f, 1.1f * meshRadius, 0.0f), 2.0f * meshRadius);
+	particleParameters.collider = glm::vec4(sceneCenter, meshRadius);
+	particleParameters.groundHeight = sceneCenter.y - meshRadius;
+	particleParameters.deltaTime = deltaTime;
+	particleParameters.lifetime = particleLifetime;
+	particleParameters.gravity = 2.0f * meshRadius;
+	particleParameters.emitCount = emitCount;
+	particleParameters.seed++;
+	particleEmittedAccumulator += emitCount;
+}
+
+void app::recordParticleSimulation(VkCommandBuffer commandBuffer, uint32_t frame, const particlePushConstants& parameters) {
+	// this frame's counters were last used by the frame that had this fence, which has been waited on - only the previous
+	// frame's step has to be finished, its render pass can keep running alongside this one
+	vkCmdFillBuffer(commandBuffer, particleCounterBuffers[frame], offsetof(particleCounters, appended), sizeof(uint32_t), 0);
+	VkMemoryBarrier stepBarrier{};
+	stepBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	stepBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	stepBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &stepBarrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particlePipelineLayout, 0, 1, &particleDescriptorSets[frame], 0, nullptr);
+	vkCmdPushConstants(commandBuffer, particlePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(parameters), &parameters);
+
+	// sized by the previous step's finalize, over the particles it left alive
+	const uint32_t previous = (frame + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleSimulatePipeline);
+	vkCmdDispatchIndirect(commandBuffer, particleCounterBuffers[previous], offsetof(particleCounters, simulate));
+
+	// emission appends after the survivors, and the finalize reads the total
+	VkMemoryBarrier appendBarrier{};
+	appendBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	appendBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	appendBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	if (parameters.emitCount > 0) {
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &appendBarrier, 0, nullptr, 0, nullptr);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleEmitPipeline);
+		dispatchParticles(commandBuffer, parameters.emitCount);
+	}
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &appendBarrier, 0, nullptr, 0, nullptr);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleFinalizePipeline);
+	vkCmdDispatch(commandBuffer, 1, 1, 1);
+
+	// the draw reads the particles and its arguments, and the host reads the counters once the frame's fence has signaled
+	VkMemoryBarrier drawBarrier{};
+	drawBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	drawBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	drawBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+		0, 1, &drawBarrier, 0, nullptr, 0, nullptr);
+}
+
+void app::recordParticleDraw(VkCommandBuffer commandBuffer, size_t imageIndex) {
+	if (!particles) return;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, particlePipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1,
+		&particleDrawDescriptorSets[imageIndex * MAX_FRAMES_IN_FLIGHT + currentFrame], 0, nullptr);
+	vkCmdDrawIndirect(commandBuffer, particleCounterBuffers[currentFrame], offsetof(particleCounters, draw), 1, sizeof(VkDrawIndirectCommand));
+}
+
+void app::readParticleStatistics() {
+	// the counters of this frame in flight, from its last submission - done once its fence has been waited on
+	if (!particleStatisticsPending[currentFrame]) return;
+	const particleCounters* counters = static_cast<const particleCounters*>(particleCountersMapped[currentFrame]);
+	particleAliveAccumulator += counters->draw.instanceCount;
+	particleSamples++;
+	particleStatisticsPending[currentFrame] = false;
+}
+
+void app::runParticleBenchmark() {
+	// simulation steps only, no drawing - each size is filled to capacity in one step with particles that outlive the
+	// benchmark, then a batch of steps is run once untimed and once timed, in a single submission each
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate command buffers!");
+
+	uint32_t step = 0; // continues across submissions, so each one picks up from the frame the last one ended on
+	auto submit = [&](uint32_t steps, uint32_t emitCount) {
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		for (uint32_t i = 0; i < steps; i++, step++) {
+			particleParameters.emitCount = emitCount;
+			particleParameters.seed++;
+			recordParticleSimulation(commandBuffer, step % MAX_FRAMES_IN_FLIGHT, particleParameters);
+		}
+		vkEndCommandBuffer(commandBuffer);
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		auto start = std::chrono::steady_clock::now();
+		vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+		vkQueueWaitIdle(graphicsQueue);
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	vkDeviceWaitIdle(device);
+	cleanupParticleBuffers();
+	for (uint32_t capacity : {10000u, 100000u, 1000000u, 10000000u}) {
+		if (sizeof(particle) * uint64_t(capacity) > deviceProperties.limits.maxStorageBufferRange) {
+			cout << capacity << " particles: skipped, over the device's maxStorageBufferRange of " << deviceProperties.limits.maxStorageBufferRange << " bytes" << endl;
+			continue;
+		}
+		createParticleBuffers(capacity);
+		updateParticles(); // the regular fountain, with a fixed time step and particles that don't die
+		particleParameters.deltaTime = 1.0f / 60.0f;
+		particleParameters.lifetime = 1e9f;
+
+		// the fill steps from the zeroed counters of the last frame, with nothing alive yet
+		step = 0;
+		submit(1, capacity);
+		submit(particleBenchmarkSteps, 0);
+		const double milliseconds = submit(particleBenchmarkSteps, 0) / particleBenchmarkSteps;
+		const uint32_t alive = static_cast<const particleCounters*>(particleCountersMapped[(step - 1) % MAX_FRAMES_IN_FLIGHT])->draw.instanceCount;
+		cout << capacity << " particles (" << alive << " alive): " << milliseconds << " ms/step, " << alive / milliseconds << " particles/ms" << endl;
+		cleanupParticleBuffers();
+	}
+	createParticleBuffers(particleCapacity); // for cleanup
+	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+}
+
+void app::toggleParticles() {
+	particles = !particles;
+	lastParticleTime = std::chrono::steady_clock::now();
+	resetFrameTime(); // the particle chunks are recorded, or left out, as each image comes up
+}
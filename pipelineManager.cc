@@ -0,0 +1,299 @@
+#include "pipelineManager.h"
+#include "profiler.h"
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+static_assert(sizeof(pipelineState) == 14 * sizeof(uint32_t), "pipelineState is hashed bytewise and must not have padding");
+
+// FNV-1a over the raw bytes of the description
+static uint64_t hashState(const pipelineState& state) {
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&state);
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < sizeof(state); i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+void pipelineManager::init(VkDevice device, const VkAllocationCallbacks* allocator, VkPipelineLayout layout, const VkVertexInputBindingDescription& binding,
+	const VkVertexInputAttributeDescription* attributes, uint32_t attributeCount, const std::vector<char>& cacheData) {
+	this->device = device;
+	this->allocator = allocator;
+	this->layout = layout;
+	this->binding = binding;
+	this->attributes.assign(attributes, attributes + attributeCount);
+
+	// the driver checks the header of the initial data itself, and starts out empty if it came from another device or driver
+	VkPipelineCacheCreateInfo cacheInfo{};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.pNext = nullptr;
+	cacheInfo.initialDataSize = cacheData.size();
+	cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+	if (vkCreatePipelineCache(device, &cacheInfo, allocator, &cache) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create pipeline cache!");
+}
+
+void pipelineManager::cleanup() {
+	for (entry& variant : variants)
+		if (variant.pipeline != VK_NULL_HANDLE)
+			vkDestroyPipeline(device, variant.pipeline, allocator);
+	for (VkShaderModule shader : shaders)
+		vkDestroyShaderModule(device, shader, allocator);
+	vkDestroyPipelineCache(device, cache, allocator);
+	variants.clear();
+	lookup.clear();
+	shaders.clear();
+	renderPasses.clear();
+	statistics = pipelineManagerStats{};
+}
+
+uint32_t pipelineManager::addShader(const std::vector<char>& code) {
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.pNext = nullptr;
+	createInfo.codeSize = code.size();
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+	VkShaderModule shaderModule;
+	if (vkCreateShaderModule(device, &createInfo, allocator, &shaderModule) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create shader module!");
+	shaders.push_back(shaderModule);
+	return static_cast<uint32_t>(shaders.size() - 1);
+}
+
+void pipelineManager::setRenderPass(uint32_t renderPassKey, VkRenderPass renderPass) {
+	std::lock_guard<std::mutex> lock(mutex);
+	renderPasses[renderPassKey] = renderPass;
+}
+
+pipelineManager::entry* pipelineManager::find(const pipelineState& state, bool insert) {
+	const uint64_t hash = hashState(state);
+	auto range = lookup.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+		if (memcmp(&it->second->state, &state, sizeof(state)) == 0)
+			return it->second;
+	if (!insert) return nullptr;
+	variants.emplace_back();
+	variants.back().state = state;
+	lookup.emplace(hash, &variants.back());
+	return &variants.back();
+}
+
+VkPipeline pipelineManager::get(const pipelineState& state) {
+	entry* variant;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		statistics.requests++;
+		variant = find(state, false);
+		if (variant) statistics.deduplicated++;
+		else variant = find(state, true);
+	}
+	compile(*variant);
+	waitFor(*variant);
+	return variant->pipeline;
+}
+
+void pipelineManager::warmUp(const std::vector<pipelineState>& states, threadPool& pool) {
+	PROFILE_ZONE("pipelineManager::warmUp");
+	// variants without specialization go first, so the rest can derive from them
+	std::vector<entry*> bases, derivatives;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const pipelineState& state : states) {
+			statistics.requests++;
+			entry* variant = find(state, false);
+			if (variant) {
+				statistics.deduplicated++;
+				continue;
+			}
+			variant = find(state, true);
+			bool specialized = false;
+			for (uint32_t value : state.specialization)
+				specialized = specialized || value != 0;
+			(specialized ? derivatives : bases).push_back(variant);
+		}
+	}
+
+	// one pipeline per job - compile times vary a lot between variants, so there's nothing to gain from batching
+	for (std::vector<entry*>* wave : {&bases, &derivatives}) {
+		pool.parallelFor(wave->size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				compile(*(*wave)[i]);
+		});
+		for (entry* variant : *wave)
+			waitFor(*variant);
+	}
+}
+
+void pipelineManager::compile(entry& variant) {
+	int expected = queued;
+	if (!variant.status.compare_exchange_strong(expected, compiling)) return;
+	PROFILE_ZONE("compile pipeline");
+	auto start = std::chrono::steady_clock::now();
+	const pipelineState& state = variant.state;
+
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+	VkPipeline basePipeline = VK_NULL_HANDLE;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto pass = renderPasses.find(state.renderPassKey);
+		if (pass != renderPasses.end()) renderPass = pass->second;
+
+		pipelineState baseState = state;
+		memset(baseState.specialization, 0, sizeof(baseState.specialization));
+		if (memcmp(&baseState, &state, sizeof(state)) != 0) {
+			entry* base = find(baseState, false);
+			if (base && base->status.load() == ready) basePipeline = base->pipeline;
+		}
+	}
+
+	// constant_id i is the i-th value of the state
+	VkSpecializationMapEntry mapEntries[4];
+	for (uint32_t i = 0; i < 4; i++) {
+		mapEntries[i].constantID = i;
+		mapEntries[i].offset = i * sizeof(uint32_t);
+		mapEntries[i].size = sizeof(uint32_t);
+	}
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = 4;
+	specializationInfo.pMapEntries = mapEntries;
+	specializationInfo.dataSize = sizeof(state.specialization);
+	specializationInfo.pData = state.specialization;
+
+	VkPipelineShaderStageCreateInfo stages[2]{};
+	stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[0].pNext = nullptr;
+	stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	stages[0].module = shaders[state.vertexShader];
+	stages[0].pName = "main";
+	stages[0].pSpecializationInfo = &specializationInfo;
+	stages[1] = stages[0];
+	stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	const bool depthOnly = state.fragmentShader == noShader;
+	if (!depthOnly) stages[1].module = shaders[state.fragmentShader];
+
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputInfo.vertexBindingDescriptionCount = 1;
+	vertexInputInfo.pVertexBindingDescriptions = &binding;
+	vertexInputInfo.vertexAttributeDescriptionCount = state.vertexAttributeCount;
+	vertexInputInfo.pVertexAttributeDescriptions = attributes.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	// viewport and scissor are dynamic, so variants outlive the swapchain extent they were first used with
+	VkPipelineViewportStateCreateInfo viewportState{};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+	VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+	VkPipelineDynamicStateCreateInfo dynamicState{};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
+
+	VkPipelineRasterizationStateCreateInfo rasterizer{};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.depthClampEnable = VK_FALSE;
+	rasterizer.rasterizerDiscardEnable = VK_FALSE;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = state.cullMode;
+	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterizer.depthBiasEnable = VK_FALSE;
+
+	VkPipelineMultisampleStateCreateInfo multisampling{};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.sampleShadingEnable = VK_FALSE;
+	multisampling.rasterizationSamples = state.samples;
+	multisampling.minSampleShading = 1.0f;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencil{};
+	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.depthTestEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = state.depthWrite;
+	depthStencil.depthCompareOp = state.depthCompare;
+	depthStencil.depthBoundsTestEnable = VK_FALSE;
+	depthStencil.stencilTestEnable = VK_FALSE;
+
+	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	colorBlendAttachment.blendEnable = state.blend;
+	colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+	colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	VkPipelineColorBlendStateCreateInfo colorBlending{};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.attachmentCount = depthOnly ? 0 : 1;
+	colorBlending.pAttachments = &colorBlendAttachment;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT | (basePipeline != VK_NULL_HANDLE ? VK_PIPELINE_CREATE_DERIVATIVE_BIT : 0);
+	pipelineInfo.stageCount = depthOnly ? 1 : 2;
+	pipelineInfo.pStages = stages;
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterizer;
+	pipelineInfo.pMultisampleState = &multisampling;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = layout;
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = state.subpass;
+	pipelineInfo.basePipelineHandle = basePipeline;
+	pipelineInfo.basePipelineIndex = -1;
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	const bool created = renderPass != VK_NULL_HANDLE &&
+		vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, allocator, &pipeline) == VK_SUCCESS;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		variant.pipeline = pipeline;
+		variant.status.store(created ? ready : failed);
+		if (created) {
+			statistics.compiled++;
+			if (basePipeline != VK_NULL_HANDLE) statistics.derived++;
+		}
+		statistics.compileMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+	compiled.notify_all();
+}
+
+void pipelineManager::waitFor(entry& variant) {
+	std::unique_lock<std::mutex> lock(mutex);
+	compiled.wait(lock, [&]{ return variant.status.load() >= ready; });
+	if (variant.status.load() == failed)
+		throw std::runtime_error("Failed to create graphics pipeline!");
+}
+
+pipelineManagerStats pipelineManager::stats() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return statistics;
+}
+
+size_t pipelineManager::size() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return variants.size();
+}
+
+std::vector<char> pipelineManager::cacheData() const {
+	size_t size = 0;
+	vkGetPipelineCacheData(device, cache, &size, nullptr);
+	std::vector<char> data(size);
+	if (size > 0 && vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+		data.clear();
+	data.resize(size);
+	return data;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "threadPool.h"
+
+// everything that varies between the graphics pipelines of the app - plain 32 bit fields only, so that a description
+// has no padding and can be hashed and compared bytewise. The rest of the state (vertex layout, pipeline layout, dynamic
+// viewport and scissor) is shared by every pipeline of a manager
+struct pipelineState {
+	uint32_t vertexShader; // ids returned by pipelineManager::addShader
+	uint32_t fragmentShader; // pipelineManager::noShader for depth only pipelines, which also get no color attachment
+	uint32_t specialization[4]; // values of constant_id 0 to 3, given to both stages - ids a shader doesn't declare are ignored
+	uint32_t renderPassKey; // identifies a family of compatible render passes, see pipelineManager::setRenderPass
+	uint32_t subpass;
+	uint32_t vertexAttributeCount; // leading attributes of the shared vertex layout that are fetched
+	VkSampleCountFlagBits samples;
+	VkCullModeFlags cullMode;
+	VkCompareOp depthCompare;
+	VkBool32 depthWrite;
+	VkBool32 blend; // alpha blending into the color attachment
+};
+
+struct pipelineManagerStats {
+	uint64_t requests = 0;
+	uint64_t deduplicated = 0; // requests for a state that was already known
+	uint64_t compiled = 0;
+	uint64_t derived = 0; // compiled as a derivative of the variant without specialization
+	double compileMilliseconds = 0.0; // summed over all compiling threads
+};
+
+// builds and owns graphics pipeline variants. Requests are hashed and deduplicated, so each distinct state is compiled
+// once, and compiles run on any number of threads against one shared VkPipelineCache, whose contents can be saved and
+// handed to the next run. Variants that only differ in specialization constants are created as derivatives of the
+// variant with all constants zero, when it has been built - most desktop drivers ignore the hint, but it's free.
+// get() compiles on the calling thread if it has to, warmUp() compiles a whole list across a thread pool
+class pipelineManager {
+public:
+	static constexpr uint32_t noShader = ~0u;
+
+	void init(VkDevice device, const VkAllocationCallbacks* allocator, VkPipelineLayout layout, const VkVertexInputBindingDescription& binding,
+		const VkVertexInputAttributeDescription* attributes, uint32_t attributeCount, const std::vector<char>& cacheData);
+	void cleanup(); // destroys every pipeline, shader module and the cache - nothing may be using them anymore
+
+	uint32_t addShader(const std::vector<char>& code); // SPIR-V, kept until cleanup
+	// pipelines for renderPassKey are compiled against this render pass - it only has to stay alive while they compile,
+	// the pipelines can then be used with any render pass compatible with it
+	void setRenderPass(uint32_t renderPassKey, VkRenderPass renderPass);
+
+	VkPipeline get(const pipelineState& state);
+	void warmUp(const std::vector<pipelineState>& states, threadPool& pool); // returns once every state has been built
+
+	pipelineManagerStats stats() const;
+	size_t size() const;
+	std::vector<char> cacheData() const; // for the next run's init
+
+private:
+	enum : int { queued, compiling, ready, failed };
+	struct entry {
+		pipelineState state;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		std::atomic<int> status{queued};
+	};
+
+	entry* find(const pipelineState& state, bool insert); // nullptr if not found and not inserted
+	void compile(entry& variant); // does nothing if another thread got there first
+	void waitFor(entry& variant);
+
+	VkDevice device = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocator = nullptr; // for the cache, shader modules and pipelines
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	VkVertexInputBindingDescription binding;
+	std::vector<VkVertexInputAttributeDescription> attributes;
+	std::vector<VkShaderModule> shaders;
+	std::unordered_map<uint32_t, VkRenderPass> renderPasses;
+
+	mutable std::mutex mutex; // guards the lookup, the render passes and the stats - compiles run unlocked
+	std::condition_variable compiled; // signaled whenever a variant leaves the compiling state
+	std::deque<entry> variants; // stable addresses
+	std::unordered_multimap<uint64_t, entry*> lookup; // by hash of the state
+	pipelineManagerStats statistics;
+};
@@ -0,0 +1,188 @@
+#include "app.h"
+
+// ╔═╗┬┌─┐┌─┐┬  ┬┌┐┌┌─┐┌─┐
+// ╠═╝│├─┘├┤ │  ││││├┤ └─┐
+// ╩  ┴┴  └─┘┴─┘┴┘└┘└─┘└─┘
+// graphics pipeline variants, built by the pipeline manager - see pipelineManager.h
+
+// render passes with the same sample count and subpass layout are compatible, so pipelines are keyed on just those
+static uint32_t renderPassKey(VkSampleCountFlagBits samples, bool prepass) {
+	return static_cast<uint32_t>(samples) | (prepass ? 1u << 8 : 0u);
+}
+
+void app::initPipelineManager(pipelineManager& manager, const std::vector<char>& cacheData) {
+	// a single interleaved stream of quantized vertices, see packedVertex in mesh.h - the depth pre-pass only fetches positions
+	VkVertexInputBindingDescription bindingDescription{};
+	bindingDescription.binding = 0;
+	bindingDescription.stride = sizeof(packedVertex);
+	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	VkVertexInputAttributeDescription attributeDescriptions[3]{};
+	attributeDescriptions[0].binding = 0;
+	attributeDescriptions[0].location = 0;
+	attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_SNORM;
+	attributeDescriptions[0].offset = offsetof(packedVertex, position);
+	attributeDescriptions[1].binding = 0;
+	attributeDescriptions[1].location = 1;
+	attributeDescriptions[1].format = VK_FORMAT_R8G8B8A8_SNORM;
+	attributeDescriptions[1].offset = offsetof(packedVertex, normal);
+	attributeDescriptions[2].binding = 0;
+	attributeDescriptions[2].location = 2;
+	attributeDescriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+	attributeDescriptions[2].offset = offsetof(packedVertex, uv);
+
+	manager.init(device, host.callbacks(), pipelineLayout, bindingDescription, attributeDescriptions, 3, cacheData);
+	vertexShader = manager.addShader(readFile("shaders/vert.spv"));
+	fragmentShader = manager.addShader(readFile("shaders/frag.spv"));
+	depthShader = manager.addShader(readFile("shaders/depth.spv"));
+	particleVertexShader = manager.addShader(readFile("shaders/particleVert.spv"));
+	particleFragmentShader = manager.addShader(readFile("shaders/particleFrag.spv"));
+}
+
+void app::createPipelineManager() {
+	PROFILE_ZONE("createPipelineManager");
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
+	pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, host.callbacks(), &pipelineLayout) != VK_SUCCESS)
+	    throw std::runtime_error("Failed to create pipeline layout!");
+
+	// last run's pipelines, if there was one
+	std::vector<char> cacheData;
+	if (std::ifstream(pipelineCachePath).good())
+		cacheData = readFile(pipelineCachePath);
+	initPipelineManager(pipelines, cacheData);
+
+	// every material, for every render pass layout the toggles can switch to
+	auto start = std::chrono::steady_clock::now();
+	std::vector<VkRenderPass> renderPasses;
+	pipelines.warmUp(pipelinePermutations(pipelines, renderPasses), workers);
+	for (VkRenderPass pass : renderPasses)
+		vkDestroyRenderPass(device, pass, host.callbacks()); // no longer needed once the pipelines exist
+	pipelineManagerStats stats = pipelines.stats();
+	cout << "Warmed up " << pipelines.size() << " pipelines (" << stats.derived << " derivatives) in "
+		<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms, "
+		<< (cacheData.empty() ? "without" : "with") << " a pipeline cache" << endl;
+}
+
+pipelineState app::colorPipelineState(VkSampleCountFlagBits samples, bool prepass, uint32_t material) const {
+	pipelineState state{};
+	state.vertexShader = vertexShader;
+	state.fragmentShader = fragmentShader;
+	state.specialization[0] = material / paletteCount; // shading model
+	state.specialization[1] = material % paletteCount; // palette
+	state.renderPassKey = renderPassKey(samples, prepass);
+	state.subpass = prepass ? 1 : 0;
+	state.vertexAttributeCount = 3;
+	state.samples = samples;
+	state.cullMode = VK_CULL_MODE_BACK_BIT; // counter-clockwise front faces - see reversedZPerspective
+	// reversed-Z depth test - greater is closer. When the pre-pass has already laid down the nearest depth, the color
+	// subpass only has to find the exact match, and does not need to write depth again
+	state.depthCompare = prepass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_GREATER;
+	state.depthWrite = prepass ? VK_FALSE : VK_TRUE;
+	state.blend = VK_TRUE;
+	return state;
+}
+
+pipelineState app::prepassPipelineState(VkSampleCountFlagBits samples) const {
+	// position only, no fragment shader is needed when only depth is written
+	pipelineState state{};
+	state.vertexShader = depthShader;
+	state.fragmentShader = pipelineManager::noShader;
+	state.renderPassKey = renderPassKey(samples, true);
+	state.subpass = 0;
+	state.vertexAttributeCount = 1;
+	state.samples = samples;
+	state.cullMode = VK_CULL_MODE_BACK_BIT;
+	state.depthCompare = VK_COMPARE_OP_GREATER;
+	state.depthWrite = VK_TRUE;
+	state.blend = VK_FALSE;
+	return state;
+}
+
+pipelineState app::particlePipelineState(VkSampleCountFlagBits samples, bool prepass) const {
+	// no vertex input, the quads are built from the particle buffer - tested against the scene's depth but not written,
+	// and blended in whatever order they come out of the simulation
+	pipelineState state{};
+	state.vertexShader = particleVertexShader;
+	state.fragmentShader = particleFragmentShader;
+	state.renderPassKey = renderPassKey(samples, prepass);
+	state.subpass = prepass ? 1 : 0;
+	state.vertexAttributeCount = 0;
+	state.samples = samples;
+	state.cullMode = VK_CULL_MODE_NONE;
+	state.depthCompare = VK_COMPARE_OP_GREATER;
+	state.depthWrite = VK_FALSE;
+	state.blend = VK_TRUE;
+	return state;
+}
+
+std::vector<pipelineState> app::pipelinePermutations(pipelineManager& manager, std::vector<VkRenderPass>& renderPasses) {
+	std::vector<pipelineState> states;
+	for (VkSampleCountFlags samples = VK_SAMPLE_COUNT_1_BIT; samples <= VK_SAMPLE_COUNT_64_BIT; samples <<= 1) {
+		if (!(supportedSampleCounts & samples)) continue;
+		const VkSampleCountFlagBits sampleCount = static_cast<VkSampleCountFlagBits>(samples);
+		for (bool prepass : {false, true}) {
+			renderPasses.push_back(buildRenderPass(sampleCount, prepass, host.callbacks()));
+			manager.setRenderPass(renderPassKey(sampleCount, prepass), renderPasses.back());
+			if (prepass) states.push_back(prepassPipelineState(sampleCount));
+			states.push_back(particlePipelineState(sampleCount, prepass));
+			for (uint32_t m = 0; m < materialCount; m++)
+				states.push_back(colorPipelineState(sampleCount, prepass, m));
+		}
+	}
+	return states;
+}
+
+void app::createGraphicsPipeline() {
+	// normally already built by the warm-up, otherwise compiled here
+	pipelines.setRenderPass(renderPassKey(msaaSamples, depthPrepass), renderPass);
+	graphicsPipeline = pipelines.get(colorPipelineState(msaaSamples, depthPrepass, material));
+	depthPrepassPipeline = depthPrepass ? pipelines.get(prepassPipelineState(msaaSamples)) : VK_NULL_HANDLE;
+	particlePipeline = pipelines.get(particlePipelineState(msaaSamples, depthPrepass));
+}
+
+void app::cycleMaterial() {
+	material = (material + 1) % materialCount;
+	cout << "Material " << material << ": shading model " << material / paletteCount << ", palette " << material % paletteCount << endl;
+	graphicsPipeline = pipelines.get(colorPipelineState(msaaSamples, depthPrepass, material)); // warmed up, and keys the opaque chunk
+	resetFrameTime();
+}
+
+void app::runPipelineBenchmark() {
+	// every permutation from scratch, with an empty cache, on an increasing number of threads - then once more on all of
+	// them, with the cache the last run filled. Drivers may keep their own on-disk cache as well, which has to be turned
+	// off for the cold numbers to mean anything (MESA_SHADER_CACHE_DISABLE=true with Mesa drivers)
+	std::vector<unsigned> threadCounts;
+	const unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned threads = 1; threads < hardwareThreads; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(hardwareThreads);
+
+	std::vector<char> cacheData;
+	for (size_t run = 0; run <= threadCounts.size(); run++) {
+		const bool cached = run == threadCounts.size();
+		const unsigned threads = cached ? hardwareThreads : threadCounts[run];
+		threadPool pool(threads);
+		pipelineManager manager;
+		initPipelineManager(manager, cached ? cacheData : std::vector<char>());
+		std::vector<VkRenderPass> renderPasses;
+		std::vector<pipelineState> states = pipelinePermutations(manager, renderPasses);
+
+		auto start = std::chrono::steady_clock::now();
+		manager.warmUp(states, pool);
+		const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		pipelineManagerStats stats = manager.stats();
+		cout << (cached ? "Cached:  " : "Cold:    ") << stats.compiled << " pipelines on " << threads << " threads in " << milliseconds
+			<< " ms - " << stats.compiled / (milliseconds / 1000.0) << " pipelines/s (" << stats.derived << " derivatives, "
+			<< stats.compileMilliseconds / stats.compiled << " ms per pipeline)" << endl;
+
+		if (!cached) cacheData = manager.cacheData();
+		for (VkRenderPass pass : renderPasses)
+			vkDestroyRenderPass(device, pass, host.callbacks());
+		manager.cleanup();
+	}
+}
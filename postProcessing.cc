@@ -0,0 +1,356 @@
+#include "app.h"
+
+// ╔═╗┌─┐┌─┐┌┬┐  ╔═╗┬─┐┌─┐┌─┐┌─┐┌─┐┌─┐┬┌┐┌┌─┐
+// ╠═╝│ │└─┐ │   ╠═╝├┬┘│ ││  ├┤ └─┐└─┐│││││ ┬
+// ╩  └─┘└─┘ ┴   ╩  ┴└─└─┘└─┘└─┘└─┘└─┘┴┘└┘└─┘
+// compute passes from the HDR target to the swapchain image, see shaders/post.glsl
+
+static VkExtent2D bloomExtent(VkExtent2D extent, uint32_t level) {
+	for (uint32_t i = 0; i <= level; i++) // level 0 is already at half resolution
+		extent = {std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u)};
+	return extent;
+}
+
+static void dispatchImage(VkCommandBuffer commandBuffer, VkExtent2D extent) {
+	vkCmdDispatch(commandBuffer, (extent.width + 7) / 8, (extent.height + 7) / 8, 1); // local size is 8x8 in every pass
+}
+
+static void computeBarrier(VkCommandBuffer commandBuffer) {
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+static VkImageMemoryBarrier imageBarrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess) {
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+	return barrier;
+}
+
+void app::pickHdrFormat() {
+	// half floats where possible - the packed format halves the bandwidth, but has no alpha and only 5-6 bits of mantissa
+	hdrFormat = findSupportedFormat({VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_B10G11R11_UFLOAT_PACK32}, VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BLEND_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+}
+
+bool app::storageOutputFormat(VkFormat format) {
+	// the tonemapping pass declares rgba8 - anything else needs its unformatted variant
+	if (format != VK_FORMAT_R8G8B8A8_UNORM && (format != VK_FORMAT_B8G8R8A8_UNORM || !storageWriteWithoutFormatSupported))
+		return false;
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+	return (props.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) != 0;
+}
+
+void app::createPostPipeline() {
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.pNext = nullptr;
+	samplerInfo.magFilter = VK_FILTER_LINEAR; // the downsampling and upsampling filters lean on bilinear taps
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = 0.0f;
+	if (vkCreateSampler(device, &samplerInfo, host.callbacks(), &postSampler) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create post-processing sampler!");
+
+	// one layout for every pass of the chain, each only uses some of the bindings - camera uniforms, source, destination,
+	// second destination, exposure buffer, bloom, output
+	const VkDescriptorType types[7] = {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+		VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE};
+	VkDescriptorSetLayoutBinding bindings[7]{};
+	for (uint32_t i = 0; i < 7; i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = types[i];
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = nullptr;
+	layoutInfo.bindingCount = 7;
+	layoutInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, host.callbacks(), &postDescriptorSetLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create post-processing descriptor set layout!");
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(postPushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &postDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, host.callbacks(), &postPipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create post-processing pipeline layout!");
+
+	// the prefilter and the plain downsample are the same shader, picked by constant_id 0. Tonemapping only needs the
+	// unformatted variant for BGRA swapchain images, but it works for everything else as well
+	const char* shaderFiles[5] = {"shaders/bloomDown.spv", "shaders/bloomDown.spv", "shaders/bloomUp.spv", "shaders/exposure.spv",
+		storageWriteWithoutFormatSupported ? "shaders/tonemapUnformatted.spv" : "shaders/tonemap.spv"};
+	VkSpecializationMapEntry mapEntry{0, 0, sizeof(VkBool32)};
+	VkBool32 prefilter = VK_TRUE;
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = 1;
+	specializationInfo.pMapEntries = &mapEntry;
+	specializationInfo.dataSize = sizeof(VkBool32);
+	specializationInfo.pData = &prefilter;
+
+	VkShaderModule shaderModules[5];
+	VkComputePipelineCreateInfo pipelineInfos[5]{};
+	for (uint32_t i = 0; i < 5; i++) {
+		shaderModules[i] = i == 1 ? shaderModules[0] : createShaderModule(readFile(shaderFiles[i]));
+		pipelineInfos[i].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfos[i].pNext = nullptr;
+		pipelineInfos[i].stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfos[i].stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfos[i].stage.module = shaderModules[i];
+		pipelineInfos[i].stage.pName = "main";
+		pipelineInfos[i].stage.pSpecializationInfo = i == 0 ? &specializationInfo : nullptr;
+		pipelineInfos[i].layout = postPipelineLayout;
+	}
+	VkPipeline computePipelines[5];
+	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 5, pipelineInfos, host.callbacks(), computePipelines) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create post-processing pipelines!");
+	bloomPrefilterPipeline = computePipelines[0];
+	bloomDownsamplePipeline = computePipelines[1];
+	bloomUpsamplePipeline = computePipelines[2];
+	exposurePipeline = computePipelines[3];
+	tonemapPipeline = computePipelines[4];
+	for (uint32_t i = 0; i < 5; i++)
+		if (i != 1) vkDestroyShaderModule(device, shaderModules[i], host.callbacks());
+
+	// outlives the swapchain, so the exposure doesn't start over on a resize - zero means nothing to adapt from yet
+	postExposure initialExposure{};
+	initialExposure.exposure = 1.0f;
+	uploadBuffer(&initialExposure, sizeof(initialExposure), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, exposureBuffer, exposureBufferMemory);
+}
+
+void app::createPostResources() {
+	const size_t imageCount = swapchainImages.size();
+	for (uint32_t level = 0; level < bloomLevels; level++) {
+		VkExtent2D extent = bloomExtent(swapchainExtent, level);
+		createImage(extent.width, extent.height, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, bloomImages[level], bloomImagesMemory[level]);
+		bloomImageViews[level] = createImageView(bloomImages[level], VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT);
+	}
+	if (!swapchainStorage) { // tonemapped into this, then copied into the swapchain image
+		createImage(swapchainExtent.width, swapchainExtent.height, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM,
+			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, postOutputImage, postOutputImageMemory);
+		postOutputImageView = createImageView(postOutputImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+	}
+
+	// the bloom sets are shared by every image, exposure and tonemapping need its uniforms and output
+	const uint32_t bloomSetCount = bloomDownsamplePasses + bloomLevels - 1;
+	const uint32_t setCount = bloomSetCount + static_cast<uint32_t>(imageCount);
+	VkDescriptorPoolSize poolSizes[4]{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = static_cast<uint32_t>(imageCount);
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[1].descriptorCount = bloomSetCount + static_cast<uint32_t>(imageCount * 2);
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[2].descriptorCount = bloomSetCount * 2 + static_cast<uint32_t>(imageCount);
+	poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[3].descriptorCount = setCount;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+	poolInfo.poolSizeCount = 4;
+	poolInfo.pPoolSizes = poolSizes;
+	poolInfo.maxSets = setCount;
+	if (vkCreateDescriptorPool(device, &poolInfo, host.swapchainCallbacks(), &postDescriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create post-processing descriptor pool!");
+
+	std::vector<VkDescriptorSetLayout> layouts(setCount, postDescriptorSetLayout);
+	std::vector<VkDescriptorSet> sets(setCount);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = postDescriptorPool;
+	allocInfo.descriptorSetCount = setCount;
+	allocInfo.pSetLayouts = layouts.data();
+	if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate post-processing descriptor sets!");
+	std::copy(sets.begin(), sets.begin() + bloomDownsamplePasses, bloomDownsampleSets);
+	std::copy(sets.begin() + bloomDownsamplePasses, sets.begin() + bloomSetCount, bloomUpsampleSets);
+	postDescriptorSets.assign(sets.begin() + bloomSetCount, sets.end());
+
+	// the bloom levels stay in the general layout for the whole chain, they are both sampled and stored to
+	const VkDescriptorBufferInfo exposureInfo{exposureBuffer, 0, VK_WHOLE_SIZE};
+	const VkDescriptorImageInfo hdrInfo{postSampler, hdrImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+	auto bloomInfo = [&](uint32_t level) { return VkDescriptorImageInfo{postSampler, bloomImageViews[level], VK_IMAGE_LAYOUT_GENERAL}; };
+	auto writeSet = [&](VkDescriptorSet set, const VkDescriptorImageInfo* source, const VkDescriptorImageInfo* destination,
+		const VkDescriptorImageInfo* nextDestination) {
+		const VkDescriptorImageInfo* images[4] = {nullptr, source, destination, nextDestination};
+		VkWriteDescriptorSet descriptorWrites[4]{};
+		uint32_t writeCount = 0;
+		for (uint32_t b = 1; b < 5; b++) {
+			if (b < 4 && images[b] == nullptr) continue;
+			VkWriteDescriptorSet& write = descriptorWrites[writeCount++];
+			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			write.dstSet = set;
+			write.dstBinding = b;
+			write.dstArrayElement = 0;
+			write.descriptorType = b == 4 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : b == 1 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			write.descriptorCount = 1;
+			if (b == 4) write.pBufferInfo = &exposureInfo;
+			else write.pImageInfo = images[b];
+		}
+		vkUpdateDescriptorSets(device, writeCount, descriptorWrites, 0, nullptr);
+	};
+
+	// the prefilter reads the HDR target into level 0, then each downsample pass reads the level above its first one
+	VkDescriptorImageInfo level0 = bloomInfo(0);
+	writeSet(bloomDownsampleSets[0], &hdrInfo, &level0, nullptr);
+	for (uint32_t pass = 1; pass < bloomDownsamplePasses; pass++) {
+		const uint32_t level = pass * 2 - 1;
+		VkDescriptorImageInfo source = bloomInfo(level - 1), destination = bloomInfo(level), next = bloomInfo(std::min(level + 1, bloomLevels - 1));
+		writeSet(bloomDownsampleSets[pass], &source, &destination, &next);
+	}
+	for (uint32_t level = 0; level + 1 < bloomLevels; level++) {
+		VkDescriptorImageInfo source = bloomInfo(level + 1), destination = bloomInfo(level);
+		writeSet(bloomUpsampleSets[level], &source, &destination, nullptr);
+	}
+
+	for (size_t i = 0; i < imageCount; i++) {
+		VkDescriptorBufferInfo uniformInfo{uniformBuffers[i], 0, sizeof(cameraUniforms)};
+		VkDescriptorImageInfo outputInfo{VK_NULL_HANDLE, swapchainStorage ? swapchainImageViews[i] : postOutputImageView, VK_IMAGE_LAYOUT_GENERAL};
+		VkWriteDescriptorSet descriptorWrites[5]{};
+		const uint32_t bindings[5] = {0, 1, 4, 5, 6};
+		for (uint32_t w = 0; w < 5; w++) {
+			descriptorWrites[w].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[w].dstSet = postDescriptorSets[i];
+			descriptorWrites[w].dstBinding = bindings[w];
+			descriptorWrites[w].dstArrayElement = 0;
+			descriptorWrites[w].descriptorCount = 1;
+		}
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[0].pBufferInfo = &uniformInfo;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[1].pImageInfo = &hdrInfo;
+		descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[2].pBufferInfo = &exposureInfo;
+		descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[3].pImageInfo = &level0;
+		descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		descriptorWrites[4].pImageInfo = &outputInfo;
+		vkUpdateDescriptorSets(device, 5, descriptorWrites, 0, nullptr);
+	}
+}
+
+void app::cleanupPostResources() {
+	const VkAllocationCallbacks* allocator = host.swapchainCallbacks();
+	for (uint32_t level = 0; level < bloomLevels; level++) {
+		deletions.destroy(bloomImageViews[level], allocator);
+		deletions.destroy(bloomImages[level], allocator);
+		deletions.destroy(bloomImagesMemory[level], allocator);
+	}
+	if (postOutputImage != VK_NULL_HANDLE) {
+		deletions.destroy(postOutputImageView, allocator);
+		deletions.destroy(postOutputImage, allocator);
+		deletions.destroy(postOutputImageMemory, allocator);
+		postOutputImage = VK_NULL_HANDLE;
+	}
+	deletions.destroy(postDescriptorPool, allocator); // frees the descriptor sets too
+}
+
+void app::recordPostProcessing(VkCommandBuffer commandBuffer, size_t imageIndex) {
+	const uint32_t firstTimestamp = static_cast<uint32_t>(imageIndex) * (gpuStageCount + 1);
+	auto timestamp = [&](uint32_t stage) {
+		if (timestampQueryPool != VK_NULL_HANDLE)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, firstTimestamp + stage);
+	};
+	VkImage outputImage = swapchainStorage ? swapchainImages[imageIndex] : postOutputImage;
+
+	// nothing in the bloom levels or the output is kept from the previous frame, but its passes have to be done with them
+	// - and with the exposure buffer, which is kept
+	VkImageMemoryBarrier startBarriers[bloomLevels + 1];
+	for (uint32_t level = 0; level < bloomLevels; level++)
+		startBarriers[level] = imageBarrier(bloomImages[level], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	startBarriers[bloomLevels] = imageBarrier(outputImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT);
+	VkMemoryBarrier exposureBarrier{};
+	exposureBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	exposureBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	exposureBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		1, &exposureBarrier, 0, nullptr, bloomLevels + 1, startBarriers);
+
+	// downsampling - the prefilter into level 0 with the histogram, then two levels per dispatch
+	postPushConstants pushConstants{0, 0};
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, bloomPrefilterPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, postPipelineLayout, 0, 1, &bloomDownsampleSets[0], 0, nullptr);
+	vkCmdPushConstants(commandBuffer, postPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+	dispatchImage(commandBuffer, bloomExtent(swapchainExtent, 0));
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, bloomDownsamplePipeline);
+	for (uint32_t pass = 1; pass < bloomDownsamplePasses; pass++) {
+		const uint32_t level = pass * 2 - 1;
+		computeBarrier(commandBuffer);
+		pushConstants.writeNextLevel = level + 1 < bloomLevels ? 1 : 0;
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, postPipelineLayout, 0, 1, &bloomDownsampleSets[pass], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, postPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+		dispatchImage(commandBuffer, bloomExtent(swapchainExtent, level));
+	}
+	timestamp(3);
+
+	// the exposure settles from the finished histogram
+	computeBarrier(commandBuffer);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, exposurePipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, postPipelineLayout, 0, 1, &postDescriptorSets[imageIndex], 0, nullptr);
+	vkCmdDispatch(commandBuffer, 1, 1, 1);
+	timestamp(4);
+
+	// upsampling, from the bottom level back up to level 0
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, bloomUpsamplePipeline);
+	for (uint32_t level = bloomLevels - 1; level-- > 0;) {
+		computeBarrier(commandBuffer);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, postPipelineLayout, 0, 1, &bloomUpsampleSets[level], 0, nullptr);
+		dispatchImage(commandBuffer, bloomExtent(swapchainExtent, level));
+	}
+	timestamp(5);
+
+	// the copy doesn't convert, so the red and blue channels of a BGRA swapchain image are swapped when tonemapping
+	computeBarrier(commandBuffer);
+	pushConstants.writeNextLevel = 0;
+	pushConstants.swapRedBlue = !swapchainStorage && (swapchainImageFormat == VK_FORMAT_B8G8R8A8_SRGB || swapchainImageFormat == VK_FORMAT_B8G8R8A8_UNORM);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, tonemapPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, postPipelineLayout, 0, 1, &postDescriptorSets[imageIndex], 0, nullptr);
+	vkCmdPushConstants(commandBuffer, postPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+	dispatchImage(commandBuffer, swapchainExtent);
+
+	if (swapchainStorage) {
+		VkImageMemoryBarrier presentBarrier = imageBarrier(outputImage, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_ACCESS_SHADER_WRITE_BIT, 0);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &presentBarrier);
+	} else {
+		// the swapchain image waits for the acquire at the transfer stage, see drawFrame
+		VkImageMemoryBarrier copyBarriers[2] = {
+			imageBarrier(outputImage, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT),
+			imageBarrier(swapchainImages[imageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT)};
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, 2, copyBarriers);
+		VkImageCopy region{};
+		region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+		region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+		region.extent = {swapchainExtent.width, swapchainExtent.height, 1};
+		vkCmdCopyImage(commandBuffer, outputImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapchainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+		VkImageMemoryBarrier presentBarrier = imageBarrier(swapchainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &presentBarrier);
+	}
+	timestamp(6);
+}
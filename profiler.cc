@@ -0,0 +1,171 @@
+#include "profiler.h"
+
+#ifdef ENABLE_PROFILER
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace profiler {
+
+static constexpr size_t ringCapacity = 1 << 17; // events per thread, a power of two
+
+enum eventType : uint32_t { zoneEvent, frameEvent, counterEvent };
+
+struct event {
+	const char* name;
+	uint64_t start;
+	union {
+		uint64_t end; // zones
+		double value; // counters
+	};
+	eventType type;
+};
+
+// single producer ring - only its thread writes, and publishes each event by bumping head
+struct ring {
+	std::atomic<uint64_t> head{0}; // events ever written
+	const char* threadName = nullptr;
+	uint32_t id;
+	event events[ringCapacity];
+};
+
+// pairs of TSC and steady_clock readings, taken at startup and on export, to convert ticks to time
+struct clockSample {
+	uint64_t ticks;
+	std::chrono::steady_clock::time_point time;
+	clockSample() : ticks(now()), time(std::chrono::steady_clock::now()) {}
+};
+
+static std::mutex ringsMutex; // only taken when a thread makes its first event, and on export
+static std::vector<std::unique_ptr<ring>> rings; // outlive their threads, so nothing recorded is lost when one exits
+static const clockSample startup;
+static thread_local ring* localRing = nullptr;
+
+static ring& threadRing() {
+	if (localRing == nullptr) {
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		rings.push_back(std::make_unique<ring>());
+		localRing = rings.back().get();
+		localRing->id = static_cast<uint32_t>(rings.size());
+	}
+	return *localRing;
+}
+
+static void push(const event& recorded) {
+	ring& target = threadRing();
+	const uint64_t head = target.head.load(std::memory_order_relaxed);
+	target.events[head & (ringCapacity - 1)] = recorded;
+	target.head.store(head + 1, std::memory_order_release);
+}
+
+void zone(const char* name, uint64_t start, uint64_t end) {
+	event recorded;
+	recorded.name = name;
+	recorded.start = start;
+	recorded.end = end;
+	recorded.type = zoneEvent;
+	push(recorded);
+}
+
+void frame() {
+	event recorded;
+	recorded.name = "frame";
+	recorded.start = now();
+	recorded.end = recorded.start;
+	recorded.type = frameEvent;
+	push(recorded);
+}
+
+void counter(const char* name, double value) {
+	event recorded;
+	recorded.name = name;
+	recorded.start = now();
+	recorded.value = value;
+	recorded.type = counterEvent;
+	push(recorded);
+}
+
+void setThreadName(const char* name) {
+	threadRing().threadName = name;
+}
+
+double measureZoneOverhead() {
+	constexpr uint32_t zoneCount = 100000; // fits in the ring without wrapping past the events already in it
+	ring& target = threadRing();
+	const uint64_t head = target.head.load(std::memory_order_relaxed);
+	std::vector<event> saved(target.events, target.events + ringCapacity);
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < zoneCount; i++) {
+		PROFILE_ZONE("overhead");
+	}
+	double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	std::copy(saved.begin(), saved.end(), target.events);
+	target.head.store(head, std::memory_order_release);
+	return elapsed / zoneCount;
+}
+
+// names come from string literals in the code, but quotes and backslashes would still break the JSON
+static void writeString(FILE* file, const char* text) {
+	fputc('"', file);
+	for (; *text; text++) {
+		if (*text == '"' || *text == '\\') fputc('\\', file);
+		fputc(*text, file);
+	}
+	fputc('"', file);
+}
+
+bool exportChromeTrace(const char* path) {
+	FILE* file = fopen(path, "w");
+	if (file == nullptr) return false;
+
+	const clockSample exported;
+	const double elapsed = std::chrono::duration<double, std::micro>(exported.time - startup.time).count();
+	const double microsecondsPerTick = exported.ticks > startup.ticks ? elapsed / double(exported.ticks - startup.ticks) : 0.0;
+	auto timestamp = [&](uint64_t ticks) { return double(int64_t(ticks - startup.ticks)) * microsecondsPerTick; };
+
+	std::lock_guard<std::mutex> lock(ringsMutex);
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+	fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"vkExperiment\"}}", file);
+	std::vector<event> events;
+	for (const auto& source : rings) {
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", source->id);
+		if (source->threadName != nullptr)
+			writeString(file, source->threadName);
+		else
+			fprintf(file, "\"thread %u\"", source->id);
+		fputs("}}", file);
+
+		// copy out what's in the ring, then drop anything the writer may have lapped while it was being copied
+		const uint64_t head = source->head.load(std::memory_order_acquire);
+		const uint64_t first = head > ringCapacity ? head - ringCapacity : 0;
+		events.clear();
+		for (uint64_t i = first; i < head; i++)
+			events.push_back(source->events[i & (ringCapacity - 1)]);
+		const uint64_t lapped = source->head.load(std::memory_order_acquire);
+		const uint64_t valid = lapped > ringCapacity ? lapped - ringCapacity : 0;
+
+		for (uint64_t i = std::max(first, valid); i < head; i++) {
+			const event& recorded = events[i - first];
+			fputs(",\n{\"name\":", file);
+			writeString(file, recorded.name);
+			if (recorded.type == zoneEvent)
+				fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", source->id, timestamp(recorded.start),
+					double(recorded.end - recorded.start) * microsecondsPerTick);
+			else if (recorded.type == frameEvent) // global instant events draw a line across every thread
+				fprintf(file, ",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", source->id, timestamp(recorded.start));
+			else
+				fprintf(file, ",\"ph\":\"C\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%g}}", source->id, timestamp(recorded.start), recorded.value);
+		}
+	}
+	fputs("\n]}\n", file);
+	return fclose(file) == 0;
+}
+
+}
+#endif
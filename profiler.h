@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+
+// CPU profiler - scoped zones, frame markers and counters, exported as a Chrome trace (JSON trace event format, which
+// chrome://tracing and ui.perfetto.dev both load). Only built with ENABLE_PROFILER defined (make PROFILE=1), otherwise
+// the macros expand to nothing and none of this is compiled in.
+//
+// Each thread writes into a ring buffer of its own, created on its first event and never freed, so there is no locking
+// on the recording side - a zone is two timestamp reads and one store into the ring, on destruction. Timestamps are the
+// TSC on x86, converted to wall time by calibrating it against steady_clock, and steady_clock elsewhere. Once a ring
+// wraps, its oldest events are overwritten, so an export holds the last ringCapacity events of each thread
+//
+//   PROFILE_ZONE("name")          times the rest of the enclosing scope, the name has to be a string literal
+//   PROFILE_FRAME()               marks the end of a frame
+//   PROFILE_COUNTER("name", v)    samples a counter, shown as a graph
+//   PROFILE_THREAD("name")        names the calling thread in the trace
+
+#ifdef ENABLE_PROFILER
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace profiler {
+	inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+	}
+
+	void zone(const char* name, uint64_t start, uint64_t end);
+	void frame();
+	void counter(const char* name, double value);
+	void setThreadName(const char* name);
+
+	// average cost of an empty zone in nanoseconds, over a run of them on the calling thread - whose ring is left as it was
+	double measureZoneOverhead();
+
+	// writes every thread's events to path, returns false if it can't be written. Meant for when the other threads are
+	// idle - events being written during the export may come out torn, since readers never block the writers
+	bool exportChromeTrace(const char* path);
+
+	class scopedZone {
+	public:
+		explicit scopedZone(const char* name) : name(name), start(now()) {}
+		~scopedZone() { zone(name, start, now()); }
+		scopedZone(const scopedZone&) = delete;
+		scopedZone& operator=(const scopedZone&) = delete;
+	private:
+		const char* name;
+		uint64_t start;
+	};
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) profiler::scopedZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_FRAME() profiler::frame()
+#define PROFILE_COUNTER(name, value) profiler::counter(name, static_cast<double>(value))
+#define PROFILE_THREAD(name) profiler::setThreadName(name)
+
+#else
+
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+
+#endif
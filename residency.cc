@@ -0,0 +1,89 @@
+#include "app.h"
+
+// ╦═╗┌─┐┌─┐┬┌┬┐┌─┐┌┐┌┌─┐┬ ┬
+// ╠╦╝├┤ └─┐│ ││├┤ ││││  └┬┘
+// ╩╚═└─┘└─┘┴─┴┘└─┘┘└┘└─┘ ┴
+// device memory budgets, and mesh LODs streamed in and out against them - see residencyManager.h
+
+void app::sampleMemoryBudget() {
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+	budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	budgetProperties.pNext = nullptr;
+	VkPhysicalDeviceMemoryProperties2 memoryProperties{};
+	memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+	memoryProperties.pNext = memoryBudgetSupported ? &budgetProperties : nullptr;
+	vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &memoryProperties);
+
+	const VkPhysicalDeviceMemoryProperties& properties = memoryProperties.memoryProperties;
+	heapBudgets.resize(properties.memoryHeapCount);
+	for (uint32_t heap = 0; heap < properties.memoryHeapCount; heap++) {
+		if (memoryBudgetSupported) { // covers every allocation in the process, and other processes' share of the heap
+			heapBudgets[heap].budget = budgetProperties.heapBudget[heap];
+			heapBudgets[heap].usage = budgetProperties.heapUsage[heap];
+		} else { // a guess - most of the heap, and only the streamable resources count against it
+			heapBudgets[heap].budget = properties.memoryHeaps[heap].size / 10 * 8;
+			heapBudgets[heap].usage = residency.residentBytes(heap);
+		}
+		if (simulatedBudget != 0 && (properties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+			heapBudgets[heap].budget = std::min(heapBudgets[heap].budget, simulatedBudget);
+	}
+	const heapBudget& local = heapBudgets[deviceLocalHeap];
+	minHeadroom = std::min(minHeadroom, static_cast<int64_t>(local.budget) - static_cast<int64_t>(local.usage));
+	PROFILE_COUNTER("device local headroom (MB)", (static_cast<int64_t>(local.budget) - static_cast<int64_t>(local.usage)) / (1024 * 1024));
+}
+
+void app::registerLods() {
+	// the coarsest LOD is the fallback for all the others, so it always stays
+	residency.clear();
+	lodResources.clear();
+	for (uint32_t lod = 0; lod < lods.size(); lod++)
+		lodResources.push_back(residency.add(sizeof(uint32_t) * VkDeviceSize(lods[lod].indexCount), deviceLocalHeap, lod + 1 == lods.size()));
+	drawnLod = lodLevel;
+}
+
+void app::uploadLod(uint32_t lod) {
+	uploadBuffer(hostIndices.data() + lods[lod].firstIndex, sizeof(uint32_t) * VkDeviceSize(lods[lod].indexCount), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		lodIndexBuffers[lod], lodIndexBuffersMemory[lod]);
+}
+
+uint32_t app::residentLod(uint32_t wanted) const {
+	for (uint32_t lod = wanted; lod < lods.size(); lod++) // the nearest coarser one
+		if (residency.resident(lodResources[lod]))
+			return lod;
+	return static_cast<uint32_t>(lods.size() - 1);
+}
+
+void app::updateResidency() {
+	residencyFrame++;
+	sampleMemoryBudget();
+
+	// whatever the command buffers were recorded with is still in use, and so is the LOD that should be drawn
+	for (uint32_t lod : recordedLods)
+		residency.use(lodResources[lod], residencyFrame);
+	residency.use(lodResources[lodLevel], residencyFrame);
+
+	// streaming back in waits for the queue to go idle - a hitch, but only when switching to an evicted LOD
+	std::vector<uint32_t> evicted;
+	if (!residency.resident(lodResources[lodLevel])) {
+		if (residency.reserve(lodResources[lodLevel], heapBudgets, residencyFrame, evicted)) {
+			uploadLod(lodLevel);
+			residency.uploaded(lodResources[lodLevel]);
+		}
+	} else if (residencyFrame >= evictionCooldown) {
+		evicted = residency.evict(heapBudgets, residencyFrame);
+	}
+
+	// nothing recorded uses these, and frames in flight are covered by the deletion queue
+	for (uint32_t id : evicted) {
+		const uint32_t lod = static_cast<uint32_t>(std::find(lodResources.begin(), lodResources.end(), id) - lodResources.begin());
+		deletions.destroy(lodIndexBuffers[lod], host.callbacks());
+		deletions.destroy(lodIndexBuffersMemory[lod], host.callbacks());
+		lodIndexBuffers[lod] = VK_NULL_HANDLE;
+		lodIndexBuffersMemory[lod] = VK_NULL_HANDLE;
+	}
+	// the sampled usage only drops once the deletion queue gets to them
+	if (!evicted.empty())
+		evictionCooldown = residencyFrame + MAX_FRAMES_IN_FLIGHT + 1;
+
+	drawnLod = residentLod(lodLevel); // rerecords the chunks drawing the mesh, see chunkKey
+}
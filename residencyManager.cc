@@ -0,0 +1,75 @@
+#include "residencyManager.h"
+#include <algorithm>
+
+uint32_t residencyManager::add(uint64_t size, uint32_t heap, bool pinned) {
+	resources.push_back(resource{size, heap, pinned, true, 0});
+	return static_cast<uint32_t>(resources.size() - 1);
+}
+
+uint64_t residencyManager::residentBytes(uint32_t heap) const {
+	uint64_t bytes = 0;
+	for (const resource& r : resources)
+		if (r.heap == heap && r.resident)
+			bytes += r.size;
+	return bytes;
+}
+
+std::vector<uint32_t> residencyManager::candidates(uint32_t heap, uint64_t frame) const {
+	std::vector<uint32_t> result;
+	for (uint32_t id = 0; id < resources.size(); id++) {
+		const resource& r = resources[id];
+		if (r.heap == heap && r.resident && !r.pinned && r.lastUsed < frame)
+			result.push_back(id);
+	}
+	std::sort(result.begin(), result.end(), [this](uint32_t a, uint32_t b) { return resources[a].lastUsed < resources[b].lastUsed; });
+	return result;
+}
+
+void residencyManager::markEvicted(uint32_t id) {
+	resources[id].resident = false;
+	statistics.evictions++;
+	statistics.evictedBytes += resources[id].size;
+}
+
+std::vector<uint32_t> residencyManager::evict(const std::vector<heapBudget>& heaps, uint64_t frame) {
+	std::vector<uint32_t> evicted;
+	for (uint32_t heap = 0; heap < heaps.size(); heap++) {
+		const heapBudget& h = heaps[heap];
+		if (h.budget == 0 || h.usage <= uint64_t(h.budget * double(highWatermark))) continue;
+		const uint64_t target = uint64_t(h.budget * double(lowWatermark));
+		uint64_t usage = h.usage;
+		for (uint32_t id : candidates(heap, frame)) {
+			if (usage <= target) break;
+			usage -= std::min(usage, resources[id].size);
+			markEvicted(id);
+			evicted.push_back(id);
+		}
+	}
+	return evicted;
+}
+
+bool residencyManager::reserve(uint32_t id, const std::vector<heapBudget>& heaps, uint64_t frame, std::vector<uint32_t>& evicted) {
+	const resource& wanted = resources[id];
+	if (wanted.heap >= heaps.size() || heaps[wanted.heap].budget == 0) return true; // nothing known about the heap
+	const heapBudget& h = heaps[wanted.heap];
+	const uint64_t limit = uint64_t(h.budget * double(highWatermark));
+	uint64_t usage = h.usage;
+	std::vector<uint32_t> victims;
+	for (uint32_t victim : candidates(wanted.heap, frame)) {
+		if (usage + wanted.size <= limit) break;
+		usage -= std::min(usage, resources[victim].size);
+		victims.push_back(victim);
+	}
+	if (usage + wanted.size > limit) return false;
+	for (uint32_t victim : victims) {
+		markEvicted(victim);
+		evicted.push_back(victim);
+	}
+	return true;
+}
+
+void residencyManager::uploaded(uint32_t id) {
+	resources[id].resident = true;
+	statistics.uploads++;
+	statistics.uploadedBytes += resources[id].size;
+}
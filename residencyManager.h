@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// budget and usage of one memory heap in bytes, as last sampled
+struct heapBudget {
+	uint64_t budget = 0;
+	uint64_t usage = 0;
+};
+
+struct residencyStats {
+	uint64_t evictions = 0;
+	uint64_t evictedBytes = 0;
+	uint64_t uploads = 0; // streamed back in after an eviction
+	uint64_t uploadedBytes = 0;
+};
+
+// least recently used residency for streamable resources - things that can be dropped from device memory and streamed
+// back in from a host copy when they are next needed. Only does the bookkeeping and makes the decisions, the owner
+// frees and uploads the memory. Resources are touched with the frame they are used in, and the ones used in the current
+// frame are never evicted. Once a heap's usage crosses the high watermark, the least recently used ones are evicted until
+// it is back under the low watermark - the gap keeps it from evicting something every frame. Usage is whatever the
+// owner samples, so it covers allocations made outside of the manager as well
+class residencyManager {
+public:
+	// fractions of the budget
+	void setWatermarks(float high, float low) { highWatermark = high; lowWatermark = low; }
+
+	// returns the id of the new resource, which starts out resident. Pinned resources are never evicted
+	uint32_t add(uint64_t size, uint32_t heap, bool pinned);
+	void clear() { resources.clear(); }
+
+	void use(uint32_t id, uint64_t frame) { resources[id].lastUsed = frame; }
+	bool resident(uint32_t id) const { return resources[id].resident; }
+	uint64_t size(uint32_t id) const { return resources[id].size; }
+	uint64_t residentBytes(uint32_t heap) const;
+
+	// resources to evict from heaps over the high watermark - they are marked as evicted, the owner frees them
+	std::vector<uint32_t> evict(const std::vector<heapBudget>& heaps, uint64_t frame);
+
+	// room for an evicted resource to be streamed back in, under the high watermark. Evicts the least recently used
+	// resources not needed this frame to make it, adding them to evicted - returns false, evicting nothing, if even that
+	// isn't enough. Otherwise the owner uploads it and calls uploaded
+	bool reserve(uint32_t id, const std::vector<heapBudget>& heaps, uint64_t frame, std::vector<uint32_t>& evicted);
+	void uploaded(uint32_t id);
+
+	const residencyStats& stats() const { return statistics; }
+
+private:
+	struct resource {
+		uint64_t size;
+		uint32_t heap;
+		bool pinned;
+		bool resident;
+		uint64_t lastUsed;
+	};
+
+	// resident, evictable resources of a heap not used this frame, least recently used first
+	std::vector<uint32_t> candidates(uint32_t heap, uint64_t frame) const;
+	void markEvicted(uint32_t id);
+
+	std::vector<resource> resources;
+	float highWatermark = 0.9f;
+	float lowWatermark = 0.8f;
+	residencyStats statistics;
+};
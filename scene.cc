@@ -0,0 +1,230 @@
+#include "scene.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SCENE_SSE
+#endif
+
+using std::cout, std::endl;
+
+namespace {
+
+// applies a new order to one of the per node arrays - newIndex maps each old position to its new one
+template <typename T>
+void permute(std::vector<T>& values, const std::vector<uint32_t>& newIndex) {
+	std::vector<T> reordered(values.size());
+	for (size_t i = 0; i < values.size(); i++)
+		reordered[newIndex[i]] = values[i];
+	values.swap(reordered);
+}
+
+} // namespace
+
+void multiplyMatrices(const matrix4& a, const matrix4& b, matrix4& result) {
+#ifdef SCENE_SSE
+	// each result column is a linear combination of a's columns, weighted by the matching column of b
+	const __m128 a0 = _mm_load_ps(&a.m[0]), a1 = _mm_load_ps(&a.m[4]), a2 = _mm_load_ps(&a.m[8]), a3 = _mm_load_ps(&a.m[12]);
+	for (int column = 0; column < 4; column++) {
+		const float* bc = &b.m[column * 4];
+		__m128 r = _mm_mul_ps(a0, _mm_set1_ps(bc[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(bc[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(bc[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(bc[3])));
+		_mm_store_ps(&result.m[column * 4], r);
+	}
+#else
+	matrix4 product;
+	for (int column = 0; column < 4; column++)
+		for (int row = 0; row < 4; row++)
+			product.m[column * 4 + row] = a.m[row] * b.m[column * 4] + a.m[4 + row] * b.m[column * 4 + 1]
+				+ a.m[8 + row] * b.m[column * 4 + 2] + a.m[12 + row] * b.m[column * 4 + 3];
+	result = product;
+#endif
+}
+
+uint32_t sceneGraph::addNode(uint32_t parent, const nodeTransform& local, uint32_t instance) {
+	uint32_t index = static_cast<uint32_t>(parents.size());
+	uint32_t parentIndex = parent == noParent ? noParent : handleToIndex.at(parent);
+	uint32_t depth = parent == noParent ? 0 : depths[parentIndex] + 1;
+	if (!depths.empty() && depth < depths.back()) sorted = false; // appending at the end is only fine for the deepest level
+	levelStart.clear(); // rebuilt before the next update
+
+	parents.push_back(parentIndex);
+	positionX.push_back(local.position[0]); positionY.push_back(local.position[1]); positionZ.push_back(local.position[2]);
+	rotationX.push_back(local.rotation[0]); rotationY.push_back(local.rotation[1]);
+	rotationZ.push_back(local.rotation[2]); rotationW.push_back(local.rotation[3]);
+	scales.push_back(local.scale);
+	instances.push_back(instance);
+	dirty.push_back(1);
+	changedVersion.push_back(0);
+	worlds.emplace_back();
+	depths.push_back(depth);
+	if (instance != noInstance) instanceSlots = std::max(instanceSlots, instance + 1);
+
+	handleToIndex.push_back(index);
+	return static_cast<uint32_t>(handleToIndex.size() - 1);
+}
+
+void sceneGraph::setLocal(uint32_t node, const nodeTransform& local) {
+	uint32_t i = handleToIndex[node];
+	positionX[i] = local.position[0]; positionY[i] = local.position[1]; positionZ[i] = local.position[2];
+	rotationX[i] = local.rotation[0]; rotationY[i] = local.rotation[1];
+	rotationZ[i] = local.rotation[2]; rotationW[i] = local.rotation[3];
+	scales[i] = local.scale;
+	dirty[i] = 1; // children are picked up during the update, through their parent's changedVersion
+}
+
+void sceneGraph::sortByDepth() {
+	if (!sorted) {
+		// breadth first order - every level follows the one above it, and within a level children are grouped by
+		// parent, in parent order. Reading the parents' world matrices then walks forward through memory
+		const size_t count = parents.size();
+		std::vector<uint32_t> childStart(count + 1, 0), children(count);
+		for (uint32_t parent : parents)
+			if (parent != noParent) childStart[parent + 1]++;
+		for (size_t i = 0; i < count; i++) childStart[i + 1] += childStart[i];
+		std::vector<uint32_t> fill(childStart.begin(), childStart.end() - 1);
+		std::vector<uint32_t> order;
+		order.reserve(count);
+		for (uint32_t i = 0; i < count; i++) {
+			if (parents[i] == noParent) order.push_back(i);
+			else children[fill[parents[i]]++] = i;
+		}
+		for (size_t next = 0; next < order.size(); next++)
+			order.insert(order.end(), children.begin() + childStart[order[next]], children.begin() + childStart[order[next] + 1]);
+
+		std::vector<uint32_t> newIndex(count);
+		for (uint32_t i = 0; i < count; i++) newIndex[order[i]] = i;
+		for (uint32_t& parent : parents)
+			if (parent != noParent) parent = newIndex[parent];
+		permute(parents, newIndex);
+		permute(positionX, newIndex); permute(positionY, newIndex); permute(positionZ, newIndex);
+		permute(rotationX, newIndex); permute(rotationY, newIndex); permute(rotationZ, newIndex); permute(rotationW, newIndex);
+		permute(scales, newIndex);
+		permute(instances, newIndex);
+		permute(dirty, newIndex);
+		permute(changedVersion, newIndex);
+		permute(worlds, newIndex);
+		permute(depths, newIndex);
+		for (uint32_t& index : handleToIndex)
+			index = newIndex[index];
+		sorted = true;
+	}
+
+	uint32_t levels = depths.empty() ? 0 : depths.back() + 1;
+	levelStart.assign(levels + 1, 0);
+	for (uint32_t depth : depths) levelStart[depth + 1]++;
+	for (uint32_t level = 0; level < levels; level++) levelStart[level + 1] += levelStart[level];
+}
+
+sceneUpdateStats sceneGraph::update(threadPool& pool, matrix4* output, uint64_t& outputVersion) {
+	PROFILE_ZONE("sceneGraph::update");
+	if (!sorted || levelStart.empty()) sortByDepth();
+	version++;
+
+	std::atomic<size_t> recomputed(0), written(0);
+	for (size_t level = 0; level + 1 < levelStart.size(); level++) {
+		const uint32_t first = levelStart[level];
+		pool.parallelFor(levelStart[level + 1] - first, [&](size_t begin, size_t end) {
+			size_t localRecomputed = 0, localWritten = 0;
+			for (size_t i = first + begin; i < first + end; i++) {
+				const uint32_t parent = parents[i];
+				if (dirty[i] || (parent != noParent && changedVersion[parent] == version)) {
+					// compose the local matrix from translation, rotation and scale
+					const float x = rotationX[i], y = rotationY[i], z = rotationZ[i], w = rotationW[i], s = scales[i];
+					matrix4 local;
+					local.m[0] = s * (1.0f - 2.0f * (y * y + z * z)); local.m[1] = s * 2.0f * (x * y + z * w);
+					local.m[2] = s * 2.0f * (x * z - y * w); local.m[3] = 0.0f;
+					local.m[4] = s * 2.0f * (x * y - z * w); local.m[5] = s * (1.0f - 2.0f * (x * x + z * z));
+					local.m[6] = s * 2.0f * (y * z + x * w); local.m[7] = 0.0f;
+					local.m[8] = s * 2.0f * (x * z + y * w); local.m[9] = s * 2.0f * (y * z - x * w);
+					local.m[10] = s * (1.0f - 2.0f * (x * x + y * y)); local.m[11] = 0.0f;
+					local.m[12] = positionX[i]; local.m[13] = positionY[i]; local.m[14] = positionZ[i]; local.m[15] = 1.0f;
+
+					if (parent == noParent) worlds[i] = local;
+					else multiplyMatrices(worlds[parent], local, worlds[i]);
+					changedVersion[i] = version;
+					dirty[i] = 0;
+					localRecomputed++;
+				}
+
+				// instance buffers are usually write-combined mapped memory - streaming stores skip the cache, and
+				// the output is never read back here
+				if (instances[i] != noInstance && changedVersion[i] > outputVersion) {
+					matrix4& destination = output[instances[i]];
+#ifdef SCENE_SSE
+					for (int column = 0; column < 4; column++)
+						_mm_stream_ps(&destination.m[column * 4], _mm_load_ps(&worlds[i].m[column * 4]));
+#else
+					destination = worlds[i];
+#endif
+					localWritten++;
+				}
+			}
+#ifdef SCENE_SSE
+			_mm_sfence(); // streaming stores are weakly ordered, make them visible before the chunk counts as done
+#endif
+			recomputed += localRecomputed;
+			written += localWritten;
+		}, 4096);
+	}
+	outputVersion = version;
+	return sceneUpdateStats{recomputed.load(), written.load()};
+}
+
+void runSceneBenchmark(threadPool& pool) {
+	cout << "Scene update benchmark, " << pool.size() << " threads" << endl;
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	auto randomTransform = [&]() {
+		nodeTransform t;
+		for (float& p : t.position) p = unit(rng);
+		float q[4] = {unit(rng), unit(rng), unit(rng), unit(rng)};
+		float length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+		for (int i = 0; i < 4; i++) t.rotation[i] = q[i] / std::max(length, 1e-6f);
+		t.scale = 1.0f;
+		return t;
+	};
+
+	for (size_t nodeCount : {size_t(100000), size_t(1000000), size_t(10000000)}) {
+		// random recursive tree - each node picks a parent among the ones before it, so handles aren't in depth order
+		// and the first update has to sort. Every node is an instance
+		sceneGraph scene;
+		std::vector<uint32_t> handles;
+		handles.reserve(nodeCount);
+		for (size_t i = 0; i < nodeCount; i++) {
+			uint32_t parent = i == 0 ? sceneGraph::noParent : handles[std::uniform_int_distribution<size_t>(0, i - 1)(rng)];
+			handles.push_back(scene.addNode(parent, randomTransform(), static_cast<uint32_t>(i)));
+		}
+		std::vector<matrix4> instanceBuffer(nodeCount);
+		uint64_t bufferVersion = 0;
+		auto start = std::chrono::steady_clock::now();
+		scene.update(pool, instanceBuffer.data(), bufferVersion); // sorts, and computes everything once
+		double firstUpdate = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		cout << "  " << nodeCount << " nodes: initial sort + update " << firstUpdate << " ms" << endl;
+
+		for (float dirtyFraction : {0.01f, 1.0f}) {
+			const int iterations = nodeCount >= 10000000 ? 3 : nodeCount >= 1000000 ? 10 : 50;
+			const size_t dirtyCount = static_cast<size_t>(nodeCount * dirtyFraction);
+			double total = 0.0;
+			sceneUpdateStats stats{};
+			for (int iteration = 0; iteration < iterations; iteration++) {
+				for (size_t d = 0; d < dirtyCount; d++) // dirtying isn't timed, only the update
+					scene.setLocal(dirtyFraction >= 1.0f ? handles[d] : handles[std::uniform_int_distribution<size_t>(0, nodeCount - 1)(rng)], randomTransform());
+				start = std::chrono::steady_clock::now();
+				stats = scene.update(pool, instanceBuffer.data(), bufferVersion);
+				total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			}
+			double average = total / iterations;
+			cout << "    " << dirtyFraction * 100.0f << "% dirty: " << average << " ms/update, " << stats.recomputed << " world matrices recomputed ("
+				<< stats.recomputed / (average * 1000.0) << " M/s), " << stats.written << " instances written" << endl;
+		}
+	}
+}
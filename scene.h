@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "threadPool.h"
+
+// column-major 4x4 matrix, laid out like glm::mat4 and a GLSL mat4 in a std430 buffer
+struct alignas(16) matrix4 {
+	float m[16];
+};
+
+// local transform of a node relative to its parent - rotation is a unit quaternion (x, y, z, w), scale is uniform
+struct nodeTransform {
+	float position[3];
+	float rotation[4];
+	float scale;
+};
+
+struct sceneUpdateStats {
+	size_t recomputed; // world matrices recalculated - every node in a dirty subtree
+	size_t written; // instance transforms written to the output
+};
+
+// transform hierarchy, stored as structure of arrays. Nodes are kept sorted by depth, so every parent comes before its
+// children and each level can be updated in parallel once the level above it is done. World matrices are only
+// recomputed for dirty subtrees, and are streamed straight into the per-instance buffer used by the draws
+class sceneGraph {
+public:
+	static constexpr uint32_t noParent = ~0u;
+	static constexpr uint32_t noInstance = ~0u;
+
+	// returns a handle that stays valid for the life of the graph - the parent has to exist already. Nodes with an
+	// instance index get their world matrix written to that slot of the instance buffer
+	uint32_t addNode(uint32_t parent, const nodeTransform& local, uint32_t instance = noInstance);
+	void setLocal(uint32_t node, const nodeTransform& local); // marks the node's subtree dirty
+	const matrix4& world(uint32_t node) const { return worlds[handleToIndex[node]]; }
+	size_t size() const { return parents.size(); }
+	uint32_t instanceCount() const { return instanceSlots; }
+
+	// recomputes the world matrices of every dirty subtree, then writes the transform of every instance that changed
+	// since outputVersion to instances[instance], and updates outputVersion. Keeping a version per output buffer lets
+	// several buffers (one per swapchain image) be kept current, each getting only the changes it hasn't seen yet
+	sceneUpdateStats update(threadPool& pool, matrix4* instances, uint64_t& outputVersion);
+
+private:
+	void sortByDepth(); // restores the breadth first order after nodes were added, and finds the levels
+
+	// per node, in depth order
+	std::vector<uint32_t> parents; // index, not handle
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+	std::vector<float> scales;
+	std::vector<uint32_t> instances;
+	std::vector<uint8_t> dirty;
+	std::vector<uint64_t> changedVersion; // update at which the world matrix last changed
+	std::vector<matrix4> worlds;
+	std::vector<uint32_t> depths;
+
+	std::vector<uint32_t> handleToIndex;
+	std::vector<uint32_t> levelStart; // first node of each depth, plus the end
+	bool sorted = true;
+	uint64_t version = 0;
+	uint32_t instanceSlots = 0;
+};
+
+// world = parent * local, four columns at a time with SSE where available
+void multiplyMatrices(const matrix4& a, const matrix4& b, matrix4& result);
+
+// scene update benchmark - random hierarchies of 100k to 10M nodes, with 1% and 100% of the nodes dirtied per update
+void runSceneBenchmark(threadPool& pool);
@@ -0,0 +1,115 @@
+#include "app.h"
+
+#include <cmath>
+#include <limits>
+
+// ╔═╗┌─┐┌─┐┌┐┌┌─┐  ╦┌┐┌┌─┐┌┬┐┌─┐┌┐┌┌─┐┌─┐┌─┐
+// ╚═╗│  ├┤ │││├┤   ║│││└─┐ │ ├─┤││││  ├┤ └─┐
+// ╚═╝└─┘└─┘┘└┘└─┘  ╩┘└┘└─┘ ┴ ┴ ┴┘└┘└─┘└─┘└─┘
+// root -> groups on a grid -> rings of instances, see scene.h for the update itself
+
+static nodeTransform translation(float x, float y, float z) {
+	return nodeTransform{{x, y, z}, {0.0f, 0.0f, 0.0f, 1.0f}, 1.0f};
+}
+
+void app::buildScene() {
+	PROFILE_ZONE("buildScene");
+	if (meshPath.empty()) instanceCount = 1; // the overdraw benchmark is a single stack of quads
+	if (multiDrawIndirectSupported) {
+		// meshlet culling gives every meshlet of every instance a slot in the indirect buffer, twice over with Hi-Z culling,
+		// and draws them all with a single indirect draw
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+		uint32_t maxMeshlets = 1;
+		for (const meshLod& lod : lods)
+			maxMeshlets = std::max(maxMeshlets, lod.meshletCount);
+		const uint64_t maxDraws = std::min<uint64_t>(deviceProperties.limits.maxDrawIndirectCount,
+			deviceProperties.limits.maxStorageBufferRange / (2 * sizeof(VkDrawIndexedIndirectCommand)));
+		const uint32_t maxInstances = static_cast<uint32_t>(std::max<uint64_t>(maxDraws / maxMeshlets, 1));
+		if (instanceCount > maxInstances) {
+			cout << "Clamping " << instanceCount << " instances to " << maxInstances << ", the most this device can draw with meshlet culling ("
+				<< maxMeshlets << " meshlets each)" << endl;
+			instanceCount = maxInstances;
+		}
+	}
+	const float meshRadius = glm::length(glm::vec3(bounds.extent[0], bounds.extent[1], bounds.extent[2]));
+	const uint32_t groupCount = (instanceCount + sceneGroupSize - 1) / sceneGroupSize;
+	const uint32_t gridSide = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(groupCount))));
+	// a full ring of sceneGroupSize instances fits with a little space between neighbours
+	const float ringRadius = instanceCount > 1 ? meshRadius * 5.5f : 0.0f;
+	const float groupSpacing = ringRadius * 2.0f + meshRadius * 2.5f;
+
+	scene = sceneGraph();
+	spinningGroups.clear();
+	instanceNodes.clear();
+	uint32_t root = scene.addNode(sceneGraph::noParent, translation(-0.5f * (gridSide - 1) * groupSpacing, 0.0f, -0.5f * (gridSide - 1) * groupSpacing));
+	for (uint32_t group = 0, instance = 0; group < groupCount; group++) {
+		nodeTransform groupTransform = translation((group % gridSide) * groupSpacing, 0.0f, (group / gridSide) * groupSpacing);
+		uint32_t groupNode = scene.addNode(root, groupTransform);
+		if (group % 4 == 3) spinningGroups.emplace_back(groupNode, groupTransform);
+		const uint32_t members = std::min(sceneGroupSize, instanceCount - instance);
+		for (uint32_t member = 0; member < members; member++, instance++) {
+			float angle = 6.2831853f * member / members;
+			instanceNodes.push_back(scene.addNode(groupNode, translation(ringRadius * std::cos(angle), 0.0f, ringRadius * std::sin(angle)), instance));
+		}
+	}
+
+	// one full update to find the scene bounds for the camera, also timing the initial sort
+	std::vector<matrix4> worlds(instanceCount);
+	uint64_t version = 0;
+	auto start = std::chrono::steady_clock::now();
+	scene.update(workers, worlds.data(), version);
+	double buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	glm::vec3 low(std::numeric_limits<float>::max()), high(-std::numeric_limits<float>::max());
+	for (const matrix4& world : worlds) {
+		glm::vec3 center;
+		for (int row = 0; row < 3; row++)
+			center[row] = world.m[row] * bounds.center[0] + world.m[4 + row] * bounds.center[1] + world.m[8 + row] * bounds.center[2] + world.m[12 + row];
+		low = glm::min(low, center);
+		high = glm::max(high, center);
+	}
+	sceneCenter = (low + high) * 0.5f;
+	sceneRadius = glm::length(high - low) * 0.5f + meshRadius;
+	if (instanceCount > 1)
+		cout << "Scene: " << instanceCount << " instances in " << groupCount << " groups, " << scene.size() << " nodes, first update "
+			<< buildTime << " ms" << endl;
+}
+
+void app::createInstanceBuffers() {
+	const size_t imageCount = swapchainImages.size();
+	const VkDeviceSize instanceBytes = sizeof(matrix4) * instanceCount;
+	instanceBuffers.resize(imageCount);
+	instanceBuffersMemory.resize(imageCount);
+	instanceBuffersMapped.resize(imageCount);
+	instanceBufferVersions.assign(imageCount, 0); // new buffers get every transform on their first update
+	for (size_t i = 0; i < imageCount; i++) {
+		createBuffer(instanceBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			instanceBuffers[i], instanceBuffersMemory[i], host.swapchainCallbacks());
+		vkMapMemory(device, instanceBuffersMemory[i], 0, instanceBytes, 0, &instanceBuffersMapped[i]);
+	}
+}
+
+void app::cleanupInstanceBuffers() {
+	for (size_t i = 0; i < instanceBuffers.size(); i++) {
+		deletions.destroy(instanceBuffers[i], host.swapchainCallbacks());
+		deletions.destroy(instanceBuffersMemory[i], host.swapchainCallbacks()); // implicitly unmapped
+	}
+}
+
+void app::updateScene(uint32_t imageIndex) {
+	// the animation moves the whole graph forward once per frame, the buffer for this image then catches up on every
+	// change since its last use - with N swapchain images, that's the last N frames' worth of dirty subtrees
+	float time = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+	for (size_t i = 0; i < spinningGroups.size(); i++) {
+		nodeTransform local = spinningGroups[i].second;
+		float halfAngle = 0.5f * (sceneGroupSpinSpeed * time + i); // offset per group, so they don't all turn in step
+		local.rotation[1] = std::sin(halfAngle);
+		local.rotation[3] = std::cos(halfAngle);
+		scene.setLocal(spinningGroups[i].first, local);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	sceneUpdateStats stats = scene.update(workers, static_cast<matrix4*>(instanceBuffersMapped[imageIndex]), instanceBufferVersions[imageIndex]);
+	sceneUpdateAccumulator += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	sceneTransformsWritten += stats.written;
+}
@@ -1,9 +1,59 @@
 #version 450
-layout(location = 0) in vec3 fragColor;
+#extension GL_GOOGLE_include_directive : require
+#define CAMERA_ONLY
+#include "camera.glsl"
+#include "clusters.glsl"
+
+layout(location = 0) in vec3 fragNormal;
+layout(location = 1) in vec3 fragViewDirection;
+layout(location = 2) in vec2 fragTexcoord;
 layout(location = 0) out vec4 outColor;
 
+// material - set per pipeline variant, see materialCount in app.h. Shading models are 0 headlight, 1 banded headlight,
+// 2 normals, 3 texcoord checker, and the palette shifts the hue of the base color
+layout(constant_id = 0) const uint shadingModel = 0;
+layout(constant_id = 1) const uint palette = 0;
+
+// diffuse from the point and spot lights binned into this fragment's cluster by shaders/clusters.comp, with a smooth
+// falloff to zero at each light's range
+vec3 clusteredLighting(vec3 position, vec3 normal) {
+	float depth = camera.clusterDepth.x / gl_FragCoord.z; // reversed-Z infinite projection, z = near / depth
+	uvec2 tile = min(uvec2(gl_FragCoord.xy / camera.clusterScale.zw * vec2(clusterTilesX, clusterTilesY)), uvec2(clusterTilesX - 1u, clusterTilesY - 1u));
+	uvec2 cluster = clusters[clusterIndex(tile, clusterSlice(depth))];
+	vec3 result = vec3(0.0);
+	for (uint i = 0; i < cluster.y; i++) {
+		pointLight light = lights[lightIndices[cluster.x + i]];
+		vec3 toLight = light.position.xyz - position;
+		float range2 = light.position.w * light.position.w;
+		float distance2 = dot(toLight, toLight);
+		if (distance2 >= range2)
+			continue;
+		vec3 direction = toLight * inversesqrt(distance2);
+		float falloff = 1.0 - distance2 / range2;
+		float attenuation = falloff * falloff;
+		if (light.direction.w > -1.0) // spot, fading out over the outer fifth of the cone
+			attenuation *= smoothstep(light.direction.w, mix(light.direction.w, 1.0, 0.2), dot(-direction, light.direction.xyz));
+		result += light.color.rgb * attenuation * max(dot(normal, direction), 0.0);
+	}
+	return result;
+}
+
 void main() {
 	// if(int(gl_FragCoord.x)%2==0&&int(gl_FragCoord.y)%2==0)
 		// discard;
-	outColor = vec4(fragColor, 1.0);
+	// headlight shading, with a palette color picked by the texcoord - for the overdraw benchmark, u is the layer
+	vec3 phase = vec3(0.0, 0.33, 0.67) + float(palette) * 0.125;
+	vec3 baseColor = 0.5 + 0.5 * cos(6.2831853 * (fragTexcoord.x + 0.5 * fragTexcoord.y + phase));
+	float lighting = 0.25 + 0.75 * abs(dot(normalize(fragNormal), normalize(fragViewDirection)));
+	if (shadingModel == 1)
+		lighting = floor(lighting * 4.0) / 4.0;
+	else if (shadingModel == 2)
+		baseColor = 0.5 + 0.5 * normalize(fragNormal);
+	else if (shadingModel == 3)
+		baseColor *= 0.5 + 0.5 * float((int(floor(fragTexcoord.x * 16.0)) + int(floor(fragTexcoord.y * 16.0))) & 1);
+	// lit from the viewer's side, like the headlight
+	vec3 normal = normalize(fragNormal);
+	if (dot(normal, fragViewDirection) < 0.0)
+		normal = -normal;
+	outColor = vec4(baseColor * (lighting + clusteredLighting(camera.cameraPosition.xyz - fragViewDirection, normal)), 1.0);
 }
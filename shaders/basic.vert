@@ -1,19 +1,22 @@
 #version 450
-layout(location = 0) out vec3 fragColor;
+#extension GL_GOOGLE_include_directive : require
+#include "camera.glsl"
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec4 inNormal;
+layout(location = 2) in vec2 inTexcoord;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(location = 0) out vec3 fragNormal;
+layout(location = 1) out vec3 fragViewDirection;
+layout(location = 2) out vec2 fragTexcoord;
+
+// has to match the depth pre-pass exactly, for the EQUAL depth test
+invariant gl_Position;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+	vec4 position = worldPosition(inPosition, gl_InstanceIndex);
+	gl_Position = camera.viewProjection * position;
+	fragNormal = mat3(instances[gl_InstanceIndex]) * inNormal.xyz; // instance scale is uniform, normalized per fragment
+	fragViewDirection = camera.cameraPosition.xyz - position.xyz;
+	fragTexcoord = inTexcoord;
 }
@@ -0,0 +1,33 @@
+// camera, instance transforms + mesh dequantization, shared by the color and depth pre-pass vertex shaders so that both
+// produce exactly the same positions - matches cameraUniforms in app.h
+layout(binding = 0) uniform cameraUniformBlock {
+	mat4 viewProjection;
+	vec4 meshCenter;
+	vec4 meshExtent;
+	vec4 cameraPosition;
+	vec4 frustumPlanes[5]; // left, right, bottom, top, near - no far plane with the infinite projection
+	mat4 view; // world to view space, for binning lights into clusters - see shaders/clusters.glsl
+	vec4 clusterDepth; // x near plane, y depth slices per unit of log(depth / near)
+	vec4 clusterScale; // xy view space x and y per unit of depth at the right and top edges, zw framebuffer size in pixels
+	uint lightCount;
+	float time; // seconds since startup
+	float deltaTime; // since the last frame, for exposure adaptation
+} camera;
+
+// positions are stored as R16G16B16A16_SNORM relative to the mesh bounds
+vec3 dequantizePosition(vec4 quantized) {
+	return camera.meshCenter.xyz + quantized.xyz * camera.meshExtent.xyz;
+}
+
+// the particle shaders bind their own buffer to 4, and only take the camera
+#ifndef CAMERA_ONLY
+// world matrix of each instance, written by the scene graph - matches matrix4 in scene.h. Binding 4 in both the graphics
+// and the culling descriptor sets
+layout(std430, binding = 4) readonly buffer instanceBuffer {
+	mat4 instances[];
+};
+
+vec4 worldPosition(vec4 quantized, uint instance) {
+	return instances[instance] * vec4(dequantizePosition(quantized), 1.0);
+}
+#endif
@@ -0,0 +1,42 @@
+// clustered lighting, shared by the binning pass and the color fragment shader - include after camera.glsl. The view
+// frustum is split into clusterTilesX by clusterTilesY screen tiles, and clusterSlices depth slices spaced exponentially
+// from the near plane, so each cluster is roughly as deep as it is wide. Matches the constants in app.h
+const uint clusterTilesX = 16;
+const uint clusterTilesY = 9;
+const uint clusterSlices = 24;
+const uint maxLightsPerCluster = 128;
+
+// the binning pass writes the lists, everything else only reads them
+#ifndef CLUSTER_ACCESS
+#define CLUSTER_ACCESS readonly
+#endif
+
+// matches pointLight in app.h
+struct pointLight {
+	vec4 position; // xyz world space, w range
+	vec4 color; // rgb
+	vec4 direction; // xyz spot axis, w cosine of the cone angle - -1 for point lights
+};
+layout(std430, binding = 5) readonly buffer lightBuffer {
+	pointLight lights[];
+};
+// first index and count of each cluster's run in lightIndices
+layout(std430, binding = 6) CLUSTER_ACCESS buffer clusterBuffer {
+	uvec2 clusters[];
+};
+layout(std430, binding = 7) CLUSTER_ACCESS buffer lightIndexBuffer {
+	uint lightIndices[];
+};
+
+uint clusterIndex(uvec2 tile, uint slice) {
+	return (slice * clusterTilesY + tile.y) * clusterTilesX + tile.x;
+}
+
+// slice boundaries are at near * exp(slice / clusterDepth.y), the last slice reaches on to infinity
+uint clusterSlice(float depth) {
+	return uint(clamp(log(depth / camera.clusterDepth.x) * camera.clusterDepth.y, 0.0, float(clusterSlices - 1u)));
+}
+
+float sliceDepth(uint slice) {
+	return camera.clusterDepth.x * exp(float(slice) / camera.clusterDepth.y);
+}
@@ -0,0 +1,12 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+#include "camera.glsl"
+
+layout(location = 0) in vec4 inPosition;
+
+// position only - used by the depth pre-pass, which has no fragment stage
+invariant gl_Position;
+
+void main() {
+	gl_Position = camera.viewProjection * worldPosition(inPosition, gl_InstanceIndex);
+}
@@ -0,0 +1,12 @@
+#version 450
+layout(location = 0) in vec2 fragCorner;
+layout(location = 1) in vec4 fragColor;
+layout(location = 0) out vec4 outColor;
+
+// round, soft edged sprite - blended over the scene without writing depth
+void main() {
+	float radius2 = dot(fragCorner, fragCorner);
+	if (radius2 > 1.0)
+		discard;
+	outColor = vec4(fragColor.rgb, fragColor.a * (1.0 - radius2));
+}
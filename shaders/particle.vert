@@ -0,0 +1,33 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+#define CAMERA_ONLY
+#include "camera.glsl"
+
+// one camera facing quad per instance, for the particles simulated this frame - see shaders/particles.comp
+struct particle {
+	vec4 position; // xyz, w age in seconds
+	vec4 velocity; // xyz, w lifetime in seconds
+};
+layout(std430, binding = 4) readonly buffer particleBuffer {
+	particle particles[];
+};
+
+layout(location = 0) out vec2 fragCorner;
+layout(location = 1) out vec4 fragColor;
+
+const vec2 corners[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0));
+
+void main() {
+	particle p = particles[gl_InstanceIndex];
+	vec2 corner = corners[gl_VertexIndex];
+	vec3 forward = normalize(p.position.xyz - camera.cameraPosition.xyz);
+	vec3 right = normalize(cross(forward, vec3(0.0, 1.0, 0.0)));
+	vec3 up = cross(right, forward);
+
+	// sized relative to the mesh, shrinking and fading from hot to cold over the particle's life
+	float life = clamp(p.position.w / p.velocity.w, 0.0, 1.0);
+	float size = 0.01 * length(camera.meshExtent.xyz) * (1.0 - 0.5 * life);
+	gl_Position = camera.viewProjection * vec4(p.position.xyz + size * (corner.x * right + corner.y * up), 1.0);
+	fragCorner = corner;
+	fragColor = vec4(mix(vec3(1.0, 0.8, 0.3), vec3(0.3, 0.5, 1.0), life), 1.0 - life);
+}
@@ -0,0 +1,40 @@
+// post-processing, shared by the compute passes of the chain in postProcessing.cc - bindings match the post descriptor
+// set layout there
+
+// luminance histogram over log2 luminance, bin 0 only counts pixels too dark to matter
+const uint histogramBins = 256;
+const float minLogLuminance = -10.0;
+const float logLuminanceRange = 16.0;
+
+// matches postExposure in app.h - persists across frames, the histogram is cleared again by the exposure pass
+layout(std430, binding = 4) buffer exposureBuffer {
+	float adaptedLuminance; // average scene luminance, eased towards each frame's
+	float exposure;
+	uint histogram[histogramBins];
+};
+
+// matches postPushConstants in app.h
+layout(push_constant) uniform postParameters {
+	uint writeNextLevel; // downsampling, if there's a level below the destination
+	uint swapRedBlue; // tonemapping into an RGBA image that gets copied into a BGRA swapchain image
+} parameters;
+
+float luminance(vec3 color) {
+	return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+uint histogramBin(float value) {
+	if (value < exp2(minLogLuminance))
+		return 0u;
+	return uint(clamp((log2(value) - minLogLuminance) / logLuminanceRange, 0.0, 1.0) * float(histogramBins - 2u)) + 1u;
+}
+
+// 3x3 tent around uv, from bilinear taps one texel apart - for adding a lower bloom level back up
+vec3 upsampleTent(sampler2D source, vec2 uv, vec2 texel) {
+	vec3 result = 4.0 * textureLod(source, uv, 0.0).rgb;
+	result += 2.0 * (textureLod(source, uv + vec2(texel.x, 0.0), 0.0).rgb + textureLod(source, uv - vec2(texel.x, 0.0), 0.0).rgb +
+		textureLod(source, uv + vec2(0.0, texel.y), 0.0).rgb + textureLod(source, uv - vec2(0.0, texel.y), 0.0).rgb);
+	result += textureLod(source, uv + texel, 0.0).rgb + textureLod(source, uv - texel, 0.0).rgb +
+		textureLod(source, uv + vec2(texel.x, -texel.y), 0.0).rgb + textureLod(source, uv + vec2(-texel.x, texel.y), 0.0).rgb;
+	return result / 16.0;
+}
@@ -0,0 +1,100 @@
+#include "threadPool.h"
+#include "profiler.h"
+#include <algorithm>
+
+threadPool::threadPool(unsigned threadCount) {
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned i = 1; i < threadCount; i++) // the calling thread makes up the last one
+		workers.emplace_back(&threadPool::workerLoop, this);
+}
+
+threadPool::~threadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void threadPool::submit(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
+		pending++;
+	}
+	jobAvailable.notify_one();
+}
+
+bool threadPool::runOne() {
+	std::function<void()> job;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (jobs.empty()) return false;
+		job = std::move(jobs.front());
+		jobs.pop_front();
+	}
+	{
+		PROFILE_ZONE("job");
+		job();
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--pending == 0) allDone.notify_all();
+	}
+	return true;
+}
+
+void threadPool::workerLoop() {
+	PROFILE_THREAD("worker");
+	for (;;) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobAvailable.wait(lock, [this]{ return stopping || !jobs.empty(); });
+			if (stopping && jobs.empty()) return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		{
+			PROFILE_ZONE("job");
+			job();
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--pending == 0) allDone.notify_all();
+		}
+	}
+}
+
+void threadPool::wait() {
+	while (runOne()); // help drain the queue first
+	std::unique_lock<std::mutex> lock(mutex);
+	allDone.wait(lock, [this]{ return pending == 0; });
+}
+
+void threadPool::parallelFor(size_t count, const std::function<void(size_t, size_t)>& fn, size_t minChunk) {
+	if (count == 0) return;
+
+	// a few chunks per thread evens out the load when chunks don't cost the same
+	size_t chunkCount = std::min<size_t>(std::max<size_t>(count / std::max<size_t>(minChunk, 1), 1), size_t(size()) * 4);
+	if (chunkCount == 1 || workers.empty()) {
+		fn(0, count);
+		return;
+	}
+
+	size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+	std::atomic<size_t> remaining(0);
+	for (size_t begin = chunkSize; begin < count; begin += chunkSize) { // first chunk is kept for this thread
+		remaining++;
+		size_t end = std::min(begin + chunkSize, count);
+		submit([&fn, &remaining, begin, end]{ fn(begin, end); remaining--; });
+	}
+	fn(0, std::min(chunkSize, count));
+
+	// help out with whatever is queued until all of this call's chunks are finished
+	while (remaining.load() != 0)
+		if (!runOne()) std::this_thread::yield();
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+// minimal worker pool - jobs are pulled from a single shared queue. Threads waiting on work (parallelFor, wait) run
+// queued jobs themselves instead of sleeping, so a parallelFor issued from inside a job can't deadlock the pool
+class threadPool {
+public:
+	explicit threadPool(unsigned threadCount = 0); // 0 = one thread per hardware thread, counting the calling thread
+	~threadPool();
+
+	// number of threads doing work, including the one calling parallelFor
+	unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+	// queue a job to run on any worker, use wait() to block until everything submitted has finished
+	void submit(std::function<void()> job);
+	void wait();
+
+	// splits [0, count) into contiguous chunks of at least minChunk elements, runs fn(begin, end) on each, and returns
+	// once every chunk is done
+	void parallelFor(size_t count, const std::function<void(size_t begin, size_t end)>& fn, size_t minChunk = 1);
+
+private:
+	void workerLoop();
+	bool runOne(); // runs a single queued job, returns false if there was nothing to run
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable allDone;
+	size_t pending = 0; // queued + running
+	bool stopping = false;
+};